@@ -0,0 +1,84 @@
+#include "frame_source.h"
+#include "stats.h"
+
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+
+void frame_source_init(frame_source_t *obj, const struct frame_source_ops *ops)
+{
+    memset(obj, 0, sizeof(*obj));
+    obj->ops = ops;
+}
+
+void frame_source_destroy(frame_source_t *obj)
+{
+    if (obj == 0)
+    {
+        return;
+    }
+    obj->ops->destroy(obj);
+}
+
+/* success: 0 */
+int frame_source_start(frame_source_t *obj)
+{
+    return obj->ops->start(obj);
+}
+
+void frame_source_stop(frame_source_t *obj)
+{
+    obj->ops->stop(obj);
+}
+
+void frame_source_set_callback(frame_source_t *obj, frame_source_callback_t callback, void *opaque)
+{
+    obj->callback = callback;
+    obj->opaque = opaque;
+}
+
+const char *frame_source_get_name(frame_source_t *obj)
+{
+    return obj->ops->name;
+}
+
+void frame_source_emit(frame_source_t *obj, const struct frame_source_frame *frame)
+{
+    if (obj->callback)
+    {
+        obj->callback(obj, frame, obj->opaque);
+    }
+}
+
+int frame_source_wait(int event, uint64_t deadline)
+{
+    struct pollfd pfd = { .fd = event, .events = POLLIN };
+
+    for (;;)
+    {
+        uint64_t now = stats_now();
+        struct timespec ts = { 0, 0 };
+
+        if (deadline > now)
+        {
+            ts.tv_sec = (deadline - now) / 1000000000ull;
+            ts.tv_nsec = (deadline - now) % 1000000000ull;
+        }
+
+        int ret = ppoll(&pfd, 1, &ts, 0);
+
+        if (ret > 0)
+        {
+            return 1;
+        }
+        if (ret == 0)
+        {
+            return 0;
+        }
+        // EINTR: 남은 시간만큼 다시 대기
+        if (errno != EINTR)
+        {
+            return 1;
+        }
+    }
+}
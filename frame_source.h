@@ -0,0 +1,67 @@
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <stdint.h>
+
+#include "v4l2_client.h"
+
+struct frame_source;
+typedef struct frame_source frame_source_t;
+
+// 콜백 안에서만 유효, 콜백이 반환되면 data는 재사용됨
+struct frame_source_frame
+{
+    const void *data;
+    unsigned int length;
+    uint64_t sequence;
+    // CLOCK_MONOTONIC, ns
+    uint64_t timestamp;
+    // 원본을 JPEG로 부호화하는 데 걸린 시간 (ns), 0: 부호화하지 않음
+    uint64_t encode_time;
+};
+
+typedef void (*frame_source_callback_t)(frame_source_t *obj, const struct frame_source_frame *frame, void *opaque);
+
+// 구현체(backend)가 채우는 함수 테이블
+struct frame_source_ops
+{
+    const char *name;
+    /* success: 0 */
+    int (*start)(frame_source_t *obj);
+    void (*stop)(frame_source_t *obj);
+    void (*destroy)(frame_source_t *obj);
+};
+
+// 구현체 구조체의 첫 멤버로 둠
+struct frame_source
+{
+    const struct frame_source_ops *ops;
+
+    void *opaque;
+    frame_source_callback_t callback;
+};
+
+// client 소유권을 가져감, 설정은 생성 전에 client에 해둘 것
+// quality, threads: YUYV 캡처를 JPEG로 부호화할 때 사용 (jpeg_encoder_create)
+frame_source_t *frame_source_v4l2_create(v4l2_client_t *client, int quality, int threads);
+// size: 목표 프레임 크기 (작으면 패딩하지 않음), fps 0: 최대 속도
+frame_source_t *frame_source_synthetic_create(unsigned int width, unsigned int height, unsigned int size, unsigned int fps);
+// path: MJPEG 파일 또는 JPEG 파일 디렉토리
+// fps 0: 원래 타이밍 (디렉토리는 파일 수정 시각, 파일은 30fps), fast: 대기 없이 최대 속도
+frame_source_t *frame_source_replay_create(const char *path, unsigned int fps, int fast);
+
+void frame_source_destroy(frame_source_t *obj);
+
+/* success: 0 */
+int frame_source_start(frame_source_t *obj);
+void frame_source_stop(frame_source_t *obj);
+void frame_source_set_callback(frame_source_t *obj, frame_source_callback_t callback, void *opaque);
+const char *frame_source_get_name(frame_source_t *obj);
+
+// 구현체에서 사용
+void frame_source_init(frame_source_t *obj, const struct frame_source_ops *ops);
+void frame_source_emit(frame_source_t *obj, const struct frame_source_frame *frame);
+// deadline(CLOCK_MONOTONIC, ns)까지 대기, event가 먼저 오면 1
+int frame_source_wait(int event, uint64_t deadline);
+
+#endif
@@ -0,0 +1,497 @@
+#include "frame_source.h"
+#include "jpeg_writer.h"
+#include "logging.h"
+#include "stats.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+// 녹화된 MJPEG 파일(연결된 JPEG 또는 multipart 스트림) 또는 JPEG 파일 디렉토리를 반복 재생
+
+#define REPLAY_DEFAULT_FPS 30
+// 디렉토리 재생 시 파일 시각 차이의 상한
+#define REPLAY_MAX_DELAY 1000000000ull
+
+struct replay_item
+{
+    // 파일: data 내 위치, 디렉토리: 파일 이름
+    size_t offset;
+    size_t length;
+    char *name;
+    // 파일 수정 시각 (CLOCK_REALTIME, ns)
+    uint64_t time;
+};
+
+struct frame_source_replay
+{
+    struct frame_source base;
+
+    char *path;
+    unsigned int fps;
+    int fast;
+
+    // MJPEG 파일
+    uint8_t *data;
+    size_t size;
+
+    struct replay_item *items;
+    unsigned int count;
+    unsigned int available;
+
+    // 디렉토리 재생 시 읽기 버퍼
+    uint8_t *buffer;
+    size_t buffer_size;
+
+    int stop;
+    int event;
+    pthread_t thread;
+};
+
+static int replay_add_item(struct frame_source_replay *obj, struct replay_item *item)
+{
+    if (obj->count == obj->available)
+    {
+        unsigned int available = obj->available ? obj->available * 2 : 64;
+        struct replay_item *items = realloc(obj->items, available * sizeof(*items));
+
+        if (items == 0)
+        {
+            return 1;
+        }
+        obj->items = items;
+        obj->available = available;
+    }
+    obj->items[obj->count++] = *item;
+
+    return 0;
+}
+
+// 마커 구조를 따라가며 SOI ~ EOI 범위를 찾음
+// APP 세그먼트 안의 썸네일 JPEG에 속지 않도록 단순 바이트 검색은 하지 않음
+/* found: 0 */
+static int replay_find_frame(const uint8_t *data, size_t size, size_t *offset, size_t *length)
+{
+    size_t start = *offset;
+
+    for (;;)
+    {
+        while (start + 1 < size && (data[start] != 0xff || data[start + 1] != JPEG_SOI))
+        {
+            start++;
+        }
+        if (start + 1 >= size)
+        {
+            return 1;
+        }
+
+        size_t pos = start + 2;
+        int scan = 0;
+
+        while (pos + 1 < size)
+        {
+            if (scan)
+            {
+                // 엔트로피 데이터: 0xFF00과 RSTn은 건너뜀
+                if (data[pos] != 0xff)
+                {
+                    pos++;
+                    continue;
+                }
+
+                uint8_t next = data[pos + 1];
+
+                if (next == 0 || (next >= JPEG_RST0 && next <= JPEG_RST0 + 7) || next == 0xff)
+                {
+                    pos += next == 0xff ? 1 : 2;
+                    continue;
+                }
+                scan = 0;
+            }
+            if (data[pos] != 0xff)
+            {
+                break;
+            }
+
+            uint8_t marker = data[pos + 1];
+
+            if (marker == 0xff)
+            {
+                pos++;
+                continue;
+            }
+            if (marker == JPEG_EOI)
+            {
+                *offset = start;
+                *length = pos + 2 - start;
+                return 0;
+            }
+            if (marker == 0x01 || (marker >= JPEG_RST0 && marker <= JPEG_RST0 + 7))
+            {
+                pos += 2;
+                continue;
+            }
+            if (pos + 3 >= size)
+            {
+                break;
+            }
+
+            size_t segment = (data[pos + 2] << 8) | data[pos + 3];
+
+            if (segment < 2)
+            {
+                break;
+            }
+            pos += 2 + segment;
+            if (marker == JPEG_SOS)
+            {
+                scan = 1;
+            }
+        }
+        // 깨진 프레임, 다음 SOI부터 다시 찾음
+        start++;
+    }
+}
+
+/* success: 0 */
+static int replay_open_file(struct frame_source_replay *obj, int fd, size_t size)
+{
+    size_t offset = 0;
+    size_t length;
+
+    if (size == 0)
+    {
+        return 1;
+    }
+    obj->data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (obj->data == MAP_FAILED)
+    {
+        obj->data = 0;
+        return 1;
+    }
+    obj->size = size;
+
+    while (replay_find_frame(obj->data, obj->size, &offset, &length) == 0)
+    {
+        struct replay_item item = { .offset = offset, .length = length };
+
+        if (replay_add_item(obj, &item))
+        {
+            return 1;
+        }
+        offset += length;
+    }
+    return obj->count == 0;
+}
+
+static int replay_filter(const struct dirent *entry)
+{
+    const char *ext = strrchr(entry->d_name, '.');
+
+    if (ext == 0)
+    {
+        return 0;
+    }
+    return strcasecmp(ext, ".jpg") == 0 || strcasecmp(ext, ".jpeg") == 0;
+}
+
+/* success: 0 */
+static int replay_open_directory(struct frame_source_replay *obj)
+{
+    struct dirent **entries;
+    int failed = 0;
+    int count = scandir(obj->path, &entries, replay_filter, alphasort);
+
+    if (count < 0)
+    {
+        return 1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        struct replay_item item = { 0 };
+        struct stat st;
+        char path[4096];
+
+        snprintf(path, sizeof(path), "%s/%s", obj->path, entries[i]->d_name);
+        if (failed == 0 && stat(path, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            item.name = strdup(path);
+            item.length = st.st_size;
+            item.time = (uint64_t)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+            if (item.name == 0 || replay_add_item(obj, &item))
+            {
+                free(item.name);
+                failed = 1;
+            }
+        }
+        free(entries[i]);
+    }
+    free(entries);
+
+    return failed || obj->count == 0;
+}
+
+/* success: 0 */
+static int replay_read_item(struct frame_source_replay *obj, struct replay_item *item, const void **data, size_t *length)
+{
+    if (item->name == 0)
+    {
+        *data = obj->data + item->offset;
+        *length = item->length;
+        return 0;
+    }
+
+    int fd = open(item->name, O_RDONLY);
+    size_t size = 0;
+
+    if (fd == -1)
+    {
+        return 1;
+    }
+    for (;;)
+    {
+        if (size == obj->buffer_size)
+        {
+            size_t buffer_size = obj->buffer_size ? obj->buffer_size * 2 : 1 << 20;
+            uint8_t *buffer = realloc(obj->buffer, buffer_size);
+
+            if (buffer == 0)
+            {
+                close(fd);
+                return 1;
+            }
+            obj->buffer = buffer;
+            obj->buffer_size = buffer_size;
+        }
+
+        ssize_t len = read(fd, obj->buffer + size, obj->buffer_size - size);
+
+        if (len < 0)
+        {
+            close(fd);
+            return 1;
+        }
+        if (len == 0)
+        {
+            break;
+        }
+        size += len;
+    }
+    close(fd);
+
+    *data = obj->buffer;
+    *length = size;
+
+    return 0;
+}
+
+static uint64_t replay_delay(struct frame_source_replay *obj, unsigned int index)
+{
+    uint64_t period = 1000000000ull / (obj->fps ? obj->fps : REPLAY_DEFAULT_FPS);
+
+    if (obj->fast)
+    {
+        return 0;
+    }
+    // 디렉토리는 파일 수정 시각 차이로 원래 타이밍을 재현
+    if (obj->fps == 0 && obj->items[index].name && index + 1 < obj->count)
+    {
+        uint64_t time = obj->items[index].time;
+        uint64_t next = obj->items[index + 1].time;
+
+        if (next < time)
+        {
+            return 0;
+        }
+        return next - time > REPLAY_MAX_DELAY ? REPLAY_MAX_DELAY : next - time;
+    }
+    return period;
+}
+
+static void *frame_source_replay_main(void *arg)
+{
+    struct frame_source_replay *obj = arg;
+    uint64_t deadline = stats_now();
+    uint64_t sequence = 0;
+    unsigned int index = 0;
+
+    while (obj->stop == 0)
+    {
+        const void *data;
+        size_t length;
+
+        if (replay_read_item(obj, &obj->items[index], &data, &length) == 0)
+        {
+            struct frame_source_frame frame =
+            {
+                .data = data,
+                .length = length,
+                .sequence = sequence++,
+                .timestamp = stats_now(),
+            };
+
+            frame_source_emit(&obj->base, &frame);
+        }
+
+        uint64_t delay = replay_delay(obj, index);
+
+        index = (index + 1) % obj->count;
+        if (delay)
+        {
+            deadline += delay;
+            if (stats_now() > deadline + delay)
+            {
+                deadline = stats_now();
+            }
+        }
+        else
+        {
+            deadline = 0;
+        }
+        if (frame_source_wait(obj->event, deadline))
+        {
+            break;
+        }
+    }
+    logging("replay stopped");
+
+    return 0;
+}
+
+static void frame_source_replay_stop(frame_source_t *base)
+{
+    struct frame_source_replay *obj = (struct frame_source_replay *)base;
+
+    if (obj->thread)
+    {
+        uint64_t u = 1;
+
+        obj->stop = 1;
+
+        write(obj->event, &u, sizeof(u));
+
+        pthread_join(obj->thread, 0);
+        obj->thread = 0;
+    }
+    if (obj->event != -1)
+    {
+        close(obj->event);
+        obj->event = -1;
+    }
+}
+
+static int frame_source_replay_start(frame_source_t *base)
+{
+    struct frame_source_replay *obj = (struct frame_source_replay *)base;
+
+    if (obj->event != -1)
+    {
+        return 1;
+    }
+
+    obj->stop = 0;
+    obj->event = eventfd(0, 0);
+    if (obj->event == -1)
+    {
+        return 1;
+    }
+    if (pthread_create(&obj->thread, 0, &frame_source_replay_main, obj) != 0)
+    {
+        obj->thread = 0;
+        frame_source_replay_stop(base);
+        return 1;
+    }
+    logging("replay %s: %u frames, %s", obj->path, obj->count, obj->fast ? "fast" : "realtime");
+
+    return 0;
+}
+
+static void frame_source_replay_destroy(frame_source_t *base)
+{
+    struct frame_source_replay *obj = (struct frame_source_replay *)base;
+
+    frame_source_replay_stop(base);
+
+    for (unsigned int i = 0; i < obj->count; i++)
+    {
+        free(obj->items[i].name);
+    }
+    free(obj->items);
+    free(obj->buffer);
+    if (obj->data)
+    {
+        munmap(obj->data, obj->size);
+    }
+    free(obj->path);
+    free(obj);
+}
+
+static const struct frame_source_ops frame_source_replay_ops =
+{
+    .name = "replay",
+    .start = frame_source_replay_start,
+    .stop = frame_source_replay_stop,
+    .destroy = frame_source_replay_destroy,
+};
+
+frame_source_t *frame_source_replay_create(const char *path, unsigned int fps, int fast)
+{
+    struct frame_source_replay *obj;
+    struct stat st;
+    int failed;
+
+    if (path == 0)
+    {
+        return 0;
+    }
+    obj = malloc(sizeof(*obj));
+    if (obj == 0)
+    {
+        return 0;
+    }
+    memset(obj, 0, sizeof(*obj));
+    frame_source_init(&obj->base, &frame_source_replay_ops);
+    obj->fps = fps;
+    obj->fast = fast;
+    obj->event = -1;
+    obj->path = strdup(path);
+    if (obj->path == 0)
+    {
+        frame_source_replay_destroy(&obj->base);
+        return 0;
+    }
+
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        failed = 1;
+    }
+    else if (S_ISDIR(st.st_mode))
+    {
+        failed = replay_open_directory(obj);
+    }
+    else
+    {
+        failed = replay_open_file(obj, fd, st.st_size);
+    }
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    if (failed)
+    {
+        logging("replay %s: no frames", path);
+        frame_source_replay_destroy(&obj->base);
+        return 0;
+    }
+    return &obj->base;
+}
@@ -0,0 +1,331 @@
+#include "frame_source.h"
+#include "jpeg_writer.h"
+#include "logging.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+// 카메라 없이 부하 테스트를 하기 위한 프레임 생성기
+// DC 계수만 있는 baseline JPEG (YCbCr 4:2:2)을 만들고 COM 세그먼트로 목표 크기까지 채움
+// 움직이는 그라데이션과 상자를 그려서 움직임 감지 등에도 사용 가능
+
+#define SYNTHETIC_QUANT 16
+// 무늬가 반복되는 주기 (프레임), 그라데이션(48), 색차(16) 주기의 배수
+// 엔트로피 부호화한 스캔을 주기만큼 캐시하여 생성기가 부하 테스트의 병목이 되지 않도록 함
+#define SYNTHETIC_FRAMES 96
+
+struct frame_source_synthetic
+{
+    struct frame_source base;
+
+    unsigned int width;
+    unsigned int height;
+    unsigned int size;
+    unsigned int fps;
+
+    int stop;
+    int event;
+    pthread_t thread;
+
+    struct jpeg_writer head;
+    // 주기 안의 위치별 스캔, length 0: 아직 만들지 않음
+    struct jpeg_writer scans[SYNTHETIC_FRAMES];
+};
+
+static const struct jpeg_component synthetic_components[3] =
+{
+    { .id = 1, .h = 2, .v = 1, .tq = 0, .td = 0, .ta = 0 },
+    { .id = 2, .h = 1, .v = 1, .tq = 0, .td = 1, .ta = 1 },
+    { .id = 3, .h = 1, .v = 1, .tq = 0, .td = 1, .ta = 1 },
+};
+
+// 0 ~ period 사이를 왕복
+static unsigned int triangle(uint64_t value, unsigned int period)
+{
+    if (period == 0)
+    {
+        return 0;
+    }
+    value %= 2 * period;
+
+    return value < period ? value : 2 * period - value;
+}
+
+// phase: 주기 안의 위치 (0 ~ SYNTHETIC_FRAMES - 1)
+static void synthetic_write_scan(struct frame_source_synthetic *obj, struct jpeg_writer *writer, unsigned int phase)
+{
+    const struct jpeg_huffman *dc_luma = jpeg_std_huffman(0);
+    const struct jpeg_huffman *dc_chroma = jpeg_std_huffman(1);
+    const struct jpeg_huffman *ac_luma = jpeg_std_huffman(2);
+    const struct jpeg_huffman *ac_chroma = jpeg_std_huffman(3);
+    unsigned int columns = (obj->width + 15) / 16;
+    unsigned int rows = (obj->height + 7) / 8;
+    // 상자 크기와 위치 (8x8 블록 단위), 주기 동안 가로로 한번, 세로로 두번 왕복
+    unsigned int box_width = columns * 2 / 8 + 1;
+    unsigned int box_height = rows / 4 + 1;
+    unsigned int box_x = triangle(phase, SYNTHETIC_FRAMES / 2) * (columns * 2 - box_width) / (SYNTHETIC_FRAMES / 2);
+    unsigned int box_y = triangle(phase, SYNTHETIC_FRAMES / 4) * (rows - box_height) / (SYNTHETIC_FRAMES / 4);
+    int16_t block[64] = { 0 };
+    int pred[3] = { 0, 0, 0 };
+
+    jpeg_writer_reset(writer);
+
+    for (unsigned int y = 0; y < rows; y++)
+    {
+        for (unsigned int x = 0; x < columns; x++)
+        {
+            for (int i = 0; i < 2; i++)
+            {
+                unsigned int bx = x * 2 + i;
+                int value;
+
+                if (bx >= box_x && bx < box_x + box_width && y >= box_y && y < box_y + box_height)
+                {
+                    value = 235;
+                }
+                else
+                {
+                    value = 16 + ((bx + y + phase) * 4) % 192;
+                }
+                // 평탄한 블록의 DC = 8 * (value - 128)
+                block[0] = (value - 128) * 8 / SYNTHETIC_QUANT;
+                jpeg_write_block(writer, block, &pred[0], dc_luma, ac_luma);
+            }
+
+            block[0] = ((int)((x * 4 + phase) % 64) - 32) * 8 / SYNTHETIC_QUANT;
+            jpeg_write_block(writer, block, &pred[1], dc_chroma, ac_chroma);
+            block[0] = ((int)((y * 4) % 64) - 32) * 8 / SYNTHETIC_QUANT;
+            jpeg_write_block(writer, block, &pred[2], dc_chroma, ac_chroma);
+        }
+    }
+    jpeg_write_flush(writer);
+}
+
+static void synthetic_write_padding(struct jpeg_writer *writer, size_t length)
+{
+    while (length >= 4)
+    {
+        size_t segment = length - 4;
+
+        if (segment > 65533)
+        {
+            segment = 65533;
+        }
+        // 다음 세그먼트가 4바이트 미만으로 남지 않도록
+        if (length - 4 - segment > 0 && length - 4 - segment < 4)
+        {
+            segment -= 4;
+        }
+        jpeg_write_marker(writer, JPEG_COM);
+        jpeg_write_word(writer, segment + 2);
+        if (jpeg_writer_reserve(writer, segment) == 0)
+        {
+            memset(writer->data + writer->length, 0, segment);
+            writer->length += segment;
+        }
+        length -= segment + 4;
+    }
+}
+
+// 캐시한 스캔, 없으면 만들어서 캐시
+/* failed: 0 */
+static const struct jpeg_writer *synthetic_get_scan(struct frame_source_synthetic *obj, uint64_t sequence)
+{
+    struct jpeg_writer *scan = &obj->scans[sequence % SYNTHETIC_FRAMES];
+
+    if (scan->length == 0)
+    {
+        synthetic_write_scan(obj, scan, sequence % SYNTHETIC_FRAMES);
+    }
+    return scan->failed ? 0 : scan;
+}
+
+// 스캔 앞에 시각을 담은 헤더를 붙여 프레임 완성
+static int synthetic_build(struct frame_source_synthetic *obj, const struct jpeg_writer *scan, uint64_t sequence, uint64_t timestamp)
+{
+    static const uint8_t jfif[] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+    struct jpeg_writer *writer = &obj->head;
+    char comment[96];
+    int comment_length;
+    uint8_t table[64];
+    size_t length;
+
+    jpeg_writer_reset(writer);
+    jpeg_write_marker(writer, JPEG_SOI);
+    jpeg_write_segment(writer, JPEG_APP0, jfif, sizeof(jfif));
+
+    // 벤치마크에서 지연 시간 계산에 사용
+    comment_length = snprintf(comment, sizeof(comment), "synthetic sequence=%llu timestamp=%llu",
+        (unsigned long long)sequence, (unsigned long long)timestamp);
+    jpeg_write_segment(writer, JPEG_COM, comment, comment_length);
+
+    memset(table, SYNTHETIC_QUANT, sizeof(table));
+    jpeg_write_dqt(writer, 0, table);
+    jpeg_write_sof0(writer, obj->width, obj->height, synthetic_components, 3);
+    jpeg_write_std_dht(writer);
+
+    // SOS 헤더 (2 + 12) + 스캔 + EOI
+    length = writer->length + 14 + scan->length + 2;
+    if (obj->size > length)
+    {
+        synthetic_write_padding(writer, obj->size - length);
+    }
+
+    jpeg_write_sos(writer, synthetic_components, 3);
+    jpeg_write_data(writer, scan->data, scan->length);
+    jpeg_write_marker(writer, JPEG_EOI);
+
+    return writer->failed;
+}
+
+static void *frame_source_synthetic_main(void *arg)
+{
+    struct frame_source_synthetic *obj = arg;
+    uint64_t period = obj->fps ? 1000000000ull / obj->fps : 0;
+    uint64_t deadline = stats_now();
+    uint64_t sequence = 0;
+
+    while (obj->stop == 0)
+    {
+        // 캡처 시각은 스캔을 만든 후에 기록 (첫 주기에는 스캔 생성이 오래 걸림)
+        const struct jpeg_writer *scan = synthetic_get_scan(obj, sequence);
+        uint64_t timestamp = stats_now();
+
+        if (scan == 0 || synthetic_build(obj, scan, sequence, timestamp))
+        {
+            logging("synthetic: out of memory");
+            break;
+        }
+
+        struct frame_source_frame frame =
+        {
+            .data = obj->head.data,
+            .length = obj->head.length,
+            .sequence = sequence,
+            .timestamp = timestamp,
+        };
+
+        frame_source_emit(&obj->base, &frame);
+        sequence++;
+
+        if (period)
+        {
+            deadline += period;
+            // 한 주기 이상 밀렸으면 몰아서 보내지 않고 기준을 다시 잡음
+            if (stats_now() > deadline + period)
+            {
+                deadline = stats_now();
+            }
+        }
+        if (frame_source_wait(obj->event, deadline))
+        {
+            break;
+        }
+    }
+    logging("synthetic stopped");
+
+    return 0;
+}
+
+static void frame_source_synthetic_stop(frame_source_t *base)
+{
+    struct frame_source_synthetic *obj = (struct frame_source_synthetic *)base;
+
+    if (obj->thread)
+    {
+        uint64_t u = 1;
+
+        obj->stop = 1;
+
+        write(obj->event, &u, sizeof(u));
+
+        pthread_join(obj->thread, 0);
+        obj->thread = 0;
+    }
+    if (obj->event != -1)
+    {
+        close(obj->event);
+        obj->event = -1;
+    }
+}
+
+static int frame_source_synthetic_start(frame_source_t *base)
+{
+    struct frame_source_synthetic *obj = (struct frame_source_synthetic *)base;
+
+    if (obj->event != -1)
+    {
+        return 1;
+    }
+
+    obj->stop = 0;
+    obj->event = eventfd(0, 0);
+    if (obj->event == -1)
+    {
+        return 1;
+    }
+    if (pthread_create(&obj->thread, 0, &frame_source_synthetic_main, obj) != 0)
+    {
+        obj->thread = 0;
+        frame_source_synthetic_stop(base);
+        return 1;
+    }
+    logging("synthetic size: %ux%u, frame: %u bytes, fps: %u", obj->width, obj->height, obj->size, obj->fps);
+
+    return 0;
+}
+
+static void frame_source_synthetic_destroy(frame_source_t *base)
+{
+    struct frame_source_synthetic *obj = (struct frame_source_synthetic *)base;
+
+    frame_source_synthetic_stop(base);
+    jpeg_writer_free(&obj->head);
+    for (int i = 0; i < SYNTHETIC_FRAMES; i++)
+    {
+        jpeg_writer_free(&obj->scans[i]);
+    }
+    free(obj);
+}
+
+static const struct frame_source_ops frame_source_synthetic_ops =
+{
+    .name = "synthetic",
+    .start = frame_source_synthetic_start,
+    .stop = frame_source_synthetic_stop,
+    .destroy = frame_source_synthetic_destroy,
+};
+
+frame_source_t *frame_source_synthetic_create(unsigned int width, unsigned int height, unsigned int size, unsigned int fps)
+{
+    struct frame_source_synthetic *obj;
+
+    if (width < 16 || height < 16 || width > 65535 || height > 65535)
+    {
+        return 0;
+    }
+    obj = malloc(sizeof(*obj));
+    if (obj == 0)
+    {
+        return 0;
+    }
+    memset(obj, 0, sizeof(*obj));
+    frame_source_init(&obj->base, &frame_source_synthetic_ops);
+    obj->width = width;
+    obj->height = height;
+    obj->size = size;
+    obj->fps = fps;
+    obj->event = -1;
+    jpeg_writer_init(&obj->head);
+    for (int i = 0; i < SYNTHETIC_FRAMES; i++)
+    {
+        jpeg_writer_init(&obj->scans[i]);
+    }
+
+    return &obj->base;
+}
@@ -0,0 +1,138 @@
+#include "frame_source.h"
+#include "jpeg_encoder.h"
+#include "logging.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <linux/videodev2.h>
+
+struct frame_source_v4l2
+{
+    struct frame_source base;
+
+    v4l2_client_t *client;
+    // 드라이버 sequence(32bit)를 64bit로 확장
+    uint64_t sequence;
+    uint32_t last;
+    int started;
+
+    // YUYV 캡처일 때만 생성
+    int quality;
+    int threads;
+    jpeg_encoder_t *encoder;
+};
+
+static void frame_source_v4l2_callback(v4l2_client_t *client, void *opaque)
+{
+    struct frame_source_v4l2 *obj = opaque;
+    uint32_t sequence = v4l2_client_get_buffer_sequence(client);
+    uint64_t timestamp = v4l2_client_get_buffer_timestamp(client);
+
+    obj->sequence = obj->started ? obj->sequence + (uint32_t)(sequence - obj->last) : sequence;
+    obj->last = sequence;
+    obj->started = 1;
+
+    struct frame_source_frame frame =
+    {
+        .data = v4l2_client_get_buffer(client),
+        .length = v4l2_client_get_buffer_length(client),
+        .sequence = obj->sequence,
+        // 드라이버 시각을 쓸 수 없으면 받은 시각
+        .timestamp = timestamp ? timestamp : stats_now(),
+    };
+
+    if (obj->encoder)
+    {
+        unsigned int width = v4l2_client_get_width(client);
+        unsigned int height = v4l2_client_get_height(client);
+        unsigned int stride = v4l2_client_get_stride(client);
+        uint64_t start = stats_now();
+        const void *data;
+        size_t length;
+
+        if (stride == 0)
+        {
+            stride = width * 2;
+        }
+        // 덜 채워진 버퍼는 버림
+        if (frame.length < (size_t)stride * (height - 1) + width * 2 || jpeg_encoder_encode_yuyv(obj->encoder, frame.data, width, height, stride, &data, &length))
+        {
+            logging("v4l2 yuyv frame not encoded (sequence: %llu, bytes: %u)", (unsigned long long)obj->sequence, frame.length);
+            return;
+        }
+        frame.data = data;
+        frame.length = length;
+        frame.encode_time = stats_now() - start;
+    }
+
+    frame_source_emit(&obj->base, &frame);
+}
+
+static int frame_source_v4l2_start(frame_source_t *base)
+{
+    struct frame_source_v4l2 *obj = (struct frame_source_v4l2 *)base;
+
+    obj->started = 0;
+
+    if (v4l2_client_get_format(obj->client) == V4L2_PIX_FMT_YUYV && obj->encoder == 0)
+    {
+        obj->encoder = jpeg_encoder_create(obj->quality, obj->threads);
+        if (obj->encoder == 0)
+        {
+            return 1;
+        }
+        logging("jpeg encoder: quality: %d, threads: %d, simd: %s", jpeg_encoder_get_quality(obj->encoder), jpeg_encoder_get_threads(obj->encoder), jpeg_encoder_get_simd());
+    }
+
+    return v4l2_client_start(obj->client);
+}
+
+static void frame_source_v4l2_stop(frame_source_t *base)
+{
+    struct frame_source_v4l2 *obj = (struct frame_source_v4l2 *)base;
+
+    v4l2_client_stop(obj->client);
+}
+
+static void frame_source_v4l2_destroy(frame_source_t *base)
+{
+    struct frame_source_v4l2 *obj = (struct frame_source_v4l2 *)base;
+
+    v4l2_client_destroy(obj->client);
+    jpeg_encoder_destroy(obj->encoder);
+    free(obj);
+}
+
+static const struct frame_source_ops frame_source_v4l2_ops =
+{
+    .name = "v4l2",
+    .start = frame_source_v4l2_start,
+    .stop = frame_source_v4l2_stop,
+    .destroy = frame_source_v4l2_destroy,
+};
+
+frame_source_t *frame_source_v4l2_create(v4l2_client_t *client, int quality, int threads)
+{
+    struct frame_source_v4l2 *obj;
+
+    if (client == 0)
+    {
+        return 0;
+    }
+    obj = malloc(sizeof(*obj));
+    if (obj == 0)
+    {
+        v4l2_client_destroy(client);
+        return 0;
+    }
+    memset(obj, 0, sizeof(*obj));
+    frame_source_init(&obj->base, &frame_source_v4l2_ops);
+    obj->client = client;
+    obj->quality = quality;
+    obj->threads = threads;
+
+    v4l2_client_set_callback(client, frame_source_v4l2_callback, obj);
+
+    return &obj->base;
+}
@@ -0,0 +1,1144 @@
+#include "jpeg_decoder.h"
+#include "jpeg_writer.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// baseline(SOF0/SOF1) 허프만 JPEG만 지원, 스캔 하나에 모든 성분이 있어야 함
+// UVC 카메라의 MJPEG은 DHT를 생략하므로 정의되지 않은 테이블은 표준 테이블 사용
+
+#define MAX_COMPONENTS 3
+// 허프만 미리보기 비트 수
+#define LOOK_BITS 9
+
+struct jpeg_decoder_component
+{
+    uint8_t id;
+    uint8_t h;
+    uint8_t v;
+    uint8_t tq;
+    uint8_t td;
+    uint8_t ta;
+    int pred;
+
+    // MCU 격자 기준 블록 수
+    unsigned int blocks_w;
+    unsigned int blocks_h;
+};
+
+struct jpeg_decoder_huffman
+{
+    // (코드 길이 << 8) | 심볼, 0: LOOK_BITS보다 긴 코드
+    uint16_t look[1 << LOOK_BITS];
+    // 길이별 마지막 코드 (없으면 -1), 길이별 첫 심볼 위치 - 첫 코드
+    int32_t maxcode[17];
+    int32_t valoffset[17];
+    uint8_t vals[256];
+    int defined;
+};
+
+struct jpeg_decoder_plane
+{
+    uint8_t *data;
+    unsigned int width;
+    unsigned int height;
+    size_t available;
+};
+
+struct jpeg_decoder_target
+{
+    // 역변환 크기 (8 / scale)
+    int size;
+    // 성분별 평면 (MCU 격자 크기)
+    struct jpeg_decoder_plane planes[MAX_COMPONENTS];
+
+    uint8_t *yuyv;
+    size_t available;
+};
+
+struct jpeg_decoder_rewriter
+{
+    // 옮길 MCU 범위 [begin, end)
+    unsigned int column_begin;
+    unsigned int column_end;
+    unsigned int row_begin;
+    unsigned int row_end;
+    int pred[MAX_COMPONENTS];
+
+    // 밝기 성분만 비인터리브 스캔으로 부호화, MCU 한 행의 블록을 모아 블록 행 순서로 출력
+    int gray;
+    unsigned int block_columns;
+    unsigned int block_rows;
+    unsigned int block_row;
+    int16_t *blocks;
+    size_t blocks_available;
+
+    struct jpeg_writer writer;
+};
+
+struct jpeg_decoder
+{
+    unsigned int width;
+    unsigned int height;
+    int count;
+    struct jpeg_decoder_component components[MAX_COMPONENTS];
+    int hmax;
+    int vmax;
+    unsigned int mcu_columns;
+    unsigned int mcu_rows;
+    unsigned int restart_interval;
+
+    // 행 우선 순서
+    uint16_t quant[4][64];
+    // 정의된 양자화 테이블 (비트), 16비트 테이블이 있는지
+    unsigned int quant_defined;
+    int quant_extended;
+    struct jpeg_decoder_huffman dc[4];
+    struct jpeg_decoder_huffman ac[4];
+
+    // 엔트로피 데이터 읽기, 상위 비트부터 사용
+    const uint8_t *p;
+    const uint8_t *end;
+    uint64_t bits;
+    int bit_count;
+
+    // 크기 N의 역변환 행렬 [N][x][u], N = 1, 2, 4, 8
+    float idct[4][8][8];
+
+    int target_count;
+    struct jpeg_decoder_target targets[JPEG_DECODER_MAX_OUTPUTS];
+
+    int rewriter_count;
+    struct jpeg_decoder_rewriter rewriters[JPEG_DECODER_MAX_REWRITES];
+};
+
+// rewrite는 양자화된 계수를 그대로 사용
+static const uint16_t unit_quant[64] =
+{
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+};
+
+static void huffman_build(struct jpeg_decoder_huffman *table, const uint8_t bits[17], const uint8_t *vals)
+{
+    int count = 0;
+    int code = 0;
+
+    memset(table->look, 0, sizeof(table->look));
+    for (int length = 1; length <= 16; length++)
+    {
+        table->valoffset[length] = count - code;
+        for (int i = 0; i < bits[length]; i++, code++, count++)
+        {
+            if (length <= LOOK_BITS)
+            {
+                int shift = LOOK_BITS - length;
+
+                for (int j = 0; j < (1 << shift); j++)
+                {
+                    table->look[(code << shift) | j] = (length << 8) | vals[count];
+                }
+            }
+        }
+        table->maxcode[length] = bits[length] ? code - 1 : -1;
+        code <<= 1;
+    }
+    memcpy(table->vals, vals, count);
+    table->defined = 1;
+}
+
+static inline void bits_fill(struct jpeg_decoder *obj)
+{
+    while (obj->bit_count <= 56)
+    {
+        unsigned int value = 0;
+
+        if (obj->p < obj->end)
+        {
+            value = *obj->p;
+            if (value != 0xff)
+            {
+                obj->p++;
+            }
+            else if (obj->p + 1 < obj->end && obj->p[1] == 0)
+            {
+                obj->p += 2;
+            }
+            else
+            {
+                // 마커: 넘어가지 않고 0을 채움
+                value = 0;
+            }
+        }
+        obj->bits |= (uint64_t)value << (56 - obj->bit_count);
+        obj->bit_count += 8;
+    }
+}
+
+static inline unsigned int bits_get(struct jpeg_decoder *obj, int size)
+{
+    if (obj->bit_count < size)
+    {
+        bits_fill(obj);
+    }
+    unsigned int value = obj->bits >> (64 - size);
+
+    obj->bits <<= size;
+    obj->bit_count -= size;
+    return value;
+}
+
+/* failed: -1 */
+static inline int huffman_decode(struct jpeg_decoder *obj, const struct jpeg_decoder_huffman *table)
+{
+    if (obj->bit_count < 16)
+    {
+        bits_fill(obj);
+    }
+    unsigned int look = table->look[obj->bits >> (64 - LOOK_BITS)];
+
+    if (look)
+    {
+        obj->bits <<= look >> 8;
+        obj->bit_count -= look >> 8;
+        return look & 0xff;
+    }
+    for (int length = LOOK_BITS + 1; length <= 16; length++)
+    {
+        int32_t code = obj->bits >> (64 - length);
+
+        if (code <= table->maxcode[length])
+        {
+            obj->bits <<= length;
+            obj->bit_count -= length;
+            return table->vals[table->valoffset[length] + code];
+        }
+    }
+    return -1;
+}
+
+static inline int extend(unsigned int value, int size)
+{
+    return value < (1u << (size - 1)) ? (int)value - (1 << size) + 1 : (int)value;
+}
+
+// coef: quant로 역양자화된 계수, 행 우선 순서, DC는 예측값을 더한 값
+/* success: 0 */
+static int decode_block(struct jpeg_decoder *obj, struct jpeg_decoder_component *component, const uint16_t *quant, int32_t coef[64])
+{
+    int size = huffman_decode(obj, &obj->dc[component->td]);
+
+    if (size < 0 || size > 11)
+    {
+        return 1;
+    }
+    memset(coef, 0, 64 * sizeof(coef[0]));
+    if (size)
+    {
+        component->pred += extend(bits_get(obj, size), size);
+    }
+    coef[0] = component->pred * quant[0];
+
+    for (int k = 1; k < 64; k++)
+    {
+        int symbol = huffman_decode(obj, &obj->ac[component->ta]);
+
+        if (symbol < 0)
+        {
+            return 1;
+        }
+        size = symbol & 15;
+        if (size == 0)
+        {
+            if (symbol != 0xf0)
+            {
+                // EOB
+                break;
+            }
+            // ZRL
+            k += 15;
+            continue;
+        }
+        k += symbol >> 4;
+        if (k > 63)
+        {
+            return 1;
+        }
+
+        int index = jpeg_zigzag[k];
+
+        coef[index] = extend(bits_get(obj, size), size) * quant[index];
+    }
+    return 0;
+}
+
+static inline uint8_t clamp_sample(float value)
+{
+    // 음수는 0으로 잘리므로 버림 변환으로 충분
+    int sample = (int)(value + 128.5f);
+
+    return sample < 0 ? 0 : sample > 255 ? 255 : sample;
+}
+
+// 저주파 NxN 계수만 NxN 크기로 역변환
+static void idct_block(const struct jpeg_decoder *obj, const int32_t coef[64], int size, uint8_t *out, unsigned int stride)
+{
+    if (size == 1)
+    {
+        out[0] = clamp_sample(coef[0] * 0.125f);
+        return;
+    }
+    const float (*m)[8] = obj->idct[__builtin_ctz(size)];
+    float t[8][8];
+    int32_t ac = 0;
+
+    for (int v = 0; v < size; v++)
+    {
+        for (int u = 0; u < size; u++)
+        {
+            ac |= (v | u) ? coef[v * 8 + u] : 0;
+        }
+    }
+    // 대부분의 블록은 축소 범위 안에 AC 계수가 없음
+    if (ac == 0)
+    {
+        uint8_t sample = clamp_sample(coef[0] * 0.125f);
+
+        for (int y = 0; y < size; y++)
+        {
+            memset(out + y * stride, sample, size);
+        }
+        return;
+    }
+
+    // 가로: t[v][x] = sum_u F[v][u] * m[x][u]
+    for (int v = 0; v < size; v++)
+    {
+        for (int x = 0; x < size; x++)
+        {
+            float sum = 0;
+
+            for (int u = 0; u < size; u++)
+            {
+                sum += coef[v * 8 + u] * m[x][u];
+            }
+            t[v][x] = sum;
+        }
+    }
+    // 세로: out[y][x] = sum_v m[y][v] * t[v][x]
+    for (int y = 0; y < size; y++)
+    {
+        for (int x = 0; x < size; x++)
+        {
+            float sum = 0;
+
+            for (int v = 0; v < size; v++)
+            {
+                sum += m[y][v] * t[v][x];
+            }
+            out[y * stride + x] = clamp_sample(sum);
+        }
+    }
+}
+
+static uint16_t read_word(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+/* success: 0 */
+static int parse_sof(struct jpeg_decoder *obj, const uint8_t *p, unsigned int length)
+{
+    if (length < 6 || p[0] != 8)
+    {
+        return 1;
+    }
+    obj->height = read_word(p + 1);
+    obj->width = read_word(p + 3);
+    obj->count = p[5];
+    if (obj->width == 0 || obj->height == 0 || (obj->count != 1 && obj->count != 3) || length < 6u + obj->count * 3)
+    {
+        return 1;
+    }
+    obj->hmax = 1;
+    obj->vmax = 1;
+    for (int i = 0; i < obj->count; i++)
+    {
+        struct jpeg_decoder_component *component = &obj->components[i];
+
+        component->id = p[6 + i * 3];
+        component->h = p[7 + i * 3] >> 4;
+        component->v = p[7 + i * 3] & 15;
+        component->tq = p[8 + i * 3] & 3;
+        // 성분이 하나면 비인터리브 스캔, 블록 하나가 MCU
+        if (obj->count == 1)
+        {
+            component->h = 1;
+            component->v = 1;
+        }
+        if (component->h < 1 || component->h > 2 || component->v < 1 || component->v > 2)
+        {
+            return 1;
+        }
+        obj->hmax = component->h > obj->hmax ? component->h : obj->hmax;
+        obj->vmax = component->v > obj->vmax ? component->v : obj->vmax;
+    }
+    obj->mcu_columns = (obj->width + obj->hmax * 8 - 1) / (obj->hmax * 8);
+    obj->mcu_rows = (obj->height + obj->vmax * 8 - 1) / (obj->vmax * 8);
+    for (int i = 0; i < obj->count; i++)
+    {
+        obj->components[i].blocks_w = obj->mcu_columns * obj->components[i].h;
+        obj->components[i].blocks_h = obj->mcu_rows * obj->components[i].v;
+    }
+    return 0;
+}
+
+/* success: 0 */
+static int parse_dqt(struct jpeg_decoder *obj, const uint8_t *p, unsigned int length)
+{
+    while (length > 0)
+    {
+        int precision = p[0] >> 4;
+        int id = p[0] & 15;
+        unsigned int size = 1 + 64 * (precision ? 2 : 1);
+
+        if (id > 3 || length < size)
+        {
+            return 1;
+        }
+        for (int k = 0; k < 64; k++)
+        {
+            obj->quant[id][jpeg_zigzag[k]] = precision ? read_word(p + 1 + k * 2) : p[1 + k];
+        }
+        obj->quant_defined |= 1u << id;
+        obj->quant_extended |= precision;
+        p += size;
+        length -= size;
+    }
+    return 0;
+}
+
+/* success: 0 */
+static int parse_dht(struct jpeg_decoder *obj, const uint8_t *p, unsigned int length)
+{
+    while (length > 17)
+    {
+        int table_class = p[0] >> 4;
+        int id = p[0] & 15;
+        uint8_t bits[17] = { 0 };
+        unsigned int count = 0;
+
+        for (int i = 1; i <= 16; i++)
+        {
+            bits[i] = p[i];
+            count += bits[i];
+        }
+        if (table_class > 1 || id > 3 || count > 256 || length < 17 + count)
+        {
+            return 1;
+        }
+        huffman_build(table_class ? &obj->ac[id] : &obj->dc[id], bits, p + 17);
+        p += 17 + count;
+        length -= 17 + count;
+    }
+    return length ? 1 : 0;
+}
+
+/* success: 0 */
+static int parse_sos(struct jpeg_decoder *obj, const uint8_t *p, unsigned int length)
+{
+    int count = length ? p[0] : 0;
+
+    if (obj->count == 0 || count != obj->count || length < 4u + count * 2)
+    {
+        return 1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        struct jpeg_decoder_component *component = 0;
+
+        for (int j = 0; j < obj->count; j++)
+        {
+            if (obj->components[j].id == p[1 + i * 2])
+            {
+                component = &obj->components[j];
+            }
+        }
+        if (component == 0)
+        {
+            return 1;
+        }
+        component->td = (p[2 + i * 2] >> 4) & 3;
+        component->ta = p[2 + i * 2] & 3;
+    }
+    return 0;
+}
+
+/* success: 0 */
+static int parse_header(struct jpeg_decoder *obj, const uint8_t *data, size_t length)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = data + length;
+
+    obj->count = 0;
+    obj->restart_interval = 0;
+    obj->quant_defined = 0;
+    obj->quant_extended = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        obj->dc[i].defined = 0;
+        obj->ac[i].defined = 0;
+    }
+
+    if (length < 4 || p[0] != 0xff || p[1] != JPEG_SOI)
+    {
+        return 1;
+    }
+    p += 2;
+
+    while (p + 4 <= end)
+    {
+        if (p[0] != 0xff)
+        {
+            return 1;
+        }
+        if (p[1] == 0xff)
+        {
+            // 채움 바이트
+            p++;
+            continue;
+        }
+        uint8_t marker = p[1];
+        unsigned int size = read_word(p + 2);
+
+        if (size < 2 || p + 2 + size > end)
+        {
+            return 1;
+        }
+        const uint8_t *segment = p + 4;
+        unsigned int segment_length = size - 2;
+        int failed = 0;
+
+        switch (marker)
+        {
+        case JPEG_SOF0:
+        case JPEG_SOF0 + 1:
+            failed = parse_sof(obj, segment, segment_length);
+            break;
+        case JPEG_DQT:
+            failed = parse_dqt(obj, segment, segment_length);
+            break;
+        case JPEG_DHT:
+            failed = parse_dht(obj, segment, segment_length);
+            break;
+        case JPEG_DRI:
+            failed = segment_length < 2;
+            if (failed == 0)
+            {
+                obj->restart_interval = read_word(segment);
+            }
+            break;
+        case JPEG_SOS:
+            if (parse_sos(obj, segment, segment_length))
+            {
+                return 1;
+            }
+            obj->p = segment + segment_length;
+            obj->end = end;
+
+            // DHT가 없으면 표준 테이블
+            for (int i = 0; i < 4; i++)
+            {
+                if (obj->dc[i].defined == 0)
+                {
+                    huffman_build(&obj->dc[i], i ? jpeg_std_dc_chroma_bits : jpeg_std_dc_luma_bits, i ? jpeg_std_dc_chroma_vals : jpeg_std_dc_luma_vals);
+                }
+                if (obj->ac[i].defined == 0)
+                {
+                    huffman_build(&obj->ac[i], i ? jpeg_std_ac_chroma_bits : jpeg_std_ac_luma_bits, i ? jpeg_std_ac_chroma_vals : jpeg_std_ac_luma_vals);
+                }
+            }
+            return 0;
+        default:
+            // 프로그레시브, 산술 부호화 등 다른 SOF는 지원하지 않음
+            failed = (marker & 0xf0) == 0xc0 && marker != JPEG_DHT && marker != 0xc8 && marker != 0xcc;
+            break;
+        }
+        if (failed)
+        {
+            return 1;
+        }
+        p += 2 + size;
+    }
+    return 1;
+}
+
+/* success: 0 */
+static int prepare_plane(struct jpeg_decoder_plane *plane, unsigned int width, unsigned int height)
+{
+    size_t size = (size_t)width * height;
+
+    if (size > plane->available)
+    {
+        uint8_t *data = realloc(plane->data, size);
+
+        if (data == 0)
+        {
+            return 1;
+        }
+        plane->data = data;
+        plane->available = size;
+    }
+    plane->width = width;
+    plane->height = height;
+    return 0;
+}
+
+// 재시작 마커를 찾아 넘기고 비트 버퍼, DC 예측값 초기화
+static void restart(struct jpeg_decoder *obj)
+{
+    while (obj->p + 1 < obj->end && !(obj->p[0] == 0xff && obj->p[1] >= JPEG_RST0 && obj->p[1] <= JPEG_RST0 + 7))
+    {
+        obj->p++;
+    }
+    if (obj->p + 1 < obj->end)
+    {
+        obj->p += 2;
+    }
+    obj->bits = 0;
+    obj->bit_count = 0;
+    for (int i = 0; i < obj->count; i++)
+    {
+        obj->components[i].pred = 0;
+    }
+}
+
+/* success: 0 */
+static int decode_scan(struct jpeg_decoder *obj)
+{
+    int32_t coef[64];
+    unsigned int mcu = 0;
+    unsigned int left = obj->restart_interval;
+
+    obj->bits = 0;
+    obj->bit_count = 0;
+    for (int i = 0; i < obj->count; i++)
+    {
+        obj->components[i].pred = 0;
+    }
+
+    for (unsigned int row = 0; row < obj->mcu_rows; row++)
+    {
+        for (unsigned int column = 0; column < obj->mcu_columns; column++, mcu++)
+        {
+            if (obj->restart_interval)
+            {
+                if (left == 0)
+                {
+                    restart(obj);
+                    left = obj->restart_interval;
+                }
+                left--;
+            }
+            for (int c = 0; c < obj->count; c++)
+            {
+                struct jpeg_decoder_component *component = &obj->components[c];
+
+                for (int v = 0; v < component->v; v++)
+                {
+                    for (int h = 0; h < component->h; h++)
+                    {
+                        if (decode_block(obj, component, obj->quant[component->tq], coef))
+                        {
+                            return 1;
+                        }
+                        unsigned int bx = column * component->h + h;
+                        unsigned int by = row * component->v + v;
+
+                        for (int t = 0; t < obj->target_count; t++)
+                        {
+                            struct jpeg_decoder_target *target = &obj->targets[t];
+                            struct jpeg_decoder_plane *plane = &target->planes[c];
+
+                            idct_block(obj, coef, target->size, plane->data + (size_t)by * target->size * plane->width + bx * target->size, plane->width);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// 모아 둔 밝기 블록을 블록 행 순서로 부호화, 영상 아래 MCU 여백의 블록 행은 버림
+static void rewrite_gray_row(struct jpeg_decoder *obj, struct jpeg_decoder_rewriter *rewriter)
+{
+    int v = obj->components[0].v;
+
+    for (int y = 0; y < v && rewriter->block_row < rewriter->block_rows; y++, rewriter->block_row++)
+    {
+        for (unsigned int x = 0; x < rewriter->block_columns; x++)
+        {
+            const int16_t *block = rewriter->blocks + ((size_t)y * rewriter->block_columns + x) * 64;
+
+            jpeg_write_block(&rewriter->writer, block, &rewriter->pred[0], jpeg_std_huffman(0), jpeg_std_huffman(2));
+        }
+    }
+}
+
+// 필요한 MCU만 rewriter마다 다시 부호화
+/* success: 0 */
+static int rewrite_scan(struct jpeg_decoder *obj)
+{
+    int32_t coef[64];
+    int16_t block[64];
+    unsigned int interval = obj->restart_interval;
+    unsigned int first = obj->mcu_rows;
+    unsigned int last = 0;
+
+    for (int r = 0; r < obj->rewriter_count; r++)
+    {
+        first = obj->rewriters[r].row_begin < first ? obj->rewriters[r].row_begin : first;
+        last = obj->rewriters[r].row_end > last ? obj->rewriters[r].row_end : last;
+    }
+    // 필요한 첫 MCU 이전에 끝나는 재시작 구간은 복호화 없이 다음 마커로 건너뜀
+    unsigned int skip = first * obj->mcu_columns;
+    unsigned int end = last * obj->mcu_columns;
+
+    obj->bits = 0;
+    obj->bit_count = 0;
+    for (int i = 0; i < obj->count; i++)
+    {
+        obj->components[i].pred = 0;
+    }
+
+    for (unsigned int mcu = 0; mcu < end; mcu++)
+    {
+        if (interval && mcu % interval == 0)
+        {
+            if (mcu)
+            {
+                restart(obj);
+            }
+            if (mcu + interval <= skip)
+            {
+                mcu += interval - 1;
+                continue;
+            }
+        }
+        unsigned int row = mcu / obj->mcu_columns;
+        unsigned int column = mcu % obj->mcu_columns;
+
+        for (int c = 0; c < obj->count; c++)
+        {
+            struct jpeg_decoder_component *component = &obj->components[c];
+
+            for (int b = 0; b < component->h * component->v; b++)
+            {
+                if (decode_block(obj, component, unit_quant, coef))
+                {
+                    return 1;
+                }
+                int converted = 0;
+
+                for (int r = 0; r < obj->rewriter_count; r++)
+                {
+                    struct jpeg_decoder_rewriter *rewriter = &obj->rewriters[r];
+
+                    if (row < rewriter->row_begin || row >= rewriter->row_end || column < rewriter->column_begin || column >= rewriter->column_end)
+                    {
+                        continue;
+                    }
+                    if (rewriter->gray)
+                    {
+                        unsigned int x = (column - rewriter->column_begin) * component->h + b % component->h;
+
+                        // 색차 블록과 영상 오른쪽 MCU 여백의 블록은 버림
+                        if (c == 0 && x < rewriter->block_columns)
+                        {
+                            int16_t *out = rewriter->blocks + ((size_t)(b / component->h) * rewriter->block_columns + x) * 64;
+
+                            for (int k = 0; k < 64; k++)
+                            {
+                                out[k] = coef[k];
+                            }
+                        }
+                        continue;
+                    }
+                    if (converted == 0)
+                    {
+                        for (int k = 0; k < 64; k++)
+                        {
+                            block[k] = coef[k];
+                        }
+                        converted = 1;
+                    }
+                    jpeg_write_block(&rewriter->writer, block, &rewriter->pred[c], jpeg_std_huffman(c ? 1 : 0), jpeg_std_huffman(c ? 3 : 2));
+                }
+            }
+        }
+
+        for (int r = 0; r < obj->rewriter_count; r++)
+        {
+            struct jpeg_decoder_rewriter *rewriter = &obj->rewriters[r];
+
+            if (rewriter->gray && column + 1 == rewriter->column_end && row >= rewriter->row_begin && row < rewriter->row_end)
+            {
+                rewrite_gray_row(obj, rewriter);
+            }
+        }
+    }
+    return 0;
+}
+
+/* success: 0 */
+static int convert_yuyv(struct jpeg_decoder *obj, struct jpeg_decoder_target *target, struct jpeg_decoder_output *output)
+{
+    unsigned int scale = output->scale;
+    unsigned int width = (obj->width + scale - 1) / scale;
+    unsigned int height = (obj->height + scale - 1) / scale;
+
+    width = (width + 1) & ~1u;
+
+    size_t size = (size_t)width * 2 * height;
+
+    if (size > target->available)
+    {
+        uint8_t *yuyv = realloc(target->yuyv, size);
+
+        if (yuyv == 0)
+        {
+            return 1;
+        }
+        target->yuyv = yuyv;
+        target->available = size;
+    }
+
+    for (unsigned int y = 0; y < height; y++)
+    {
+        uint8_t *out = target->yuyv + (size_t)y * width * 2;
+        const uint8_t *line[MAX_COMPONENTS];
+        unsigned int limit[MAX_COMPONENTS];
+
+        for (int c = 0; c < obj->count; c++)
+        {
+            struct jpeg_decoder_plane *plane = &target->planes[c];
+            unsigned int py = y * obj->components[c].v / obj->vmax;
+
+            line[c] = plane->data + (size_t)(py < plane->height ? py : plane->height - 1) * plane->width;
+            limit[c] = plane->width - 1;
+        }
+        for (unsigned int x = 0; x < width; x += 2)
+        {
+            unsigned int x0 = x * obj->components[0].h / obj->hmax;
+            unsigned int x1 = (x + 1) * obj->components[0].h / obj->hmax;
+
+            out[x * 2] = line[0][x0 < limit[0] ? x0 : limit[0]];
+            out[x * 2 + 2] = line[0][x1 < limit[0] ? x1 : limit[0]];
+            if (obj->count == 1)
+            {
+                out[x * 2 + 1] = 128;
+                out[x * 2 + 3] = 128;
+                continue;
+            }
+            unsigned int cb = x * obj->components[1].h / obj->hmax;
+            unsigned int cr = x * obj->components[2].h / obj->hmax;
+
+            out[x * 2 + 1] = line[1][cb < limit[1] ? cb : limit[1]];
+            out[x * 2 + 3] = line[2][cr < limit[2] ? cr : limit[2]];
+        }
+    }
+    output->width = width;
+    output->height = height;
+    output->stride = width * 2;
+    output->yuyv = target->yuyv;
+    return 0;
+}
+
+jpeg_decoder_t *jpeg_decoder_create(void)
+{
+    struct jpeg_decoder *obj = malloc(sizeof(*obj));
+
+    if (obj == 0)
+    {
+        return 0;
+    }
+    memset(obj, 0, sizeof(*obj));
+
+    // m[x][u] = C(u) / 2 * cos((2x + 1) * u * pi / 2N), 저주파 NxN 계수에서 NxN 출력
+    for (int n = 0; n < 4; n++)
+    {
+        int size = 1 << n;
+
+        for (int x = 0; x < size; x++)
+        {
+            for (int u = 0; u < size; u++)
+            {
+                obj->idct[n][x][u] = (u ? 0.5f : 0.5f * (float)M_SQRT1_2) * cosf((2 * x + 1) * u * (float)M_PI / (2 * size));
+            }
+        }
+    }
+    return obj;
+}
+
+void jpeg_decoder_destroy(jpeg_decoder_t *obj)
+{
+    if (obj == 0)
+    {
+        return;
+    }
+    for (int t = 0; t < JPEG_DECODER_MAX_OUTPUTS; t++)
+    {
+        for (int c = 0; c < MAX_COMPONENTS; c++)
+        {
+            free(obj->targets[t].planes[c].data);
+        }
+        free(obj->targets[t].yuyv);
+    }
+    for (int r = 0; r < JPEG_DECODER_MAX_REWRITES; r++)
+    {
+        jpeg_writer_free(&obj->rewriters[r].writer);
+        free(obj->rewriters[r].blocks);
+    }
+    free(obj);
+}
+
+/* success: 0 */
+int jpeg_decoder_decode(jpeg_decoder_t *obj, const void *data, size_t length, struct jpeg_decoder_output *outputs, int count)
+{
+    if (count < 1 || count > JPEG_DECODER_MAX_OUTPUTS || parse_header(obj, data, length))
+    {
+        return 1;
+    }
+
+    obj->target_count = count;
+    for (int t = 0; t < count; t++)
+    {
+        unsigned int scale = outputs[t].scale;
+        struct jpeg_decoder_target *target = &obj->targets[t];
+
+        if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+        {
+            return 1;
+        }
+        target->size = 8 / scale;
+        for (int c = 0; c < obj->count; c++)
+        {
+            struct jpeg_decoder_component *component = &obj->components[c];
+
+            if (prepare_plane(&target->planes[c], component->blocks_w * target->size, component->blocks_h * target->size))
+            {
+                return 1;
+            }
+        }
+    }
+
+    if (decode_scan(obj))
+    {
+        return 1;
+    }
+    for (int t = 0; t < count; t++)
+    {
+        if (convert_yuyv(obj, &obj->targets[t], &outputs[t]))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* success: 0 */
+int jpeg_decoder_rewrite(jpeg_decoder_t *obj, const void *data, size_t length, struct jpeg_decoder_rewrite *rewrites, int count)
+{
+    // 출력은 8비트 양자화 테이블만 쓰는 baseline
+    if (count < 1 || count > JPEG_DECODER_MAX_REWRITES || parse_header(obj, data, length) || obj->quant_extended)
+    {
+        return 1;
+    }
+    unsigned int mcu_width = obj->hmax * 8;
+    unsigned int mcu_height = obj->vmax * 8;
+    struct jpeg_component components[MAX_COMPONENTS];
+
+    for (int c = 0; c < obj->count; c++)
+    {
+        // 원본 테이블 대신 표준 허프만 테이블로 부호화 (모든 심볼 포함)
+        components[c].id = obj->components[c].id;
+        components[c].h = obj->components[c].h;
+        components[c].v = obj->components[c].v;
+        components[c].tq = obj->components[c].tq;
+        components[c].td = c ? 1 : 0;
+        components[c].ta = c ? 1 : 0;
+    }
+
+    obj->rewriter_count = count;
+    for (int r = 0; r < count; r++)
+    {
+        struct jpeg_decoder_rewrite *rewrite = &rewrites[r];
+        struct jpeg_decoder_rewriter *rewriter = &obj->rewriters[r];
+        unsigned int column = (rewrite->x < obj->width ? rewrite->x : obj->width - 1) / mcu_width;
+        unsigned int row = (rewrite->y < obj->height ? rewrite->y : obj->height - 1) / mcu_height;
+        unsigned int x = column * mcu_width;
+        unsigned int y = row * mcu_height;
+        unsigned int width = obj->width - x;
+        unsigned int height = obj->height - y;
+
+        // 시작 위치를 내린 만큼 넓혀 요청한 영역을 모두 포함
+        if (rewrite->width && rewrite->width + (rewrite->x - x) < width)
+        {
+            width = rewrite->width + (rewrite->x - x);
+        }
+        if (rewrite->height && rewrite->height + (rewrite->y - y) < height)
+        {
+            height = rewrite->height + (rewrite->y - y);
+        }
+        rewriter->column_begin = column;
+        rewriter->column_end = column + (width + mcu_width - 1) / mcu_width;
+        rewriter->row_begin = row;
+        rewriter->row_end = row + (height + mcu_height - 1) / mcu_height;
+        for (int c = 0; c < MAX_COMPONENTS; c++)
+        {
+            rewriter->pred[c] = 0;
+        }
+
+        struct jpeg_component gray = components[0];
+        int output_count = obj->count;
+
+        rewriter->gray = rewrite->gray;
+        if (rewriter->gray)
+        {
+            // 단일 성분 스캔은 블록 하나가 MCU, 블록 수는 영상 크기 기준
+            gray.h = 1;
+            gray.v = 1;
+            output_count = 1;
+            rewriter->block_columns = (width + 7) / 8;
+            rewriter->block_rows = (height + 7) / 8;
+            rewriter->block_row = 0;
+
+            size_t size = (size_t)obj->components[0].v * rewriter->block_columns * 64 * sizeof(int16_t);
+
+            if (size > rewriter->blocks_available)
+            {
+                int16_t *blocks = realloc(rewriter->blocks, size);
+
+                if (blocks == 0)
+                {
+                    return 1;
+                }
+                rewriter->blocks = blocks;
+                rewriter->blocks_available = size;
+            }
+        }
+        const struct jpeg_component *output = rewriter->gray ? &gray : components;
+        struct jpeg_writer *writer = &rewriter->writer;
+
+        jpeg_writer_reset(writer);
+        jpeg_write_marker(writer, JPEG_SOI);
+        for (int id = 0; id < 4; id++)
+        {
+            int used = 0;
+
+            for (int c = 0; c < output_count; c++)
+            {
+                used |= output[c].tq == id;
+            }
+            if (used && (obj->quant_defined & (1u << id)))
+            {
+                uint8_t table[64];
+
+                for (int k = 0; k < 64; k++)
+                {
+                    table[k] = obj->quant[id][k];
+                }
+                jpeg_write_dqt(writer, id, table);
+            }
+        }
+        jpeg_write_sof0(writer, width, height, output, output_count);
+        if (rewriter->gray)
+        {
+            jpeg_write_dht(writer, 0, 0, jpeg_std_dc_luma_bits, jpeg_std_dc_luma_vals);
+            jpeg_write_dht(writer, 1, 0, jpeg_std_ac_luma_bits, jpeg_std_ac_luma_vals);
+        }
+        else
+        {
+            jpeg_write_std_dht(writer);
+        }
+        jpeg_write_sos(writer, output, output_count);
+    }
+
+    if (rewrite_scan(obj))
+    {
+        return 1;
+    }
+    for (int r = 0; r < count; r++)
+    {
+        struct jpeg_writer *writer = &obj->rewriters[r].writer;
+
+        jpeg_write_flush(writer);
+        jpeg_write_marker(writer, JPEG_EOI);
+        if (writer->failed)
+        {
+            return 1;
+        }
+        rewrites[r].data = writer->data;
+        rewrites[r].length = writer->length;
+    }
+    return 0;
+}
+
+/* success: 0 */
+int jpeg_decoder_peek_size(const void *data, size_t length, unsigned int *width, unsigned int *height)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = p + length;
+
+    if (length < 4 || p[0] != 0xff || p[1] != JPEG_SOI)
+    {
+        return 1;
+    }
+    p += 2;
+
+    while (p + 4 <= end)
+    {
+        if (p[0] != 0xff)
+        {
+            return 1;
+        }
+        if (p[1] == 0xff)
+        {
+            p++;
+            continue;
+        }
+        uint8_t marker = p[1];
+        unsigned int size = read_word(p + 2);
+
+        if (size < 2 || p + 2 + size > end || marker == JPEG_SOS)
+        {
+            return 1;
+        }
+        if (marker == JPEG_SOF0 || marker == JPEG_SOF0 + 1)
+        {
+            if (size < 2 + 6)
+            {
+                return 1;
+            }
+            *height = read_word(p + 5);
+            *width = read_word(p + 7);
+            return *width == 0 || *height == 0;
+        }
+        p += 2 + size;
+    }
+    return 1;
+}
+
+unsigned int jpeg_decoder_get_width(jpeg_decoder_t *obj)
+{
+    return obj->width;
+}
+
+unsigned int jpeg_decoder_get_height(jpeg_decoder_t *obj)
+{
+    return obj->height;
+}
@@ -0,0 +1,62 @@
+#ifndef JPEG_DECODER_H
+#define JPEG_DECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct jpeg_decoder;
+typedef struct jpeg_decoder jpeg_decoder_t;
+
+#define JPEG_DECODER_MAX_OUTPUTS 4
+#define JPEG_DECODER_MAX_REWRITES 8
+
+// baseline JPEG을 1/scale 크기로 복원하여 YUYV 4:2:2로 출력
+// 축소 출력은 DCT 계수 중 저주파 (8/scale)x(8/scale)만 역변환하므로 원본 크기 복원보다 빠름
+struct jpeg_decoder_output
+{
+    // 1, 2, 4, 8
+    unsigned int scale;
+
+    // decode 결과, 다음 decode 전까지 유효 (decoder 소유)
+    // width는 짝수로 올림, 늘어난 열은 가장자리 픽셀 반복
+    unsigned int width;
+    unsigned int height;
+    unsigned int stride;
+    const uint8_t *yuyv;
+};
+
+// 양자화된 DCT 계수를 그대로 옮기고 허프만 부호만 다시 만듦 (역변환/재부호화 없음, 화질 손실 없음)
+struct jpeg_decoder_rewrite
+{
+    // 잘라낼 영역 (픽셀), 시작 위치는 MCU 경계로 내리고 영상 밖은 잘라냄, width/height 0: 끝까지
+    unsigned int x;
+    unsigned int y;
+    unsigned int width;
+    unsigned int height;
+    // 밝기 성분만 남긴 단일 성분 JPEG
+    int gray;
+
+    // rewrite 결과, 다음 rewrite 전까지 유효 (decoder 소유)
+    const void *data;
+    size_t length;
+};
+
+jpeg_decoder_t *jpeg_decoder_create(void);
+void jpeg_decoder_destroy(jpeg_decoder_t *obj);
+
+// 허프만 복호화는 한번만 하고 출력마다 역변환
+/* success: 0 */
+int jpeg_decoder_decode(jpeg_decoder_t *obj, const void *data, size_t length, struct jpeg_decoder_output *outputs, int count);
+// 허프만 복호화는 한번만 하고 rewrite마다 부호화, 필요한 마지막 MCU 행 이후는 읽지 않음
+/* success: 0 */
+int jpeg_decoder_rewrite(jpeg_decoder_t *obj, const void *data, size_t length, struct jpeg_decoder_rewrite *rewrites, int count);
+
+// 복호화 없이 SOF 헤더에서 영상 크기만 읽음
+/* success: 0 */
+int jpeg_decoder_peek_size(const void *data, size_t length, unsigned int *width, unsigned int *height);
+
+// 마지막으로 복호화한 원본 크기
+unsigned int jpeg_decoder_get_width(jpeg_decoder_t *obj);
+unsigned int jpeg_decoder_get_height(jpeg_decoder_t *obj);
+
+#endif
@@ -0,0 +1,667 @@
+#include "jpeg_encoder.h"
+#include "jpeg_writer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// YUYV 4:2:2 -> baseline JPEG (YCbCr 4:2:2, MCU 16x8)
+// MCU 행마다 재시작 간격(DRI)을 두어 MCU 행 묶음(strip)을 스레드마다 따로 부호화한 후 이어 붙임
+// YUYV는 이미 YCbCr이므로 색 변환은 성분 분리와 레벨 이동(-128)
+
+#define MAX_THREADS 16
+// 블록 하나의 엔트로피 부호화 최대 크기 (0xFF 스터핑 포함)
+#define MAX_BLOCK_BYTES 512
+
+// GCC/Clang 벡터 확장: 컴파일 대상에 따라 SSE2/AVX2/NEON 레지스터 사용
+#if defined(__GNUC__)
+#define JPEG_VECTOR 1
+typedef float v8sf __attribute__((vector_size(32)));
+typedef int32_t v8si __attribute__((vector_size(32)));
+typedef int16_t v8hi __attribute__((vector_size(16)));
+#endif
+
+// x86-64: AVX2 경로를 따로 컴파일해 두고 실행 시 CPU에 따라 선택
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) && defined(__linux__)
+#define JPEG_AVX2_DISPATCH 1
+#define JPEG_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define JPEG_TARGET_CLONES
+#endif
+
+struct jpeg_encoder;
+
+struct jpeg_encoder_strip
+{
+    struct jpeg_encoder *encoder;
+
+    // MCU 행 [begin, end)
+    unsigned int begin;
+    unsigned int end;
+    struct jpeg_writer writer;
+
+    sem_t start;
+    pthread_t thread;
+    int running;
+};
+
+struct jpeg_encoder
+{
+    int quality;
+    int thread_count;
+
+    // 행 우선 순서, 0: luma, 1: chroma
+    uint8_t quant[2][64];
+    // DCT 결과(전치된 순서)에 곱할 값, AAN 배율 포함
+    float divisor[2][64];
+    // 지그재그 순서 -> 전치된 순서
+    uint8_t zigzag[64];
+
+    // 부호화 중인 프레임
+    const uint8_t *src;
+    unsigned int width;
+    unsigned int height;
+    unsigned int stride;
+    unsigned int mcu_columns;
+    unsigned int mcu_rows;
+    // 밝기 전용: 8x8 블록 하나가 MCU, 한 행의 블록 수
+    int gray;
+    unsigned int block_columns;
+
+    int stop;
+    sem_t done;
+    struct jpeg_encoder_strip strips[MAX_THREADS];
+
+    struct jpeg_writer output;
+};
+
+static const struct jpeg_component encoder_components[3] =
+{
+    { .id = 1, .h = 2, .v = 1, .tq = 0, .td = 0, .ta = 0 },
+    { .id = 2, .h = 1, .v = 1, .tq = 1, .td = 1, .ta = 1 },
+    { .id = 3, .h = 1, .v = 1, .tq = 1, .td = 1, .ta = 1 },
+};
+
+static const struct jpeg_component gray_component =
+{
+    .id = 1, .h = 1, .v = 1, .tq = 0, .td = 0, .ta = 0,
+};
+
+// ITU-T T.81 Annex K 양자화 테이블, 행 우선 순서
+static const uint8_t std_luma_quant[64] =
+{
+    16, 11, 10, 16, 24, 40, 51, 61,
+    12, 12, 14, 19, 26, 58, 60, 55,
+    14, 13, 16, 24, 40, 57, 69, 56,
+    14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68, 109, 103, 77,
+    24, 35, 55, 64, 81, 104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103, 99,
+};
+
+static const uint8_t std_chroma_quant[64] =
+{
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+};
+
+// AAN DCT 출력 배율: cos(k * pi / 16) * sqrt(2), k = 0 이면 1
+static const float aan_scale[8] =
+{
+    1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+    1.0f, 0.785694958f, 0.541196100f, 0.275899379f,
+};
+
+// IJG 품질 배율
+static void build_quant(uint8_t table[64], const uint8_t base[64], int quality)
+{
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+
+    for (int i = 0; i < 64; i++)
+    {
+        int value = (base[i] * scale + 50) / 100;
+
+        table[i] = value < 1 ? 1 : value > 255 ? 255 : value;
+    }
+}
+
+static void build_divisor(float divisor[64], const uint8_t table[64])
+{
+    // 전치된 순서 h * 8 + u (h: 가로 주파수, u: 세로 주파수)
+    for (int h = 0; h < 8; h++)
+    {
+        for (int u = 0; u < 8; u++)
+        {
+            divisor[h * 8 + u] = 1.0f / (table[u * 8 + h] * aan_scale[u] * aan_scale[h] * 8.0f);
+        }
+    }
+}
+
+// 8 픽셀 행 x 16 픽셀, block 0/1: Y 왼쪽/오른쪽, 2: Cb, 3: Cr
+static inline void load_mcu_edge(const struct jpeg_encoder *obj, unsigned int column, unsigned int row, int16_t block[4][64])
+{
+    unsigned int x0 = column * 16;
+    unsigned int y0 = row * 8;
+    unsigned int pairs = obj->width / 2;
+
+    // 이미지 밖은 가장자리 픽셀을 반복
+    for (unsigned int r = 0; r < 8; r++)
+    {
+        unsigned int y = y0 + r < obj->height ? y0 + r : obj->height - 1;
+        const uint8_t *line = obj->src + (size_t)y * obj->stride;
+
+        for (unsigned int c = 0; c < 16; c++)
+        {
+            unsigned int x = x0 + c < obj->width ? x0 + c : obj->width - 1;
+
+            block[c >> 3][r * 8 + (c & 7)] = line[x * 2] - 128;
+        }
+        for (unsigned int c = 0; c < 8; c++)
+        {
+            unsigned int pair = x0 / 2 + c < pairs ? x0 / 2 + c : pairs - 1;
+
+            block[2][r * 8 + c] = line[pair * 4 + 1] - 128;
+            block[3][r * 8 + c] = line[pair * 4 + 3] - 128;
+        }
+    }
+}
+
+static inline void load_mcu(const struct jpeg_encoder *obj, unsigned int column, unsigned int row, int16_t block[4][64])
+{
+    if ((column + 1) * 16 > obj->width || (row + 1) * 8 > obj->height)
+    {
+        load_mcu_edge(obj, column, row, block);
+        return;
+    }
+    const uint8_t *line = obj->src + (size_t)row * 8 * obj->stride + column * 32;
+
+    for (int r = 0; r < 8; r++, line += obj->stride)
+    {
+#if defined(__SSE2__)
+        // 16bit 단위로 보면 하위 바이트가 Y, 상위 바이트가 U/V 교대
+        const __m128i mask = _mm_set1_epi16(0xff);
+        const __m128i bias = _mm_set1_epi16(128);
+        __m128i a = _mm_loadu_si128((const __m128i *)line);
+        __m128i b = _mm_loadu_si128((const __m128i *)(line + 16));
+        __m128i uva = _mm_srli_epi16(a, 8);
+        __m128i uvb = _mm_srli_epi16(b, 8);
+        __m128i u = _mm_packs_epi32(_mm_and_si128(uva, _mm_set1_epi32(0xffff)), _mm_and_si128(uvb, _mm_set1_epi32(0xffff)));
+        __m128i v = _mm_packs_epi32(_mm_srli_epi32(uva, 16), _mm_srli_epi32(uvb, 16));
+
+        _mm_storeu_si128((__m128i *)&block[0][r * 8], _mm_sub_epi16(_mm_and_si128(a, mask), bias));
+        _mm_storeu_si128((__m128i *)&block[1][r * 8], _mm_sub_epi16(_mm_and_si128(b, mask), bias));
+        _mm_storeu_si128((__m128i *)&block[2][r * 8], _mm_sub_epi16(u, bias));
+        _mm_storeu_si128((__m128i *)&block[3][r * 8], _mm_sub_epi16(v, bias));
+#elif defined(__ARM_NEON)
+        // val[0]: Y 16개, val[1]: U/V 교대
+        uint8x16x2_t yuv = vld2q_u8(line);
+        uint8x8x2_t uv = vuzp_u8(vget_low_u8(yuv.val[1]), vget_high_u8(yuv.val[1]));
+        const uint8x8_t bias = vdup_n_u8(128);
+
+        vst1q_s16(&block[0][r * 8], vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(yuv.val[0]), bias)));
+        vst1q_s16(&block[1][r * 8], vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(yuv.val[0]), bias)));
+        vst1q_s16(&block[2][r * 8], vreinterpretq_s16_u16(vsubl_u8(uv.val[0], bias)));
+        vst1q_s16(&block[3][r * 8], vreinterpretq_s16_u16(vsubl_u8(uv.val[1], bias)));
+#else
+        for (int c = 0; c < 8; c++)
+        {
+            block[0][r * 8 + c] = line[c * 2] - 128;
+            block[1][r * 8 + c] = line[16 + c * 2] - 128;
+            block[2][r * 8 + c] = line[c * 4 + 1] - 128;
+            block[3][r * 8 + c] = line[c * 4 + 3] - 128;
+        }
+#endif
+    }
+}
+
+// AAN 부동소수점 DCT (IJG jfdctflt), d[0..7]에 대해 1차원 변환, 출력은 aan_scale 배
+#define FDCT_1D(d) \
+    do \
+    { \
+        __typeof__(d[0]) tmp0 = d[0] + d[7], tmp7 = d[0] - d[7]; \
+        __typeof__(d[0]) tmp1 = d[1] + d[6], tmp6 = d[1] - d[6]; \
+        __typeof__(d[0]) tmp2 = d[2] + d[5], tmp5 = d[2] - d[5]; \
+        __typeof__(d[0]) tmp3 = d[3] + d[4], tmp4 = d[3] - d[4]; \
+        __typeof__(d[0]) tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3; \
+        __typeof__(d[0]) tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2; \
+        __typeof__(d[0]) z1, z2, z3, z4, z5, z11, z13; \
+        d[0] = tmp10 + tmp11; \
+        d[4] = tmp10 - tmp11; \
+        z1 = (tmp12 + tmp13) * 0.707106781f; \
+        d[2] = tmp13 + z1; \
+        d[6] = tmp13 - z1; \
+        tmp10 = tmp4 + tmp5; \
+        tmp11 = tmp5 + tmp6; \
+        tmp12 = tmp6 + tmp7; \
+        z5 = (tmp10 - tmp12) * 0.382683433f; \
+        z2 = tmp10 * 0.541196100f + z5; \
+        z4 = tmp12 * 1.306562965f + z5; \
+        z3 = tmp11 * 0.707106781f; \
+        z11 = tmp7 + z3; \
+        z13 = tmp7 - z3; \
+        d[5] = z13 + z2; \
+        d[3] = z13 - z2; \
+        d[1] = z11 + z4; \
+        d[7] = z11 - z4; \
+    } while (0)
+
+// in: 행 우선 순서, out: 전치된 순서 (h * 8 + u)
+static inline void dct_quantize(const int16_t in[64], const float divisor[64], int16_t out[64])
+{
+#if defined(JPEG_VECTOR)
+    v8sf d[8];
+
+    // 벡터 하나가 한 행, 벡터 사이의 연산으로 8개 열의 세로 변환을 한번에 처리
+    for (int i = 0; i < 8; i++)
+    {
+        v8hi row;
+
+        memcpy(&row, in + i * 8, sizeof(row));
+        d[i] = __builtin_convertvector(row, v8sf);
+    }
+    FDCT_1D(d);
+
+    float t[64];
+
+    memcpy(t, d, sizeof(t));
+    for (int i = 0; i < 8; i++)
+    {
+        d[i] = (v8sf){ t[i], t[8 + i], t[16 + i], t[24 + i], t[32 + i], t[40 + i], t[48 + i], t[56 + i] };
+    }
+    FDCT_1D(d);
+
+    for (int i = 0; i < 8; i++)
+    {
+        v8sf scale;
+
+        memcpy(&scale, divisor + i * 8, sizeof(scale));
+        // 반올림: (int)(x + 16384.5) - 16384 (IJG jcdctmgr)
+        v8si value = __builtin_convertvector(d[i] * scale + 16384.5f, v8si) - 16384;
+        v8hi packed = __builtin_convertvector(value, v8hi);
+
+        memcpy(out + i * 8, &packed, sizeof(packed));
+    }
+#else
+    float t[64];
+    float d[8];
+
+    for (int c = 0; c < 8; c++)
+    {
+        for (int r = 0; r < 8; r++)
+        {
+            d[r] = in[r * 8 + c];
+        }
+        FDCT_1D(d);
+        for (int r = 0; r < 8; r++)
+        {
+            t[r * 8 + c] = d[r];
+        }
+    }
+    for (int u = 0; u < 8; u++)
+    {
+        memcpy(d, t + u * 8, sizeof(d));
+        FDCT_1D(d);
+        for (int h = 0; h < 8; h++)
+        {
+            out[h * 8 + u] = (int)(d[h] * divisor[h * 8 + u] + 16384.5f) - 16384;
+        }
+    }
+#endif
+}
+
+static inline int magnitude_size(int value)
+{
+    if (value < 0)
+    {
+        value = -value;
+    }
+    return value ? 32 - __builtin_clz(value) : 0;
+}
+
+// 공간을 미리 확보한 후 호출 (MAX_BLOCK_BYTES), size <= 27
+static inline void put_bits(struct jpeg_writer *writer, uint32_t code, int size)
+{
+    writer->bits = (writer->bits << size) | (code & ((1u << size) - 1));
+    writer->count += size;
+
+    while (writer->count >= 8)
+    {
+        uint8_t value = writer->bits >> (writer->count -= 8);
+
+        writer->data[writer->length++] = value;
+        if (value == 0xff)
+        {
+            writer->data[writer->length++] = 0;
+        }
+    }
+}
+
+// jpeg_write_block과 같은 부호화, 0이 아닌 AC 계수 위치를 비트마스크로 모아 건너뜀
+static inline void encode_block(struct jpeg_writer *writer, const int16_t coef[64], const uint8_t zigzag[64], int *pred, const struct jpeg_huffman *dc, const struct jpeg_huffman *ac)
+{
+    uint64_t mask = 0;
+
+    for (int k = 1; k < 64; k++)
+    {
+        mask |= (uint64_t)(coef[zigzag[k]] != 0) << k;
+    }
+
+    int diff = coef[0] - *pred;
+    int size = magnitude_size(diff);
+
+    *pred = coef[0];
+    put_bits(writer, ((uint32_t)dc->code[size] << size) | ((diff < 0 ? diff - 1 : diff) & ((1u << size) - 1)), dc->size[size] + size);
+
+    int last = 0;
+
+    while (mask)
+    {
+        int k = __builtin_ctzll(mask);
+        int run = k - last - 1;
+
+        mask &= mask - 1;
+        while (run > 15)
+        {
+            // ZRL: 0 16개
+            put_bits(writer, ac->code[0xf0], ac->size[0xf0]);
+            run -= 16;
+        }
+
+        int value = coef[zigzag[k]];
+        int symbol;
+
+        size = magnitude_size(value);
+        symbol = (run << 4) | size;
+        put_bits(writer, ((uint32_t)ac->code[symbol] << size) | ((value < 0 ? value - 1 : value) & ((1u << size) - 1)), ac->size[symbol] + size);
+        last = k;
+    }
+    if (last != 63)
+    {
+        // EOB
+        put_bits(writer, ac->code[0], ac->size[0]);
+    }
+}
+
+// MCU 행 [begin, end)를 writer에 부호화, 각 행 끝에 RSTn (마지막 행 제외)
+JPEG_TARGET_CLONES
+static void jpeg_encoder_encode_rows(struct jpeg_encoder *obj, struct jpeg_writer *writer, unsigned int begin, unsigned int end)
+{
+    const struct jpeg_huffman *dc[2] = { jpeg_std_huffman(0), jpeg_std_huffman(1) };
+    const struct jpeg_huffman *ac[2] = { jpeg_std_huffman(2), jpeg_std_huffman(3) };
+    int16_t block[4][64];
+    int16_t coef[64];
+
+    jpeg_writer_reset(writer);
+
+    for (unsigned int row = begin; row < end; row++)
+    {
+        // 재시작 구간마다 DC 예측값 초기화
+        int pred[3] = { 0, 0, 0 };
+
+        for (unsigned int column = 0; column < obj->mcu_columns; column++)
+        {
+            if (jpeg_writer_reserve(writer, 4 * MAX_BLOCK_BYTES))
+            {
+                return;
+            }
+            load_mcu(obj, column, row, block);
+
+            // 밝기 전용은 Y 블록만, 폭이 블록 홀수 개면 마지막 MCU의 오른쪽 블록은 영상 밖
+            int count = obj->gray ? (column * 2 + 1 < obj->block_columns ? 2 : 1) : 4;
+
+            for (int i = 0; i < count; i++)
+            {
+                int table = i < 2 ? 0 : 1;
+                int component = i < 2 ? 0 : i - 1;
+
+                dct_quantize(block[i], obj->divisor[table], coef);
+                encode_block(writer, coef, obj->zigzag, &pred[component], dc[table], ac[table]);
+            }
+        }
+        jpeg_write_flush(writer);
+        if (row + 1 < obj->mcu_rows)
+        {
+            jpeg_write_marker(writer, JPEG_RST0 + (row & 7));
+        }
+    }
+}
+
+static void *jpeg_encoder_worker(void *args)
+{
+    struct jpeg_encoder_strip *strip = args;
+    struct jpeg_encoder *obj = strip->encoder;
+
+    while (1)
+    {
+        sem_wait(&strip->start);
+        if (obj->stop)
+        {
+            break;
+        }
+        jpeg_encoder_encode_rows(obj, &strip->writer, strip->begin, strip->end);
+        sem_post(&obj->done);
+    }
+    return 0;
+}
+
+static void jpeg_encoder_write_header(struct jpeg_encoder *obj, struct jpeg_writer *writer)
+{
+    static const uint8_t jfif[] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+
+    jpeg_write_marker(writer, JPEG_SOI);
+    jpeg_write_segment(writer, JPEG_APP0, jfif, sizeof(jfif));
+    jpeg_write_dqt(writer, 0, obj->quant[0]);
+    if (obj->gray == 0)
+    {
+        jpeg_write_dqt(writer, 1, obj->quant[1]);
+    }
+    jpeg_write_sof0(writer, obj->width, obj->height, obj->gray ? &gray_component : encoder_components, obj->gray ? 1 : 3);
+    jpeg_write_std_dht(writer);
+
+    // 재시작 간격: MCU 한 행
+    jpeg_write_marker(writer, JPEG_DRI);
+    jpeg_write_word(writer, 4);
+    jpeg_write_word(writer, obj->gray ? obj->block_columns : obj->mcu_columns);
+
+    jpeg_write_sos(writer, obj->gray ? &gray_component : encoder_components, obj->gray ? 1 : 3);
+}
+
+jpeg_encoder_t *jpeg_encoder_create(int quality, int threads)
+{
+    struct jpeg_encoder *obj;
+
+    if (quality < 1)
+    {
+        quality = 1;
+    }
+    if (quality > 100)
+    {
+        quality = 100;
+    }
+    if (threads < 1)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        threads = cpus > 0 ? cpus : 1;
+    }
+    if (threads > MAX_THREADS)
+    {
+        threads = MAX_THREADS;
+    }
+
+    obj = malloc(sizeof(*obj));
+    if (obj == 0)
+    {
+        return 0;
+    }
+    memset(obj, 0, sizeof(*obj));
+    obj->quality = quality;
+    obj->thread_count = threads;
+
+    build_quant(obj->quant[0], std_luma_quant, quality);
+    build_quant(obj->quant[1], std_chroma_quant, quality);
+    build_divisor(obj->divisor[0], obj->quant[0]);
+    build_divisor(obj->divisor[1], obj->quant[1]);
+    for (int k = 0; k < 64; k++)
+    {
+        obj->zigzag[k] = (jpeg_zigzag[k] & 7) * 8 + (jpeg_zigzag[k] >> 3);
+    }
+
+    jpeg_writer_init(&obj->output);
+    sem_init(&obj->done, 0, 0);
+
+    // strip 0은 호출한 스레드에서 부호화
+    for (int i = 0; i < threads; i++)
+    {
+        struct jpeg_encoder_strip *strip = &obj->strips[i];
+
+        strip->encoder = obj;
+        jpeg_writer_init(&strip->writer);
+        if (i == 0)
+        {
+            continue;
+        }
+        sem_init(&strip->start, 0, 0);
+        if (pthread_create(&strip->thread, 0, jpeg_encoder_worker, strip))
+        {
+            // 초기화한 strip(이번 strip 까지)만 정리
+            obj->thread_count = i + 1;
+            jpeg_encoder_destroy(obj);
+            return 0;
+        }
+        strip->running = 1;
+    }
+
+    return obj;
+}
+
+void jpeg_encoder_destroy(jpeg_encoder_t *obj)
+{
+    if (obj == 0)
+    {
+        return;
+    }
+    obj->stop = 1;
+    for (int i = 1; i < obj->thread_count; i++)
+    {
+        struct jpeg_encoder_strip *strip = &obj->strips[i];
+
+        if (strip->running)
+        {
+            sem_post(&strip->start);
+            pthread_join(strip->thread, 0);
+        }
+        sem_destroy(&strip->start);
+    }
+    for (int i = 0; i < obj->thread_count; i++)
+    {
+        jpeg_writer_free(&obj->strips[i].writer);
+    }
+    jpeg_writer_free(&obj->output);
+    sem_destroy(&obj->done);
+    free(obj);
+}
+
+/* success: 0 */
+static int jpeg_encoder_encode(jpeg_encoder_t *obj, const void *yuyv, unsigned int width, unsigned int height, unsigned int stride, int gray, const void **data, size_t *length)
+{
+    if (width < 2 || height < 1 || width > 0xffff || height > 0xffff || stride < width * 2)
+    {
+        return 1;
+    }
+    obj->gray = gray;
+    obj->block_columns = (width + 7) / 8;
+    obj->src = yuyv;
+    obj->width = width;
+    obj->height = height;
+    obj->stride = stride;
+    obj->mcu_columns = (width + 15) / 16;
+    obj->mcu_rows = (height + 7) / 8;
+
+    int count = (unsigned int)obj->thread_count < obj->mcu_rows ? obj->thread_count : (int)obj->mcu_rows;
+
+    for (int i = 0; i < count; i++)
+    {
+        obj->strips[i].begin = obj->mcu_rows * i / count;
+        obj->strips[i].end = obj->mcu_rows * (i + 1) / count;
+    }
+    for (int i = 1; i < count; i++)
+    {
+        sem_post(&obj->strips[i].start);
+    }
+    jpeg_encoder_encode_rows(obj, &obj->strips[0].writer, obj->strips[0].begin, obj->strips[0].end);
+    for (int i = 1; i < count; i++)
+    {
+        sem_wait(&obj->done);
+    }
+
+    struct jpeg_writer *writer = &obj->output;
+    int failed = 0;
+
+    jpeg_writer_reset(writer);
+    jpeg_encoder_write_header(obj, writer);
+    for (int i = 0; i < count; i++)
+    {
+        jpeg_write_data(writer, obj->strips[i].writer.data, obj->strips[i].writer.length);
+        failed |= obj->strips[i].writer.failed;
+    }
+    jpeg_write_marker(writer, JPEG_EOI);
+
+    if (failed || writer->failed)
+    {
+        return 1;
+    }
+    *data = writer->data;
+    *length = writer->length;
+    return 0;
+}
+
+/* success: 0 */
+int jpeg_encoder_encode_yuyv(jpeg_encoder_t *obj, const void *yuyv, unsigned int width, unsigned int height, unsigned int stride, const void **data, size_t *length)
+{
+    return jpeg_encoder_encode(obj, yuyv, width, height, stride, 0, data, length);
+}
+
+/* success: 0 */
+int jpeg_encoder_encode_gray(jpeg_encoder_t *obj, const void *yuyv, unsigned int width, unsigned int height, unsigned int stride, const void **data, size_t *length)
+{
+    return jpeg_encoder_encode(obj, yuyv, width, height, stride, 1, data, length);
+}
+
+int jpeg_encoder_get_quality(jpeg_encoder_t *obj)
+{
+    return obj->quality;
+}
+
+int jpeg_encoder_get_threads(jpeg_encoder_t *obj)
+{
+    return obj->thread_count;
+}
+
+const char *jpeg_encoder_get_simd(void)
+{
+#if defined(JPEG_AVX2_DISPATCH)
+    return __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+#elif defined(__SSE2__)
+    return "sse2";
+#elif defined(__ARM_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,27 @@
+#ifndef JPEG_ENCODER_H
+#define JPEG_ENCODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct jpeg_encoder;
+typedef struct jpeg_encoder jpeg_encoder_t;
+
+// quality: 1 ~ 100, threads: 부호화 스레드 수 (0: CPU 수)
+jpeg_encoder_t *jpeg_encoder_create(int quality, int threads);
+void jpeg_encoder_destroy(jpeg_encoder_t *obj);
+
+// yuyv: YUYV 4:2:2, stride: 한 행의 바이트 수
+// 결과(data)는 다음 encode 호출 전까지 유효
+/* success: 0 */
+int jpeg_encoder_encode_yuyv(jpeg_encoder_t *obj, const void *yuyv, unsigned int width, unsigned int height, unsigned int stride, const void **data, size_t *length);
+// 같은 YUYV 입력에서 밝기(Y)만 단일 성분 JPEG으로 부호화
+/* success: 0 */
+int jpeg_encoder_encode_gray(jpeg_encoder_t *obj, const void *yuyv, unsigned int width, unsigned int height, unsigned int stride, const void **data, size_t *length);
+
+int jpeg_encoder_get_quality(jpeg_encoder_t *obj);
+int jpeg_encoder_get_threads(jpeg_encoder_t *obj);
+// 실행 중인 CPU에서 사용하는 SIMD 경로 이름
+const char *jpeg_encoder_get_simd(void);
+
+#endif
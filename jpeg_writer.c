@@ -0,0 +1,327 @@
+#include "jpeg_writer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+const uint8_t jpeg_std_dc_luma_bits[17] = { 0, 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+const uint8_t jpeg_std_dc_luma_vals[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+const uint8_t jpeg_std_dc_chroma_bits[17] = { 0, 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+const uint8_t jpeg_std_dc_chroma_vals[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+const uint8_t jpeg_std_ac_luma_bits[17] = { 0, 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+const uint8_t jpeg_std_ac_luma_vals[162] =
+{
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+const uint8_t jpeg_std_ac_chroma_bits[17] = { 0, 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+const uint8_t jpeg_std_ac_chroma_vals[162] =
+{
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+const uint8_t jpeg_zigzag[64] =
+{
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+static struct jpeg_huffman std_huffman[4];
+static pthread_once_t std_huffman_once = PTHREAD_ONCE_INIT;
+
+static void std_huffman_init()
+{
+    jpeg_huffman_build(&std_huffman[0], jpeg_std_dc_luma_bits, jpeg_std_dc_luma_vals);
+    jpeg_huffman_build(&std_huffman[1], jpeg_std_dc_chroma_bits, jpeg_std_dc_chroma_vals);
+    jpeg_huffman_build(&std_huffman[2], jpeg_std_ac_luma_bits, jpeg_std_ac_luma_vals);
+    jpeg_huffman_build(&std_huffman[3], jpeg_std_ac_chroma_bits, jpeg_std_ac_chroma_vals);
+}
+
+void jpeg_huffman_build(struct jpeg_huffman *table, const uint8_t bits[17], const uint8_t *vals)
+{
+    uint16_t code = 0;
+    int k = 0;
+
+    memset(table, 0, sizeof(*table));
+
+    // T.81 Annex C: 길이 순으로 코드 할당
+    for (int length = 1; length <= 16; length++)
+    {
+        for (int i = 0; i < bits[length]; i++)
+        {
+            table->code[vals[k]] = code;
+            table->size[vals[k]] = length;
+            code++;
+            k++;
+        }
+        code <<= 1;
+    }
+}
+
+const struct jpeg_huffman *jpeg_std_huffman(int index)
+{
+    pthread_once(&std_huffman_once, std_huffman_init);
+
+    return &std_huffman[index];
+}
+
+void jpeg_writer_init(struct jpeg_writer *writer)
+{
+    memset(writer, 0, sizeof(*writer));
+}
+
+void jpeg_writer_free(struct jpeg_writer *writer)
+{
+    if (writer->data)
+    {
+        free(writer->data);
+    }
+    memset(writer, 0, sizeof(*writer));
+}
+
+void jpeg_writer_reset(struct jpeg_writer *writer)
+{
+    writer->length = 0;
+    writer->bits = 0;
+    writer->count = 0;
+    writer->failed = 0;
+}
+
+/* success: 0 */
+int jpeg_writer_reserve(struct jpeg_writer *writer, size_t size)
+{
+    if (writer->length + size <= writer->available)
+    {
+        return 0;
+    }
+    size_t available = writer->available ? writer->available : 4096;
+    while (available < writer->length + size)
+    {
+        available *= 2;
+    }
+    uint8_t *data = realloc(writer->data, available);
+    if (data == 0)
+    {
+        writer->failed = 1;
+        return 1;
+    }
+    writer->data = data;
+    writer->available = available;
+    return 0;
+}
+
+void jpeg_write_byte(struct jpeg_writer *writer, uint8_t value)
+{
+    if (writer->length >= writer->available && jpeg_writer_reserve(writer, 1))
+    {
+        return;
+    }
+    writer->data[writer->length++] = value;
+}
+
+void jpeg_write_word(struct jpeg_writer *writer, uint16_t value)
+{
+    jpeg_write_byte(writer, value >> 8);
+    jpeg_write_byte(writer, value & 0xff);
+}
+
+void jpeg_write_data(struct jpeg_writer *writer, const void *data, size_t length)
+{
+    if (jpeg_writer_reserve(writer, length))
+    {
+        return;
+    }
+    memcpy(writer->data + writer->length, data, length);
+    writer->length += length;
+}
+
+void jpeg_write_marker(struct jpeg_writer *writer, uint8_t marker)
+{
+    jpeg_write_byte(writer, 0xff);
+    jpeg_write_byte(writer, marker);
+}
+
+void jpeg_write_segment(struct jpeg_writer *writer, uint8_t marker, const void *data, size_t length)
+{
+    jpeg_write_marker(writer, marker);
+    jpeg_write_word(writer, length + 2);
+    jpeg_write_data(writer, data, length);
+}
+
+void jpeg_write_dqt(struct jpeg_writer *writer, int id, const uint8_t table[64])
+{
+    jpeg_write_marker(writer, JPEG_DQT);
+    jpeg_write_word(writer, 2 + 1 + 64);
+    jpeg_write_byte(writer, id);
+    for (int i = 0; i < 64; i++)
+    {
+        jpeg_write_byte(writer, table[jpeg_zigzag[i]]);
+    }
+}
+
+void jpeg_write_dht(struct jpeg_writer *writer, int table_class, int id, const uint8_t bits[17], const uint8_t *vals)
+{
+    int count = 0;
+
+    for (int i = 1; i <= 16; i++)
+    {
+        count += bits[i];
+    }
+    jpeg_write_marker(writer, JPEG_DHT);
+    jpeg_write_word(writer, 2 + 1 + 16 + count);
+    jpeg_write_byte(writer, (table_class << 4) | id);
+    jpeg_write_data(writer, bits + 1, 16);
+    jpeg_write_data(writer, vals, count);
+}
+
+void jpeg_write_std_dht(struct jpeg_writer *writer)
+{
+    jpeg_write_dht(writer, 0, 0, jpeg_std_dc_luma_bits, jpeg_std_dc_luma_vals);
+    jpeg_write_dht(writer, 1, 0, jpeg_std_ac_luma_bits, jpeg_std_ac_luma_vals);
+    jpeg_write_dht(writer, 0, 1, jpeg_std_dc_chroma_bits, jpeg_std_dc_chroma_vals);
+    jpeg_write_dht(writer, 1, 1, jpeg_std_ac_chroma_bits, jpeg_std_ac_chroma_vals);
+}
+
+void jpeg_write_sof0(struct jpeg_writer *writer, unsigned int width, unsigned int height, const struct jpeg_component *components, int count)
+{
+    jpeg_write_marker(writer, JPEG_SOF0);
+    jpeg_write_word(writer, 2 + 6 + count * 3);
+    jpeg_write_byte(writer, 8);
+    jpeg_write_word(writer, height);
+    jpeg_write_word(writer, width);
+    jpeg_write_byte(writer, count);
+    for (int i = 0; i < count; i++)
+    {
+        jpeg_write_byte(writer, components[i].id);
+        jpeg_write_byte(writer, (components[i].h << 4) | components[i].v);
+        jpeg_write_byte(writer, components[i].tq);
+    }
+}
+
+void jpeg_write_sos(struct jpeg_writer *writer, const struct jpeg_component *components, int count)
+{
+    jpeg_write_marker(writer, JPEG_SOS);
+    jpeg_write_word(writer, 2 + 1 + count * 2 + 3);
+    jpeg_write_byte(writer, count);
+    for (int i = 0; i < count; i++)
+    {
+        jpeg_write_byte(writer, components[i].id);
+        jpeg_write_byte(writer, (components[i].td << 4) | components[i].ta);
+    }
+    // baseline: Ss = 0, Se = 63, Ah/Al = 0
+    jpeg_write_byte(writer, 0);
+    jpeg_write_byte(writer, 63);
+    jpeg_write_byte(writer, 0);
+}
+
+void jpeg_write_bits(struct jpeg_writer *writer, uint32_t code, int size)
+{
+    writer->bits = (writer->bits << size) | (code & ((1u << size) - 1));
+    writer->count += size;
+
+    while (writer->count >= 8)
+    {
+        uint8_t value = writer->bits >> (writer->count - 8);
+
+        writer->count -= 8;
+
+        // 엔트로피 데이터 안의 0xFF는 0x00을 덧붙여 마커와 구분
+        jpeg_write_byte(writer, value);
+        if (value == 0xff)
+        {
+            jpeg_write_byte(writer, 0);
+        }
+    }
+}
+
+static inline int magnitude_size(int value)
+{
+    if (value < 0)
+    {
+        value = -value;
+    }
+    return value ? 32 - __builtin_clz(value) : 0;
+}
+
+void jpeg_write_block(struct jpeg_writer *writer, const int16_t block[64], int *pred, const struct jpeg_huffman *dc, const struct jpeg_huffman *ac)
+{
+    int diff = block[0] - *pred;
+    int size = magnitude_size(diff);
+    int run = 0;
+
+    *pred = block[0];
+
+    // 음수는 1의 보수 표현의 하위 비트
+    jpeg_write_bits(writer, dc->code[size], dc->size[size]);
+    if (size)
+    {
+        jpeg_write_bits(writer, diff < 0 ? diff - 1 : diff, size);
+    }
+
+    for (int k = 1; k < 64; k++)
+    {
+        int value = block[jpeg_zigzag[k]];
+
+        if (value == 0)
+        {
+            run++;
+            continue;
+        }
+        while (run > 15)
+        {
+            // ZRL: 0 16개
+            jpeg_write_bits(writer, ac->code[0xf0], ac->size[0xf0]);
+            run -= 16;
+        }
+        size = magnitude_size(value);
+
+        int symbol = (run << 4) | size;
+
+        jpeg_write_bits(writer, ac->code[symbol], ac->size[symbol]);
+        jpeg_write_bits(writer, value < 0 ? value - 1 : value, size);
+        run = 0;
+    }
+    if (run)
+    {
+        // EOB
+        jpeg_write_bits(writer, ac->code[0], ac->size[0]);
+    }
+}
+
+void jpeg_write_flush(struct jpeg_writer *writer)
+{
+    if (writer->count > 0)
+    {
+        jpeg_write_bits(writer, 0x7f, 8 - writer->count);
+    }
+    writer->bits = 0;
+    writer->count = 0;
+}
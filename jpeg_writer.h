@@ -0,0 +1,92 @@
+#ifndef JPEG_WRITER_H
+#define JPEG_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define JPEG_SOI 0xD8
+#define JPEG_EOI 0xD9
+#define JPEG_SOF0 0xC0
+#define JPEG_DHT 0xC4
+#define JPEG_SOS 0xDA
+#define JPEG_DQT 0xDB
+#define JPEG_DRI 0xDD
+#define JPEG_RST0 0xD0
+#define JPEG_APP0 0xE0
+#define JPEG_COM 0xFE
+
+// 허프만 부호화 테이블 (심볼 -> 코드)
+struct jpeg_huffman
+{
+    uint16_t code[256];
+    uint8_t size[256];
+};
+
+struct jpeg_component
+{
+    uint8_t id;
+    uint8_t h;
+    uint8_t v;
+    // 양자화 테이블, DC/AC 허프만 테이블 번호
+    uint8_t tq;
+    uint8_t td;
+    uint8_t ta;
+};
+
+struct jpeg_writer
+{
+    uint8_t *data;
+    size_t length;
+    size_t available;
+
+    // 엔트로피 부호화 비트 버퍼
+    uint64_t bits;
+    int count;
+
+    int failed;
+};
+
+// ITU-T T.81 Annex K 표준 허프만 테이블 (bits[0]은 사용하지 않음)
+extern const uint8_t jpeg_std_dc_luma_bits[17];
+extern const uint8_t jpeg_std_dc_luma_vals[12];
+extern const uint8_t jpeg_std_dc_chroma_bits[17];
+extern const uint8_t jpeg_std_dc_chroma_vals[12];
+extern const uint8_t jpeg_std_ac_luma_bits[17];
+extern const uint8_t jpeg_std_ac_luma_vals[162];
+extern const uint8_t jpeg_std_ac_chroma_bits[17];
+extern const uint8_t jpeg_std_ac_chroma_vals[162];
+
+// 지그재그 순서 -> 행 우선 순서
+extern const uint8_t jpeg_zigzag[64];
+
+void jpeg_huffman_build(struct jpeg_huffman *table, const uint8_t bits[17], const uint8_t *vals);
+// 0: DC luma, 1: DC chroma, 2: AC luma, 3: AC chroma
+const struct jpeg_huffman *jpeg_std_huffman(int index);
+
+void jpeg_writer_init(struct jpeg_writer *writer);
+void jpeg_writer_free(struct jpeg_writer *writer);
+void jpeg_writer_reset(struct jpeg_writer *writer);
+/* success: 0 */
+int jpeg_writer_reserve(struct jpeg_writer *writer, size_t size);
+
+void jpeg_write_byte(struct jpeg_writer *writer, uint8_t value);
+void jpeg_write_word(struct jpeg_writer *writer, uint16_t value);
+void jpeg_write_data(struct jpeg_writer *writer, const void *data, size_t length);
+void jpeg_write_marker(struct jpeg_writer *writer, uint8_t marker);
+void jpeg_write_segment(struct jpeg_writer *writer, uint8_t marker, const void *data, size_t length);
+
+// table: 행 우선 순서
+void jpeg_write_dqt(struct jpeg_writer *writer, int id, const uint8_t table[64]);
+// table_class 0: DC, 1: AC
+void jpeg_write_dht(struct jpeg_writer *writer, int table_class, int id, const uint8_t bits[17], const uint8_t *vals);
+void jpeg_write_std_dht(struct jpeg_writer *writer);
+void jpeg_write_sof0(struct jpeg_writer *writer, unsigned int width, unsigned int height, const struct jpeg_component *components, int count);
+void jpeg_write_sos(struct jpeg_writer *writer, const struct jpeg_component *components, int count);
+
+void jpeg_write_bits(struct jpeg_writer *writer, uint32_t code, int size);
+// block: 양자화된 계수, 행 우선 순서
+void jpeg_write_block(struct jpeg_writer *writer, const int16_t block[64], int *pred, const struct jpeg_huffman *dc, const struct jpeg_huffman *ac);
+// 남은 비트를 1로 채워 바이트 경계로 맞춤
+void jpeg_write_flush(struct jpeg_writer *writer);
+
+#endif
@@ -1,15 +1,19 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <string.h>
+#include <getopt.h>
 #include <unistd.h>
 #include <sys/eventfd.h>
+#include <linux/videodev2.h>
 
 #include "logging.h"
 #include "mjpeg_server.h"
-#include "v4l2_client.h"
+#include "frame_source.h"
 
-static int done = 0;
+static volatile sig_atomic_t done = 0;
+static volatile sig_atomic_t dump = 0;
 static int event = -1;
 static void signal_handler(int sig)
 {
@@ -19,40 +23,309 @@ static void signal_handler(int sig)
     {
         done = 1;
 
+        write(event, &u, sizeof(u));
+    }
+    // kill -USR1 <pid> 로 전송 통계 출력
+    if (sig == SIGUSR1 && event >= 0)
+    {
+        dump = 1;
+
         write(event, &u, sizeof(u));
     }
 }
 
-static void v4l2_client_callback(v4l2_client_t *obj, void *opaque)
+static void frame_source_callback(frame_source_t *obj, const struct frame_source_frame *frame, void *opaque)
 {
-    void *buffer = v4l2_client_get_buffer(obj);
-    //unsigned int index = v4l2_client_get_buffer_index(obj);
-    unsigned int length = v4l2_client_get_buffer_length(obj);
-
-    mjpeg_server_post(opaque, buffer, length);
-    //char message[128];
-    //sprintf(message, "read queue: %3i, pointer: %p, length: %6i\r", index, buffer, length);
-    //write(fileno(stdout), message, strlen(message));
+    if (frame->encode_time)
+    {
+        mjpeg_server_add_encode_time(opaque, frame->encode_time);
+    }
+    mjpeg_server_post(opaque, frame->data, frame->length, frame->timestamp, frame->sequence);
+}
+
+// name:x,y,w,h[:percent]
+/* success: 0 */
+static int parse_zone(const char *spec, struct mjpeg_zone *zone)
+{
+    const char *colon = strchr(spec, ':');
+    int used = 0;
+
+    memset(zone, 0, sizeof(*zone));
+    if (colon == 0 || (size_t)(colon - spec) >= sizeof(zone->name))
+    {
+        return 1;
+    }
+    memcpy(zone->name, spec, colon - spec);
+    if (sscanf(colon + 1, "%u,%u,%u,%u%n", &zone->x, &zone->y, &zone->width, &zone->height, &used) != 4)
+    {
+        return 1;
+    }
+    colon += 1 + used;
+    if (*colon == ':')
+    {
+        used = 0;
+        if (sscanf(colon + 1, "%u%n", &zone->area, &used) != 1)
+        {
+            return 1;
+        }
+        colon += 1 + used;
+    }
+    return *colon != 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -l, --list                  list capture devices\n"
+        "  -d, --device <path>         capture device (default: /dev/video0)\n"
+        "  -S, --synthetic             generate test frames instead of capturing\n"
+        "  -R, --replay <path>         replay an MJPEG file or a directory of JPEGs\n"
+        "  -F, --fast                  replay as fast as possible\n"
+        "  -W, --width <pixels>        capture/synthetic frame width (default: 1920)\n"
+        "  -H, --height <pixels>       capture/synthetic frame height (default: 1080)\n"
+        "  -f, --fps <rate>            frame rate, capture 0: driver default, replay 0: original\n"
+        "                              (default: capture 0, synthetic 30, replay 0)\n"
+        "  -P, --pixel-format <name>   capture format: mjpeg | jpeg | yuyv (default: mjpeg)\n"
+        "  -q, --quality <1-100>       JPEG quality for yuyv capture (default: 85)\n"
+        "  -j, --encode-threads <n>    yuyv encoder threads, 0: CPU count (default: 0)\n"
+        "  -b, --buffers <count>       capture buffers (default: 4)\n"
+        "  -L, --low-latency           publish only the newest captured buffer\n"
+        "  -z, --frame-size <bytes>    pad synthetic frames to this size (default: 0)\n"
+        "  -r, --reactors <count>      event loop threads (default: 1)\n"
+        "  -c, --max-clients <count>   connection limit, 0: unlimited (default: 64)\n"
+        "  -o, --overload <policy>     reject | oldest | idle (default: oldest)\n"
+        "  -s, --frame-slots <count>   shared frame buffers (default: 16)\n"
+        "  -m, --client-fps <rate>     per-stream frame rate cap, ?fps=N overrides, 0: every frame (default: 0)\n"
+        "  -n, --nodelay <0|1>         TCP_NODELAY on client sockets (default: 1)\n"
+        "  -B, --sndbuf <bytes>        SO_SNDBUF for client sockets, 0: kernel autotuning (default: 0)\n"
+        "  -w, --notsent-lowat <bytes> hand a stream its next frame only below this many unsent bytes,\n"
+        "                              0: no limit (default: 131072)\n"
+        "  -t, --tls-cert <file>       serve HTTPS with this PEM certificate chain (kernel TLS when available)\n"
+        "  -K, --tls-key <file>        PEM private key (default: the certificate file)\n"
+        "  -x, --zerocopy              send large frames with MSG_ZEROCOPY\n"
+        "  -A, --adaptive              lower frame rate and resolution of streams whose send queue builds up,\n"
+        "                              ?adaptive=0|1 overrides\n"
+        "  -g, --motion <level>        send a frame only when a region changed by this luma level (1-255),\n"
+        "                              ?motion=N overrides, 0: every frame (default: 0)\n"
+        "  -k, --keepalive <seconds>   send a frame at least this often while gated, 0: never (default: 10)\n"
+        "  -Z, --zone <name:x,y,w,h[:percent]>\n"
+        "                              /events motion zone in pixels, w/h 0: to the edge, percent of changed\n"
+        "                              blocks to trigger, 0: any block (repeatable, default: whole frame)\n"
+        "  -e, --sensitivity <level>   /events block luma change to count as motion (default: 16)\n",
+        name
+    );
 }
 
 int main(int argc, char *argv[])
 {
     const char *device = "/dev/video0";
+    const char *replay = 0;
+    int synthetic = 0;
+    int fast = 0;
+    int width = 1920;
+    int height = 1080;
+    int fps = -1;
+    int frame_size = 0;
+    int buffers = 0;
+    int low_latency = 0;
+    int quality = 85;
+    int encode_threads = 0;
+    uint32_t pixel_format = V4L2_PIX_FMT_MJPEG;
+    int reactors = 1;
+    int max_clients = 64;
+    int frame_slots = 0;
+    int client_fps = 0;
+    int adaptive = 0;
+    int nodelay = 1;
+    int sndbuf = 0;
+    int notsent_lowat = 131072;
+    int zerocopy = 0;
+    const char *tls_cert = 0;
+    const char *tls_key = 0;
+    int motion = 0;
+    int keepalive = 10;
+    struct mjpeg_zone zones[MJPEG_EVENTS_MAX_ZONES];
+    int zone_count = 0;
+    int sensitivity = 0;
+    enum mjpeg_overload_policy overload = mjpeg_overload_evict_oldest;
+    int opt;
 
-    logging_init();
-
-    if (argc >= 2 && strcmp(argv[1], "-l") == 0)
+    static const struct option options[] =
     {
-        v4l2_device_list();
+        { "list", no_argument, 0, 'l' },
+        { "device", required_argument, 0, 'd' },
+        { "synthetic", no_argument, 0, 'S' },
+        { "replay", required_argument, 0, 'R' },
+        { "fast", no_argument, 0, 'F' },
+        { "width", required_argument, 0, 'W' },
+        { "height", required_argument, 0, 'H' },
+        { "fps", required_argument, 0, 'f' },
+        { "frame-size", required_argument, 0, 'z' },
+        { "pixel-format", required_argument, 0, 'P' },
+        { "quality", required_argument, 0, 'q' },
+        { "encode-threads", required_argument, 0, 'j' },
+        { "buffers", required_argument, 0, 'b' },
+        { "low-latency", no_argument, 0, 'L' },
+        { "reactors", required_argument, 0, 'r' },
+        { "max-clients", required_argument, 0, 'c' },
+        { "overload", required_argument, 0, 'o' },
+        { "frame-slots", required_argument, 0, 's' },
+        { "client-fps", required_argument, 0, 'm' },
+        { "nodelay", required_argument, 0, 'n' },
+        { "sndbuf", required_argument, 0, 'B' },
+        { "notsent-lowat", required_argument, 0, 'w' },
+        { "tls-cert", required_argument, 0, 't' },
+        { "tls-key", required_argument, 0, 'K' },
+        { "zerocopy", no_argument, 0, 'x' },
+        { "adaptive", no_argument, 0, 'A' },
+        { "motion", required_argument, 0, 'g' },
+        { "keepalive", required_argument, 0, 'k' },
+        { "zone", required_argument, 0, 'Z' },
+        { "sensitivity", required_argument, 0, 'e' },
+        { 0, 0, 0, 0 },
+    };
 
-        return 0;
-    }
-    if (argc >= 3 && strcmp(argv[1], "-d") == 0)
+    logging_init();
+
+    while ((opt = getopt_long(argc, argv, "ld:SR:FW:H:f:z:P:q:j:b:Lr:c:o:s:m:n:B:w:t:K:xAg:k:Z:e:", options, 0)) != -1)
     {
-        device = argv[2];
+        switch (opt)
+        {
+        case 'l':
+            v4l2_device_list();
+            return 0;
+        case 'd':
+            device = optarg;
+            break;
+        case 'S':
+            synthetic = 1;
+            break;
+        case 'R':
+            replay = optarg;
+            break;
+        case 'F':
+            fast = 1;
+            break;
+        case 'W':
+            width = atoi(optarg);
+            break;
+        case 'H':
+            height = atoi(optarg);
+            break;
+        case 'f':
+            fps = atoi(optarg);
+            break;
+        case 'z':
+            frame_size = atoi(optarg);
+            break;
+        case 'P':
+            if (strcmp(optarg, "mjpeg") == 0)
+            {
+                pixel_format = V4L2_PIX_FMT_MJPEG;
+            }
+            else if (strcmp(optarg, "jpeg") == 0)
+            {
+                pixel_format = V4L2_PIX_FMT_JPEG;
+            }
+            else if (strcmp(optarg, "yuyv") == 0)
+            {
+                pixel_format = V4L2_PIX_FMT_YUYV;
+            }
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'q':
+            quality = atoi(optarg);
+            break;
+        case 'j':
+            encode_threads = atoi(optarg);
+            break;
+        case 'b':
+            buffers = atoi(optarg);
+            break;
+        case 'L':
+            low_latency = 1;
+            break;
+        case 'r':
+            reactors = atoi(optarg);
+            break;
+        case 'c':
+            max_clients = atoi(optarg);
+            break;
+        case 'o':
+            if (strcmp(optarg, "reject") == 0)
+            {
+                overload = mjpeg_overload_reject;
+            }
+            else if (strcmp(optarg, "oldest") == 0)
+            {
+                overload = mjpeg_overload_evict_oldest;
+            }
+            else if (strcmp(optarg, "idle") == 0)
+            {
+                overload = mjpeg_overload_evict_idle;
+            }
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's':
+            frame_slots = atoi(optarg);
+            break;
+        case 'm':
+            client_fps = atoi(optarg);
+            break;
+        case 'n':
+            nodelay = atoi(optarg);
+            break;
+        case 'B':
+            sndbuf = atoi(optarg);
+            break;
+        case 'w':
+            notsent_lowat = atoi(optarg);
+            break;
+        case 't':
+            tls_cert = optarg;
+            break;
+        case 'K':
+            tls_key = optarg;
+            break;
+        case 'x':
+            zerocopy = 1;
+            break;
+        case 'A':
+            adaptive = 1;
+            break;
+        case 'g':
+            motion = atoi(optarg);
+            break;
+        case 'k':
+            keepalive = atoi(optarg);
+            break;
+        case 'Z':
+            if (zone_count == MJPEG_EVENTS_MAX_ZONES || parse_zone(optarg, &zones[zone_count]))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            zone_count++;
+            break;
+        case 'e':
+            sensitivity = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
     }
 
-    if (signal(SIGINT, signal_handler) == SIG_ERR)
+    if (signal(SIGINT, signal_handler) == SIG_ERR || signal(SIGUSR1, signal_handler) == SIG_ERR)
     {
         return 1;
     }
@@ -63,38 +336,99 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    int v4l2_ret;
+    int source_ret;
     int mjpeg_ret;
 
-    v4l2_client_t *v4l2 = v4l2_client_create(device);
+    frame_source_t *source;
+    if (synthetic)
+    {
+        source = frame_source_synthetic_create(width, height, frame_size > 0 ? frame_size : 0, fps >= 0 ? fps : 30);
+    }
+    else if (replay)
+    {
+        source = frame_source_replay_create(replay, fps > 0 ? fps : 0, fast);
+    }
+    else
+    {
+        v4l2_client_t *v4l2 = v4l2_client_create(device);
+
+        if (v4l2)
+        {
+            v4l2_client_set_format(v4l2, width, height, pixel_format);
+            v4l2_client_set_fps(v4l2, fps > 0 ? fps : 0);
+            v4l2_client_set_buffer_count(v4l2, buffers > 0 ? buffers : 0);
+            v4l2_client_set_latest(v4l2, low_latency);
+        }
+        source = frame_source_v4l2_create(v4l2, quality, encode_threads > 0 ? encode_threads : 0);
+    }
     mjpeg_server_t *mjpeg = mjpeg_server_create("0.0.0.0", 8080);
     
-    if (v4l2 == 0 || mjpeg == 0)
+    if (source == 0 || mjpeg == 0)
     {
-        v4l2_client_destroy(v4l2);
+        frame_source_destroy(source);
         mjpeg_server_destroy(mjpeg);
 
         return 1;
     }
 
-    v4l2_client_set_callback(v4l2, v4l2_client_callback, mjpeg);
+    frame_source_set_callback(source, frame_source_callback, mjpeg);
+    mjpeg_server_set_reactors(mjpeg, reactors);
+    mjpeg_server_set_max_clients(mjpeg, max_clients > 0 ? max_clients : 0, overload);
+    mjpeg_server_set_client_fps(mjpeg, client_fps > 0 ? client_fps : 0);
+    mjpeg_server_set_tcp(mjpeg, nodelay, sndbuf > 0 ? sndbuf : 0, notsent_lowat > 0 ? notsent_lowat : 0);
+    mjpeg_server_set_zerocopy(mjpeg, zerocopy);
+    if (tls_cert && mjpeg_server_set_tls(mjpeg, tls_cert, tls_key ? tls_key : tls_cert))
+    {
+        logging("tls setup failed: %s", tls_cert);
+        frame_source_destroy(source);
+        mjpeg_server_destroy(mjpeg);
+
+        return 1;
+    }
+    mjpeg_server_set_adaptive(mjpeg, adaptive);
+    mjpeg_server_set_motion(mjpeg, motion > 0 ? motion : 0, keepalive > 0 ? keepalive : 0);
+    for (int i = 0; i < zone_count; i++)
+    {
+        if (mjpeg_server_add_motion_zone(mjpeg, &zones[i]))
+        {
+            logging("invalid motion zone: %s", zones[i].name);
+        }
+    }
+    if (sensitivity > 0)
+    {
+        mjpeg_server_set_motion_sensitivity(mjpeg, sensitivity);
+    }
+    if (frame_slots > 0 && mjpeg_server_set_frame_slots(mjpeg, frame_slots))
+    {
+        logging("invalid frame slots: %d", frame_slots);
+    }
 
-    v4l2_ret = v4l2_client_start(v4l2);
+    source_ret = frame_source_start(source);
     mjpeg_ret = mjpeg_server_start(mjpeg);
 
-    logging("v4l2: %d, mjpeg: %d\n", v4l2_ret, mjpeg_ret);
+    logging("%s: %d, mjpeg: %d\n", frame_source_get_name(source), source_ret, mjpeg_ret);
 
-    if (v4l2_ret == 0 && mjpeg_ret == 0)
+    if (source_ret == 0 && mjpeg_ret == 0)
     {
-        uint64_t u = 0;
+        while (done == 0)
+        {
+            uint64_t u = 0;
+
+            read(event, &u, sizeof(u));
 
-        read(event, &u, sizeof(u));
+            if (dump)
+            {
+                dump = 0;
+                mjpeg_server_log_stats(mjpeg);
+            }
+        }
 
-        v4l2_client_stop(v4l2);
+        frame_source_stop(source);
+        mjpeg_server_log_stats(mjpeg);
         mjpeg_server_stop(mjpeg);
     }
 
-    v4l2_client_destroy(v4l2);
+    frame_source_destroy(source);
     mjpeg_server_destroy(mjpeg);
     close(event);
     return 0;
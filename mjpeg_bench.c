@@ -0,0 +1,642 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#ifdef MJPEG_TLS
+#include <openssl/ssl.h>
+#endif
+
+#include "logging.h"
+#include "mjpeg_server.h"
+#include "frame_source.h"
+#include "stats.h"
+
+// 합성 프레임 소스로 서버를 띄우고 루프백 시청자 N개로 multipart 스트림을 받아
+// 처리량, 지연 시간(프레임 소스의 캡처 시각 ~ 수신 완료), CPU 사용량, 드롭을 측정
+// 서버 CPU에서는 시청자 스레드와 합성 프레임 생성 시간을 뺌
+
+#define VIEWER_BUFFER (256 * 1024)
+// 프레임 앞부분에서 COM 세그먼트를 찾을 범위
+#define VIEWER_PEEK 256
+
+struct bench_viewer
+{
+    int id;
+    int sock;
+    pthread_t thread;
+    clockid_t clock;
+    uint64_t cpu_start;
+    uint64_t cpu_end;
+
+    // 측정 구간 카운터
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t gaps;
+    uint64_t *latency;
+    size_t latency_count;
+    size_t latency_available;
+
+    int failed;
+#ifdef MJPEG_TLS
+    SSL *ssl;
+#endif
+};
+
+static atomic_int measuring;
+static atomic_int done;
+// 프레임 소스 스레드의 CPU 시계 (첫 콜백에서 설정), 그 스레드에서 mjpeg_server_post에 쓴 CPU 시간 누적
+static clockid_t source_clock;
+static atomic_int source_clock_valid;
+static atomic_uint_least64_t source_post_cpu;
+static short port = 18080;
+#ifdef MJPEG_TLS
+// 설정하면 시청자는 HTTPS로 접속 (인증서 검증 없음)
+static SSL_CTX *tls_client;
+#endif
+
+static uint64_t thread_cpu(clockid_t clock)
+{
+    struct timespec ts;
+
+    if (clock_gettime(clock, &ts) != 0)
+    {
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void viewer_record(struct bench_viewer *viewer, const char *peek, size_t peek_length, uint64_t length, uint64_t *last)
+{
+    uint64_t now = stats_now();
+    unsigned long long sequence = 0;
+    unsigned long long timestamp = 0;
+    const char *comment = memmem(peek, peek_length, "synthetic sequence=", 19);
+
+    if (comment == 0 || sscanf(comment, "synthetic sequence=%llu timestamp=%llu", &sequence, &timestamp) != 2)
+    {
+        viewer->failed = 1;
+        return;
+    }
+
+    if (atomic_load(&measuring))
+    {
+        if (viewer->latency_count == viewer->latency_available)
+        {
+            size_t available = viewer->latency_available ? viewer->latency_available * 2 : 1024;
+            uint64_t *latency = realloc(viewer->latency, available * sizeof(*latency));
+
+            if (latency == 0)
+            {
+                viewer->failed = 1;
+                return;
+            }
+            viewer->latency = latency;
+            viewer->latency_available = available;
+        }
+        viewer->latency[viewer->latency_count++] = now > timestamp ? now - timestamp : 0;
+        viewer->frames++;
+        viewer->bytes += length;
+        if (*last && sequence > *last + 1)
+        {
+            viewer->gaps += sequence - *last - 1;
+        }
+    }
+    *last = sequence;
+}
+
+// 블로킹 소켓 연결, HTTPS면 핸드셰이크까지
+/* success: 0 */
+static int viewer_connect(struct bench_viewer *viewer, const struct sockaddr_in *addr)
+{
+    if (connect(viewer->sock, (const struct sockaddr *)addr, sizeof(*addr)) != 0)
+    {
+        return 1;
+    }
+#ifdef MJPEG_TLS
+    if (tls_client)
+    {
+        viewer->ssl = SSL_new(tls_client);
+        if (viewer->ssl == 0 || SSL_set_fd(viewer->ssl, viewer->sock) != 1 || SSL_connect(viewer->ssl) != 1)
+        {
+            return 1;
+        }
+    }
+#endif
+    return 0;
+}
+
+static ssize_t viewer_send(struct bench_viewer *viewer, const void *buffer, size_t length)
+{
+#ifdef MJPEG_TLS
+    if (viewer->ssl)
+    {
+        size_t written = 0;
+
+        return SSL_write_ex(viewer->ssl, buffer, length, &written) == 1 ? (ssize_t)written : -1;
+    }
+#endif
+    return send(viewer->sock, buffer, length, MSG_NOSIGNAL);
+}
+
+static ssize_t viewer_recv(struct bench_viewer *viewer, void *buffer, size_t length)
+{
+#ifdef MJPEG_TLS
+    if (viewer->ssl)
+    {
+        size_t read = 0;
+
+        return SSL_read_ex(viewer->ssl, buffer, length, &read) == 1 ? (ssize_t)read : -1;
+    }
+#endif
+    return recv(viewer->sock, buffer, length, 0);
+}
+
+static void *viewer_main(void *arg)
+{
+    struct bench_viewer *viewer = arg;
+    struct sockaddr_in addr;
+    static const char request[] = "GET /video.mjpeg HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    char *buffer = malloc(VIEWER_BUFFER);
+    char peek[VIEWER_PEEK];
+    size_t peek_length = 0;
+    size_t start = 0;
+    size_t end = 0;
+    uint64_t body = 0;
+    uint64_t left = 0;
+    uint64_t last = 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (buffer == 0 || viewer_connect(viewer, &addr) != 0 ||
+        viewer_send(viewer, request, sizeof(request) - 1) != sizeof(request) - 1)
+    {
+        viewer->failed = 1;
+        free(buffer);
+        return 0;
+    }
+
+    while (atomic_load(&done) == 0)
+    {
+        if (left)
+        {
+            size_t length = end - start < left ? end - start : left;
+
+            if (peek_length < VIEWER_PEEK)
+            {
+                size_t copy = VIEWER_PEEK - peek_length < length ? VIEWER_PEEK - peek_length : length;
+
+                memcpy(peek + peek_length, buffer + start, copy);
+                peek_length += copy;
+            }
+            start += length;
+            left -= length;
+            if (left == 0)
+            {
+                viewer_record(viewer, peek, peek_length, body, &last);
+            }
+        }
+        else
+        {
+            // 파트 헤더: Content-Length가 없으면 (HTTP 응답 헤더) 건너뜀
+            char *head = memmem(buffer + start, end - start, "\r\n\r\n", 4);
+
+            if (head)
+            {
+                char *field = memmem(buffer + start, head - (buffer + start), "Content-Length:", 15);
+
+                if (field)
+                {
+                    body = strtoull(field + 15, 0, 10);
+                    left = body;
+                    peek_length = 0;
+                }
+                start = head + 4 - buffer;
+                continue;
+            }
+        }
+
+        if (start == end)
+        {
+            start = end = 0;
+        }
+        else if (start > VIEWER_BUFFER / 2)
+        {
+            memmove(buffer, buffer + start, end - start);
+            end -= start;
+            start = 0;
+        }
+        if (end == VIEWER_BUFFER)
+        {
+            viewer->failed = 1;
+            break;
+        }
+
+        ssize_t len = viewer_recv(viewer, buffer + end, VIEWER_BUFFER - end);
+
+        if (len <= 0)
+        {
+            if (atomic_load(&done) == 0)
+            {
+                viewer->failed = 1;
+            }
+            break;
+        }
+        end += len;
+    }
+    free(buffer);
+
+    return 0;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const uint64_t *values, size_t count, double p)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    size_t index = (size_t)(p / 100.0 * (count - 1) + 0.5);
+
+    return values[index] / 1e6;
+}
+
+static struct mjpeg_histogram histogram_delta(const struct mjpeg_histogram *end, const struct mjpeg_histogram *start)
+{
+    struct mjpeg_histogram histogram;
+
+    histogram.count = end->count - start->count;
+    histogram.sum = end->sum - start->sum;
+    for (int i = 0; i < MJPEG_HISTOGRAM_BUCKETS; i++)
+    {
+        histogram.bucket[i] = end->bucket[i] - start->bucket[i];
+    }
+    return histogram;
+}
+
+static void print_histogram(const char *name, const struct mjpeg_histogram *histogram)
+{
+    printf("  %-16s avg %8.1f, p50 < %6llu, p90 < %6llu, p99 < %6llu (%llu samples)\n",
+        name,
+        histogram->count ? histogram->sum / 1e3 / histogram->count : 0,
+        (unsigned long long)mjpeg_histogram_percentile(histogram, 50),
+        (unsigned long long)mjpeg_histogram_percentile(histogram, 90),
+        (unsigned long long)mjpeg_histogram_percentile(histogram, 99),
+        (unsigned long long)histogram->count);
+}
+
+// 프레임 소스 스레드에서 호출, 스레드 CPU 중 게시 부분은 서버 몫이므로 따로 셈
+static void frame_source_callback(frame_source_t *obj, const struct frame_source_frame *frame, void *opaque)
+{
+    if (atomic_load_explicit(&source_clock_valid, memory_order_relaxed) == 0 && pthread_getcpuclockid(pthread_self(), &source_clock) == 0)
+    {
+        atomic_store_explicit(&source_clock_valid, 1, memory_order_release);
+    }
+    uint64_t start = thread_cpu(CLOCK_THREAD_CPUTIME_ID);
+
+    mjpeg_server_post(opaque, frame->data, frame->length, frame->timestamp, frame->sequence);
+    atomic_fetch_add(&source_post_cpu, thread_cpu(CLOCK_THREAD_CPUTIME_ID) - start);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -n, --viewers <count>       loopback viewers (default: 10)\n"
+        "  -t, --time <seconds>        measurement time (default: 10)\n"
+        "  -w, --warmup <seconds>      time before measuring (default: 2)\n"
+        "  -r, --reactors <count>      event loop threads (default: 1)\n"
+        "  -s, --frame-slots <count>   shared frame buffers (default: 16)\n"
+        "  -W, --width <pixels>        frame width (default: 1920)\n"
+        "  -H, --height <pixels>       frame height (default: 1080)\n"
+        "  -z, --frame-size <bytes>    frame size (default: 200000)\n"
+        "  -f, --fps <rate>            frame rate, 0: unlimited (default: 30)\n"
+        "  -p, --port <port>           loopback port (default: 18080)\n"
+        "  -c, --tls-cert <file>       serve HTTPS with this PEM certificate chain\n"
+        "  -k, --tls-key <file>        PEM private key (default: the certificate file)\n",
+        name
+    );
+}
+
+int main(int argc, char *argv[])
+{
+    int viewers = 10;
+    int seconds = 10;
+    int warmup = 2;
+    int reactors = 1;
+    int frame_slots = 0;
+    int width = 1920;
+    int height = 1080;
+    int frame_size = 200000;
+    int fps = 30;
+    const char *tls_cert = 0;
+    const char *tls_key = 0;
+    int failed = 0;
+    int opt;
+
+    static const struct option options[] =
+    {
+        { "viewers", required_argument, 0, 'n' },
+        { "time", required_argument, 0, 't' },
+        { "warmup", required_argument, 0, 'w' },
+        { "reactors", required_argument, 0, 'r' },
+        { "frame-slots", required_argument, 0, 's' },
+        { "width", required_argument, 0, 'W' },
+        { "height", required_argument, 0, 'H' },
+        { "frame-size", required_argument, 0, 'z' },
+        { "fps", required_argument, 0, 'f' },
+        { "port", required_argument, 0, 'p' },
+        { "tls-cert", required_argument, 0, 'c' },
+        { "tls-key", required_argument, 0, 'k' },
+        { 0, 0, 0, 0 },
+    };
+
+    logging_init();
+
+    while ((opt = getopt_long(argc, argv, "n:t:w:r:s:W:H:z:f:p:c:k:", options, 0)) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            viewers = atoi(optarg);
+            break;
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 'r':
+            reactors = atoi(optarg);
+            break;
+        case 's':
+            frame_slots = atoi(optarg);
+            break;
+        case 'W':
+            width = atoi(optarg);
+            break;
+        case 'H':
+            height = atoi(optarg);
+            break;
+        case 'z':
+            frame_size = atoi(optarg);
+            break;
+        case 'f':
+            fps = atoi(optarg);
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'c':
+            tls_cert = optarg;
+            break;
+        case 'k':
+            tls_key = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (viewers <= 0 || seconds <= 0 || warmup < 0 || fps < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    frame_source_t *source = frame_source_synthetic_create(width, height, frame_size > 0 ? frame_size : 0, fps);
+    mjpeg_server_t *mjpeg = mjpeg_server_create("127.0.0.1", port);
+    struct bench_viewer *viewer = calloc(viewers, sizeof(*viewer));
+
+    if (source == 0 || mjpeg == 0 || viewer == 0)
+    {
+        frame_source_destroy(source);
+        mjpeg_server_destroy(mjpeg);
+        free(viewer);
+        return 1;
+    }
+
+    frame_source_set_callback(source, frame_source_callback, mjpeg);
+    mjpeg_server_set_reactors(mjpeg, reactors);
+    mjpeg_server_set_max_clients(mjpeg, 0, mjpeg_overload_reject);
+    if (frame_slots > 0 && mjpeg_server_set_frame_slots(mjpeg, frame_slots))
+    {
+        fprintf(stderr, "invalid frame slots: %d\n", frame_slots);
+    }
+    if (tls_cert)
+    {
+#ifdef MJPEG_TLS
+        tls_client = SSL_CTX_new(TLS_client_method());
+#endif
+        if (mjpeg_server_set_tls(mjpeg, tls_cert, tls_key ? tls_key : tls_cert))
+        {
+            fprintf(stderr, "tls setup failed: %s\n", tls_cert);
+            failed = 1;
+        }
+    }
+
+    if (failed || mjpeg_server_start(mjpeg) || frame_source_start(source))
+    {
+#ifdef MJPEG_TLS
+        SSL_CTX_free(tls_client);
+#endif
+        frame_source_destroy(source);
+        mjpeg_server_destroy(mjpeg);
+        free(viewer);
+        return 1;
+    }
+
+    int started = 0;
+
+    for (; started < viewers; started++)
+    {
+        viewer[started].id = started;
+        viewer[started].sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (viewer[started].sock == -1 || pthread_create(&viewer[started].thread, 0, viewer_main, &viewer[started]) != 0)
+        {
+            if (viewer[started].sock != -1)
+            {
+                close(viewer[started].sock);
+            }
+            failed = 1;
+            break;
+        }
+        pthread_getcpuclockid(viewer[started].thread, &viewer[started].clock);
+    }
+
+    struct mjpeg_server_stats stats_start;
+    struct mjpeg_server_stats stats_end;
+    uint64_t cpu_start;
+    uint64_t cpu_end;
+    // 프레임 소스 스레드 CPU, 그 중 게시 CPU
+    uint64_t source_start = 0;
+    uint64_t source_end = 0;
+    uint64_t post_start;
+    uint64_t post_end;
+    int source_valid;
+    uint64_t time_start;
+    uint64_t time_end;
+
+    sleep(warmup);
+
+    mjpeg_server_get_stats(mjpeg, &stats_start);
+    for (int i = 0; i < started; i++)
+    {
+        viewer[i].cpu_start = thread_cpu(viewer[i].clock);
+    }
+    source_valid = atomic_load_explicit(&source_clock_valid, memory_order_acquire);
+    if (source_valid)
+    {
+        source_start = thread_cpu(source_clock);
+    }
+    post_start = atomic_load(&source_post_cpu);
+    cpu_start = thread_cpu(CLOCK_PROCESS_CPUTIME_ID);
+    time_start = stats_now();
+    atomic_store(&measuring, 1);
+
+    sleep(seconds);
+
+    atomic_store(&measuring, 0);
+    time_end = stats_now();
+    cpu_end = thread_cpu(CLOCK_PROCESS_CPUTIME_ID);
+    post_end = atomic_load(&source_post_cpu);
+    if (source_valid)
+    {
+        source_end = thread_cpu(source_clock);
+    }
+    for (int i = 0; i < started; i++)
+    {
+        viewer[i].cpu_end = thread_cpu(viewer[i].clock);
+    }
+    mjpeg_server_get_stats(mjpeg, &stats_end);
+
+    atomic_store(&done, 1);
+    for (int i = 0; i < started; i++)
+    {
+        shutdown(viewer[i].sock, SHUT_RDWR);
+        pthread_join(viewer[i].thread, 0);
+#ifdef MJPEG_TLS
+        SSL_free(viewer[i].ssl);
+#endif
+        close(viewer[i].sock);
+    }
+    frame_source_stop(source);
+    mjpeg_server_stop(mjpeg);
+
+    // 결과 집계
+    double elapsed = (time_end - time_start) / 1e9;
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    uint64_t gaps = 0;
+    uint64_t viewer_cpu = 0;
+    size_t count = 0;
+    int viewer_failed = 0;
+
+    for (int i = 0; i < started; i++)
+    {
+        frames += viewer[i].frames;
+        bytes += viewer[i].bytes;
+        gaps += viewer[i].gaps;
+        viewer_cpu += viewer[i].cpu_end - viewer[i].cpu_start;
+        count += viewer[i].latency_count;
+        viewer_failed += viewer[i].failed;
+    }
+
+    uint64_t *latency = malloc((count ? count : 1) * sizeof(*latency));
+    size_t offset = 0;
+
+    for (int i = 0; latency && i < started; i++)
+    {
+        memcpy(latency + offset, viewer[i].latency, viewer[i].latency_count * sizeof(*latency));
+        offset += viewer[i].latency_count;
+    }
+    if (latency)
+    {
+        qsort(latency, count, sizeof(*latency), compare_u64);
+    }
+
+    // 프레임 소스 스레드에서 게시를 뺀 나머지가 프레임 생성
+    // 측정 시작 전에 소스 스레드가 아직 프레임을 내지 않았으면 생성 시간을 구분하지 못함 (0)
+    uint64_t source_cpu = source_end - source_start;
+    uint64_t post_cpu = post_end - post_start;
+    uint64_t generate_cpu = source_cpu > post_cpu ? source_cpu - post_cpu : 0;
+    // 프로세스 CPU에서 시청자 스레드와 프레임 생성을 빼면 서버
+    uint64_t other_cpu = viewer_cpu + generate_cpu;
+    uint64_t server_cpu = cpu_end - cpu_start > other_cpu ? cpu_end - cpu_start - other_cpu : 0;
+
+    printf("viewers: %d (failed: %d), reactors: %d, frame: %dx%d %d bytes, fps: %d, time: %.2f s\n",
+        started, viewer_failed, reactors, width, height, frame_size, fps, elapsed);
+    printf("posted: %.1f frames/s, discarded: %llu, server dropped: %llu, viewer gaps: %llu\n",
+        (stats_end.frames_posted - stats_start.frames_posted) / elapsed,
+        (unsigned long long)(stats_end.frames_discarded - stats_start.frames_discarded),
+        (unsigned long long)(stats_end.frames_dropped - stats_start.frames_dropped),
+        (unsigned long long)gaps);
+    printf("received: %.1f frames/s total, %.1f frames/s per viewer, %.1f MB/s\n",
+        frames / elapsed, frames / elapsed / (started ? started : 1), bytes / elapsed / 1e6);
+    printf("latency ms: p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f (%zu samples)\n",
+        latency ? percentile(latency, count, 50) : 0,
+        latency ? percentile(latency, count, 90) : 0,
+        latency ? percentile(latency, count, 99) : 0,
+        latency ? percentile(latency, count, 99.9) : 0,
+        latency && count ? latency[count - 1] / 1e6 : 0,
+        count);
+    printf("server cpu: %.1f %%, %.3f %% per viewer, send calls: %llu (saved: %llu)\n",
+        server_cpu / elapsed / 1e7,
+        server_cpu / elapsed / 1e7 / (started ? started : 1),
+        (unsigned long long)(stats_end.send_calls - stats_start.send_calls),
+        (unsigned long long)(stats_end.send_calls_saved - stats_start.send_calls_saved));
+    printf("frame generation cpu: %.1f %% (not included in server cpu or latency)%s\n",
+        generate_cpu / elapsed / 1e7,
+        source_valid ? "" : ", unknown: no frame before measuring");
+
+    struct mjpeg_histogram capture_to_publish = histogram_delta(&stats_end.capture_to_publish, &stats_start.capture_to_publish);
+    struct mjpeg_histogram publish_to_send = histogram_delta(&stats_end.publish_to_send, &stats_start.publish_to_send);
+    struct mjpeg_histogram send_duration = histogram_delta(&stats_end.send_duration, &stats_start.send_duration);
+    struct mjpeg_histogram first_frame = stats_end.first_frame;
+
+    printf("server latency us:\n");
+    print_histogram("capture->publish", &capture_to_publish);
+    print_histogram("publish->send", &publish_to_send);
+    print_histogram("send", &send_duration);
+    // 시청자는 측정 전에 접속하므로 누적 값
+    print_histogram("first frame", &first_frame);
+    if (tls_cert)
+    {
+        // 접속 시 한 번, 누적 값
+        print_histogram("tls handshake", &stats_end.tls_handshake);
+        printf("tls: handshakes: %llu (failed: %llu), kernel tls sessions: %llu\n",
+            (unsigned long long)stats_end.tls_handshakes,
+            (unsigned long long)stats_end.tls_failed,
+            (unsigned long long)stats_end.tls_ktls);
+    }
+
+    free(latency);
+    for (int i = 0; i < started; i++)
+    {
+        free(viewer[i].latency);
+    }
+    free(viewer);
+#ifdef MJPEG_TLS
+    SSL_CTX_free(tls_client);
+#endif
+    frame_source_destroy(source);
+    mjpeg_server_destroy(mjpeg);
+
+    return failed || viewer_failed;
+}
@@ -0,0 +1,458 @@
+#include "mjpeg_events.h"
+#include "logging.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+// 기본 감도: 블록 평균 밝기 차이
+#define DEFAULT_SENSITIVITY 16
+// 마지막 움직임 후 이 시간 동안 움직임이 없으면 stop (ns)
+#define HOLD_TIME 2000000000ull
+
+struct mjpeg_events_zone
+{
+    struct mjpeg_zone zone;
+    // 분석 스레드에서만 변경
+    atomic_int active;
+    uint64_t last_motion;
+};
+
+struct mjpeg_events
+{
+    mjpeg_events_callback_t published;
+    void *opaque;
+    unsigned int sensitivity;
+    int zone_count;
+    struct mjpeg_events_zone zones[MJPEG_EVENTS_MAX_ZONES];
+
+    int stop;
+    int running;
+    pthread_t thread;
+    // 깨우기 요청이 쌓이지 않도록 pending이 0 -> 1 일 때만 post
+    sem_t wakeup;
+    atomic_int pending;
+    atomic_int subscribers;
+    // 구독자가 다시 생기면 이전 프레임과 영역 상태를 버림
+    atomic_int reset;
+
+    // source, history, last_id 보호
+    sem_t semaphore;
+    struct mjpeg_frame *source;
+    struct mjpeg_event history[MJPEG_EVENTS_HISTORY];
+    uint64_t last_id;
+
+    // 분석 스레드에서만 사용, 블록마다 평균 밝기 (frame->blocks 복사)
+    uint8_t *blocks;
+    uint8_t *previous;
+    size_t available;
+    unsigned int columns;
+    unsigned int rows;
+    int has_previous;
+    uint64_t analysed;
+    int failing;
+
+    struct mjpeg_events_stats stats;
+};
+
+static void mjpeg_events_kick(mjpeg_events_t *obj)
+{
+    if (atomic_exchange(&obj->pending, 1) == 0)
+    {
+        sem_post(&obj->wakeup);
+    }
+}
+
+static void mjpeg_events_emit(mjpeg_events_t *obj, int zone, int active, struct mjpeg_frame *frame, unsigned int blocks)
+{
+    sem_wait(&obj->semaphore);
+    struct mjpeg_event *event = &obj->history[++obj->last_id % MJPEG_EVENTS_HISTORY];
+
+    event->id = obj->last_id;
+    event->zone = zone;
+    event->active = active;
+    event->sequence = frame->sequence;
+    event->timestamp = frame->timestamp ? frame->timestamp : frame->published;
+    event->blocks = blocks;
+    sem_post(&obj->semaphore);
+
+    atomic_store(&obj->zones[zone].active, active);
+    stats_add(&obj->stats.events, 1);
+}
+
+/* success: 0 */
+static int mjpeg_events_prepare(mjpeg_events_t *obj, unsigned int columns, unsigned int rows)
+{
+    size_t size = (size_t)columns * rows;
+
+    if (columns != obj->columns || rows != obj->rows)
+    {
+        // 크기가 바뀌면 이전 프레임과 비교하지 않음
+        obj->has_previous = 0;
+    }
+    if (size > obj->available)
+    {
+        uint8_t *blocks = realloc(obj->blocks, size);
+
+        if (blocks == 0)
+        {
+            return 1;
+        }
+        obj->blocks = blocks;
+
+        uint8_t *previous = realloc(obj->previous, size);
+
+        if (previous == 0)
+        {
+            return 1;
+        }
+        obj->previous = previous;
+        obj->available = size;
+    }
+    obj->columns = columns;
+    obj->rows = rows;
+    return 0;
+}
+
+// 영역마다 바뀐 블록을 세어 start/stop 판단
+/* events: 1 */
+static int mjpeg_events_compare(mjpeg_events_t *obj, struct mjpeg_frame *frame)
+{
+    uint64_t timestamp = frame->timestamp ? frame->timestamp : frame->published;
+    int emitted = 0;
+
+    for (int i = 0; i < obj->zone_count; i++)
+    {
+        struct mjpeg_events_zone *state = &obj->zones[i];
+        const struct mjpeg_zone *zone = &state->zone;
+        unsigned int x0 = zone->x / 8;
+        unsigned int y0 = zone->y / 8;
+        unsigned int x1 = zone->width ? (zone->x + zone->width + 7) / 8 : obj->columns;
+        unsigned int y1 = zone->height ? (zone->y + zone->height + 7) / 8 : obj->rows;
+        unsigned int changed = 0;
+
+        x1 = x1 < obj->columns ? x1 : obj->columns;
+        y1 = y1 < obj->rows ? y1 : obj->rows;
+        if (x0 >= x1 || y0 >= y1)
+        {
+            continue;
+        }
+        for (unsigned int y = y0; y < y1; y++)
+        {
+            const uint8_t *current = obj->blocks + (size_t)y * obj->columns;
+            const uint8_t *previous = obj->previous + (size_t)y * obj->columns;
+
+            for (unsigned int x = x0; x < x1; x++)
+            {
+                unsigned int diff = current[x] > previous[x] ? current[x] - previous[x] : previous[x] - current[x];
+
+                changed += diff >= obj->sensitivity;
+            }
+        }
+        unsigned int required = (x1 - x0) * (y1 - y0) * zone->area / 100;
+
+        if (changed && changed >= required)
+        {
+            state->last_motion = timestamp;
+            if (atomic_load(&state->active) == 0)
+            {
+                mjpeg_events_emit(obj, i, 1, frame, changed);
+                emitted = 1;
+            }
+        }
+        else if (atomic_load(&state->active) && timestamp >= state->last_motion + HOLD_TIME)
+        {
+            mjpeg_events_emit(obj, i, 0, frame, changed);
+            emitted = 1;
+        }
+    }
+    return emitted;
+}
+
+static void mjpeg_events_run(mjpeg_events_t *obj)
+{
+    sem_wait(&obj->semaphore);
+    struct mjpeg_frame *frame = mjpeg_frame_ref(obj->source);
+    sem_post(&obj->semaphore);
+
+    if (frame == 0 || frame->sequence == obj->analysed)
+    {
+        mjpeg_frame_unref(frame);
+        return;
+    }
+    obj->analysed = frame->sequence;
+
+    if (atomic_exchange(&obj->reset, 0))
+    {
+        obj->has_previous = 0;
+        for (int i = 0; i < obj->zone_count; i++)
+        {
+            atomic_store(&obj->zones[i].active, 0);
+        }
+    }
+
+    uint64_t start = stats_now();
+    // 변환 스레드가 복원한 블록 평균을 그대로 사용
+    int failed = atomic_load_explicit(&frame->motion_state, memory_order_acquire) != MJPEG_FRAME_MOTION_VALID;
+    unsigned int columns = 0;
+    unsigned int rows = 0;
+
+    if (failed == 0)
+    {
+        columns = frame->block_columns;
+        rows = frame->block_rows;
+        failed = mjpeg_events_prepare(obj, columns, rows);
+    }
+    if (failed)
+    {
+        if (obj->failing == 0)
+        {
+            logging("mjpeg events analyse failed (sequence: %llu, bytes: %u)", (unsigned long long)frame->source_sequence, frame->length);
+        }
+        obj->failing = 1;
+        obj->has_previous = 0;
+        stats_add(&obj->stats.frames_failed, 1);
+        mjpeg_frame_unref(frame);
+        return;
+    }
+    obj->failing = 0;
+
+    memcpy(obj->blocks, frame->blocks, (size_t)columns * rows);
+
+    int emitted = obj->has_previous && mjpeg_events_compare(obj, frame);
+    uint8_t *previous = obj->previous;
+
+    obj->previous = obj->blocks;
+    obj->blocks = previous;
+    obj->has_previous = 1;
+
+    stats_add(&obj->stats.frames_analysed, 1);
+    stats_histogram_add(&obj->stats.duration, stats_now() - start);
+    mjpeg_frame_unref(frame);
+
+    if (emitted && obj->published)
+    {
+        obj->published(obj->opaque);
+    }
+}
+
+static void *mjpeg_events_main(void *args)
+{
+    mjpeg_events_t *obj = args;
+
+    while (1)
+    {
+        sem_wait(&obj->wakeup);
+        if (obj->stop)
+        {
+            break;
+        }
+        atomic_store(&obj->pending, 0);
+        mjpeg_events_run(obj);
+    }
+    return 0;
+}
+
+mjpeg_events_t *mjpeg_events_create(mjpeg_events_callback_t published, void *opaque)
+{
+    mjpeg_events_t *obj = malloc(sizeof(*obj));
+
+    if (obj == 0)
+    {
+        return 0;
+    }
+    memset(obj, 0, sizeof(*obj));
+    obj->published = published;
+    obj->opaque = opaque;
+    obj->sensitivity = DEFAULT_SENSITIVITY;
+    sem_init(&obj->wakeup, 0, 0);
+    sem_init(&obj->semaphore, 0, 1);
+    atomic_init(&obj->pending, 0);
+    atomic_init(&obj->subscribers, 0);
+    atomic_init(&obj->reset, 0);
+    for (int i = 0; i < MJPEG_EVENTS_MAX_ZONES; i++)
+    {
+        atomic_init(&obj->zones[i].active, 0);
+    }
+    return obj;
+}
+
+void mjpeg_events_destroy(mjpeg_events_t *obj)
+{
+    if (obj == 0)
+    {
+        return;
+    }
+    mjpeg_events_stop(obj);
+    sem_destroy(&obj->wakeup);
+    sem_destroy(&obj->semaphore);
+    free(obj);
+}
+
+// 이름은 JSON, 메트릭 레이블에 그대로 쓰이므로 이스케이프가 필요 없는 문자만 허용
+static int zone_name_valid(const char *name, size_t size)
+{
+    size_t length = strnlen(name, size);
+
+    if (length == 0 || length == size)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = name[i];
+
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-'))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* success: 0 */
+int mjpeg_events_add_zone(mjpeg_events_t *obj, const struct mjpeg_zone *zone)
+{
+    if (obj->running || obj->zone_count == MJPEG_EVENTS_MAX_ZONES || !zone_name_valid(zone->name, sizeof(zone->name)) || zone->area > 100)
+    {
+        return 1;
+    }
+    obj->zones[obj->zone_count++].zone = *zone;
+    return 0;
+}
+
+void mjpeg_events_set_sensitivity(mjpeg_events_t *obj, unsigned int level)
+{
+    obj->sensitivity = level ? level : 1;
+}
+
+/* success: 0 */
+int mjpeg_events_start(mjpeg_events_t *obj)
+{
+    if (obj->running)
+    {
+        return 1;
+    }
+    if (obj->zone_count == 0)
+    {
+        struct mjpeg_zone zone;
+
+        memset(&zone, 0, sizeof(zone));
+        strcpy(zone.name, "frame");
+        mjpeg_events_add_zone(obj, &zone);
+    }
+    obj->stop = 0;
+    obj->failing = 0;
+    obj->has_previous = 0;
+    obj->analysed = 0;
+    if (pthread_create(&obj->thread, 0, mjpeg_events_main, obj))
+    {
+        mjpeg_events_stop(obj);
+        return 1;
+    }
+    obj->running = 1;
+    return 0;
+}
+
+void mjpeg_events_stop(mjpeg_events_t *obj)
+{
+    if (obj->running)
+    {
+        obj->stop = 1;
+        sem_post(&obj->wakeup);
+        pthread_join(obj->thread, 0);
+        obj->running = 0;
+    }
+    free(obj->blocks);
+    free(obj->previous);
+    obj->blocks = 0;
+    obj->previous = 0;
+    obj->available = 0;
+
+    sem_wait(&obj->semaphore);
+    mjpeg_frame_unref(obj->source);
+    obj->source = 0;
+    sem_post(&obj->semaphore);
+}
+
+void mjpeg_events_subscribe(mjpeg_events_t *obj)
+{
+    if (atomic_fetch_add(&obj->subscribers, 1) == 0)
+    {
+        atomic_store(&obj->reset, 1);
+    }
+}
+
+void mjpeg_events_unsubscribe(mjpeg_events_t *obj)
+{
+    atomic_fetch_sub(&obj->subscribers, 1);
+}
+
+int mjpeg_events_get_subscribers(mjpeg_events_t *obj)
+{
+    return atomic_load(&obj->subscribers);
+}
+
+void mjpeg_events_post(mjpeg_events_t *obj, struct mjpeg_frame *frame)
+{
+    if (atomic_load(&obj->subscribers) == 0 || obj->running == 0)
+    {
+        return;
+    }
+    sem_wait(&obj->semaphore);
+    struct mjpeg_frame *prev = obj->source;
+    obj->source = mjpeg_frame_ref(frame);
+    sem_post(&obj->semaphore);
+
+    mjpeg_frame_unref(prev);
+    mjpeg_events_kick(obj);
+}
+
+/* found: 0 */
+int mjpeg_events_get(mjpeg_events_t *obj, uint64_t after, struct mjpeg_event *event)
+{
+    int found = 1;
+
+    sem_wait(&obj->semaphore);
+    if (after < obj->last_id)
+    {
+        uint64_t first = obj->last_id > MJPEG_EVENTS_HISTORY ? obj->last_id - MJPEG_EVENTS_HISTORY + 1 : 1;
+        uint64_t id = after + 1 > first ? after + 1 : first;
+
+        *event = obj->history[id % MJPEG_EVENTS_HISTORY];
+        found = 0;
+    }
+    sem_post(&obj->semaphore);
+    return found;
+}
+
+uint64_t mjpeg_events_get_last_id(mjpeg_events_t *obj)
+{
+    sem_wait(&obj->semaphore);
+    uint64_t id = obj->last_id;
+    sem_post(&obj->semaphore);
+
+    return id;
+}
+
+int mjpeg_events_get_zone_count(mjpeg_events_t *obj)
+{
+    return obj->zone_count;
+}
+
+const struct mjpeg_zone *mjpeg_events_get_zone(mjpeg_events_t *obj, int index)
+{
+    return &obj->zones[index].zone;
+}
+
+int mjpeg_events_get_zone_active(mjpeg_events_t *obj, int index)
+{
+    // 구독자가 없으면 분석하지 않으므로 이전 상태는 의미 없음
+    return atomic_load(&obj->subscribers) && atomic_load(&obj->zones[index].active);
+}
+
+struct mjpeg_events_stats *mjpeg_events_get_stats(mjpeg_events_t *obj)
+{
+    return &obj->stats;
+}
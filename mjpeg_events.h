@@ -0,0 +1,90 @@
+#ifndef MJPEG_EVENTS_H
+#define MJPEG_EVENTS_H
+
+#include <stdint.h>
+
+#include "mjpeg_frame.h"
+#include "stats.h"
+
+struct mjpeg_events;
+typedef struct mjpeg_events mjpeg_events_t;
+
+#define MJPEG_EVENTS_MAX_ZONES 8
+// 보관하는 최근 이벤트 수, 재연결한 클라이언트(Last-Event-ID)는 이 범위 안에서 이어서 받음
+#define MJPEG_EVENTS_HISTORY 64
+
+// 움직임을 감시할 영역 (픽셀), width/height 0: 영상 끝까지
+struct mjpeg_zone
+{
+    char name[32];
+    unsigned int x;
+    unsigned int y;
+    unsigned int width;
+    unsigned int height;
+    // 영역 안에서 바뀐 블록 비율이 이 값(%) 이상이면 움직임, 0: 블록 하나
+    unsigned int area;
+};
+
+struct mjpeg_event
+{
+    // 1부터 증가
+    uint64_t id;
+    int zone;
+    // 1: start, 0: stop
+    int active;
+    // 판단한 프레임의 번호, 캡처 시각 (CLOCK_MONOTONIC, ns), 바뀐 블록 수
+    uint64_t sequence;
+    uint64_t timestamp;
+    unsigned int blocks;
+};
+
+// 분석 스레드에서만 증가
+struct mjpeg_events_stats
+{
+    stats_counter_t frames_analysed;
+    stats_counter_t frames_failed;
+    stats_counter_t events;
+    struct stats_histogram duration;
+};
+
+typedef void (*mjpeg_events_callback_t)(void *opaque);
+
+// published: 새 이벤트가 생길 때마다 분석 스레드에서 호출
+mjpeg_events_t *mjpeg_events_create(mjpeg_events_callback_t published, void *opaque);
+void mjpeg_events_destroy(mjpeg_events_t *obj);
+
+// 영역이 없으면 영상 전체를 "frame" 영역으로 감시, start 전에 설정
+// 이름: 영문자, 숫자, '_', '-' (31자 이하)
+/* success: 0 */
+int mjpeg_events_add_zone(mjpeg_events_t *obj, const struct mjpeg_zone *zone);
+// 블록(8x8) 평균 밝기가 이전 프레임보다 level 이상 바뀌면 바뀐 블록
+void mjpeg_events_set_sensitivity(mjpeg_events_t *obj, unsigned int level);
+
+/* success: 0 */
+int mjpeg_events_start(mjpeg_events_t *obj);
+void mjpeg_events_stop(mjpeg_events_t *obj);
+
+// 구독자가 있을 때만 분석, 구독자가 없는 동안의 상태는 이어지지 않음
+void mjpeg_events_subscribe(mjpeg_events_t *obj);
+void mjpeg_events_unsubscribe(mjpeg_events_t *obj);
+// 구독자가 있으면 원본 프레임의 움직임 분석(mjpeg_motion_update)이 필요
+int mjpeg_events_get_subscribers(mjpeg_events_t *obj);
+
+// 움직임 분석을 마친 원본 프레임마다 호출 (실패한 프레임 포함), 직접 복호화하지 않고 frame->blocks를 비교
+// 분석이 밀리면 가장 최신 프레임만 분석
+void mjpeg_events_post(mjpeg_events_t *obj, struct mjpeg_frame *frame);
+
+// after 다음 이벤트, 보관 범위를 벗어났으면 가장 오래된 이벤트
+/* found: 0 */
+int mjpeg_events_get(mjpeg_events_t *obj, uint64_t after, struct mjpeg_event *event);
+// 마지막 이벤트 번호, 없으면 0
+uint64_t mjpeg_events_get_last_id(mjpeg_events_t *obj);
+
+int mjpeg_events_get_zone_count(mjpeg_events_t *obj);
+const struct mjpeg_zone *mjpeg_events_get_zone(mjpeg_events_t *obj, int index);
+// 분석 스레드가 갱신, 읽는 쪽은 근사값
+int mjpeg_events_get_zone_active(mjpeg_events_t *obj, int index);
+
+struct mjpeg_events_stats *mjpeg_events_get_stats(mjpeg_events_t *obj);
+
+#endif
@@ -0,0 +1,136 @@
+#include "mjpeg_frame.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+struct mjpeg_frame_pool
+{
+    unsigned int count;
+    atomic_uint next;
+
+    struct mjpeg_frame *frames;
+};
+
+mjpeg_frame_pool_t *mjpeg_frame_pool_create(unsigned int count)
+{
+    mjpeg_frame_pool_t *obj;
+    if (count == 0)
+    {
+        return 0;
+    }
+    obj = malloc(sizeof(*obj));
+    if (obj == 0)
+    {
+        return 0;
+    }
+    memset(obj, 0, sizeof(*obj));
+    obj->frames = calloc(count, sizeof(struct mjpeg_frame));
+    if (obj->frames == 0)
+    {
+        free(obj);
+        return 0;
+    }
+    obj->count = count;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        obj->frames[i].pool = obj;
+        atomic_init(&obj->frames[i].refcount, 0);
+        atomic_init(&obj->frames[i].motion_state, MJPEG_FRAME_MOTION_NONE);
+    }
+    atomic_init(&obj->next, 0);
+    return obj;
+}
+
+// 모든 프레임의 참조가 해제된 후 호출해야 함
+void mjpeg_frame_pool_destroy(mjpeg_frame_pool_t *obj)
+{
+    if (obj == 0)
+    {
+        return;
+    }
+    for (unsigned int i = 0; i < obj->count; i++)
+    {
+        if (obj->frames[i].data)
+        {
+            free(obj->frames[i].data);
+        }
+        free(obj->frames[i].blocks);
+    }
+    free(obj->frames);
+    free(obj);
+}
+
+struct mjpeg_frame *mjpeg_frame_pool_acquire(mjpeg_frame_pool_t *obj, unsigned int size)
+{
+    if (obj == 0)
+    {
+        return 0;
+    }
+    // 최근에 반환된 슬롯부터 재사용하지 않도록 순환하며 탐색
+    unsigned int start = atomic_fetch_add_explicit(&obj->next, 1, memory_order_relaxed);
+
+    for (unsigned int i = 0; i < obj->count; i++)
+    {
+        struct mjpeg_frame *frame = &obj->frames[(start + i) % obj->count];
+        int expected = 0;
+
+        if (!atomic_compare_exchange_strong_explicit(&frame->refcount, &expected, 1, memory_order_acquire, memory_order_relaxed))
+        {
+            continue;
+        }
+        // 참조가 없는 슬롯이므로 다른 스레드가 읽지 않음
+        if (frame->data == 0 || frame->available < size)
+        {
+            char *data = realloc(frame->data, size);
+            if (data == 0)
+            {
+                atomic_store_explicit(&frame->refcount, 0, memory_order_release);
+                return 0;
+            }
+            frame->data = data;
+            frame->available = size;
+        }
+        frame->length = 0;
+        frame->sequence = 0;
+        atomic_store_explicit(&frame->motion_state, MJPEG_FRAME_MOTION_NONE, memory_order_relaxed);
+        return frame;
+    }
+    return 0;
+}
+
+unsigned int mjpeg_frame_pool_get_count(mjpeg_frame_pool_t *obj)
+{
+    return obj->count;
+}
+
+void mjpeg_frame_build_head(struct mjpeg_frame *frame)
+{
+    frame->head_length = snprintf(frame->head, sizeof(frame->head),
+        "Content-Type: image/jpeg\r\n"
+        "Content-Length: %u\r\n"
+        "\r\n",
+        frame->length
+    );
+    assert(sizeof(frame->head) > frame->head_length);
+}
+
+struct mjpeg_frame *mjpeg_frame_ref(struct mjpeg_frame *frame)
+{
+    if (frame)
+    {
+        atomic_fetch_add_explicit(&frame->refcount, 1, memory_order_relaxed);
+    }
+    return frame;
+}
+
+void mjpeg_frame_unref(struct mjpeg_frame *frame)
+{
+    if (frame == 0)
+    {
+        return;
+    }
+    // 0이 되면 풀에서 다시 acquire 가능
+    atomic_fetch_sub_explicit(&frame->refcount, 1, memory_order_release);
+}
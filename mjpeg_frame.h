@@ -0,0 +1,62 @@
+#ifndef MJPEG_FRAME_H
+#define MJPEG_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+struct mjpeg_frame_pool;
+typedef struct mjpeg_frame_pool mjpeg_frame_pool_t;
+
+// 움직임 판단용 밝기 격자 크기 (가로, 세로 칸 수)
+#define MJPEG_FRAME_MOTION_GRID 16
+#define MJPEG_FRAME_MOTION_CELLS (MJPEG_FRAME_MOTION_GRID * MJPEG_FRAME_MOTION_GRID)
+
+// motion_state: 계산하지 않음 (게이트 없이 전송), 게시 후 분석 중, 계산됨
+#define MJPEG_FRAME_MOTION_NONE 0
+#define MJPEG_FRAME_MOTION_PENDING 1
+#define MJPEG_FRAME_MOTION_VALID 2
+
+// 캡처 스레드에서 한번 채운 후 게시(publish)되면 읽기 전용
+// 마지막 참조가 해제되면 풀로 반환되어 다음 프레임에 재사용
+struct mjpeg_frame
+{
+    char *data;
+    unsigned int length;
+    unsigned int available;
+    uint64_t sequence;
+    // 프레임 소스가 붙인 번호와 캡처 시각, 게시 시각 (CLOCK_MONOTONIC, ns)
+    uint64_t source_sequence;
+    uint64_t timestamp;
+    uint64_t published;
+    // multipart 파트 헤더, 게시할 때 한번만 생성
+    char head[128];
+    unsigned int head_length;
+    // 칸별 평균 밝기와 블록(8x8)별 평균 밝기 (mjpeg_motion_update), 유일하게 게시 후에 채우는 값
+    // 변환 스레드가 채운 후 motion_state를 release로 설정, 읽는 쪽은 acquire로 확인 후 읽음
+    uint8_t motion[MJPEG_FRAME_MOTION_CELLS];
+    atomic_int motion_state;
+    // block_columns x block_rows, 버퍼는 슬롯을 재사용해도 유지
+    uint8_t *blocks;
+    unsigned int block_columns;
+    unsigned int block_rows;
+    size_t blocks_available;
+
+    atomic_int refcount;
+    mjpeg_frame_pool_t *pool;
+};
+
+mjpeg_frame_pool_t *mjpeg_frame_pool_create(unsigned int count);
+void mjpeg_frame_pool_destroy(mjpeg_frame_pool_t *obj);
+
+/* failed or no free slot: 0 */
+struct mjpeg_frame *mjpeg_frame_pool_acquire(mjpeg_frame_pool_t *obj, unsigned int size);
+unsigned int mjpeg_frame_pool_get_count(mjpeg_frame_pool_t *obj);
+
+// length를 채운 후 게시 전에 호출
+void mjpeg_frame_build_head(struct mjpeg_frame *frame);
+
+struct mjpeg_frame *mjpeg_frame_ref(struct mjpeg_frame *frame);
+void mjpeg_frame_unref(struct mjpeg_frame *frame);
+
+#endif
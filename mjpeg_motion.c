@@ -0,0 +1,118 @@
+#include "mjpeg_motion.h"
+#include "jpeg_decoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct mjpeg_motion
+{
+    jpeg_decoder_t *decoder;
+};
+
+mjpeg_motion_t *mjpeg_motion_create(void)
+{
+    mjpeg_motion_t *obj = malloc(sizeof(*obj));
+
+    if (obj == 0)
+    {
+        return 0;
+    }
+    obj->decoder = jpeg_decoder_create();
+    if (obj->decoder == 0)
+    {
+        free(obj);
+        return 0;
+    }
+    return obj;
+}
+
+void mjpeg_motion_destroy(mjpeg_motion_t *obj)
+{
+    if (obj == 0)
+    {
+        return;
+    }
+    jpeg_decoder_destroy(obj->decoder);
+    free(obj);
+}
+
+// 게시된 프레임이지만 분석이 끝나기 전에는 변환 스레드만 접근
+/* success: 0 */
+static int mjpeg_motion_reserve(struct mjpeg_frame *frame, size_t size)
+{
+    if (size > frame->blocks_available)
+    {
+        uint8_t *blocks = realloc(frame->blocks, size);
+
+        if (blocks == 0)
+        {
+            return 1;
+        }
+        frame->blocks = blocks;
+        frame->blocks_available = size;
+    }
+    return 0;
+}
+
+/* success: 0 */
+int mjpeg_motion_update(mjpeg_motion_t *obj, struct mjpeg_frame *frame)
+{
+    struct jpeg_decoder_output output = { .scale = 8 };
+    uint32_t sum[MJPEG_FRAME_MOTION_CELLS];
+    uint32_t count[MJPEG_FRAME_MOTION_CELLS];
+    unsigned int columns = 0;
+    unsigned int rows = 0;
+    int failed = jpeg_decoder_decode(obj->decoder, frame->data, frame->length, &output, 1);
+
+    if (failed == 0)
+    {
+        columns = (jpeg_decoder_get_width(obj->decoder) + 7) / 8;
+        rows = output.height;
+        failed = mjpeg_motion_reserve(frame, (size_t)columns * rows);
+    }
+    if (failed)
+    {
+        atomic_store_explicit(&frame->motion_state, MJPEG_FRAME_MOTION_NONE, memory_order_release);
+        return 1;
+    }
+    memset(sum, 0, sizeof(sum));
+    memset(count, 0, sizeof(count));
+
+    // YUYV의 Y만 사용, 짝수로 늘어난 열은 버림, 영상이 격자보다 작으면 빈 칸은 0
+    for (unsigned int y = 0; y < rows; y++)
+    {
+        const uint8_t *line = output.yuyv + (size_t)y * output.stride;
+        uint8_t *out = frame->blocks + (size_t)y * columns;
+        unsigned int row = y * MJPEG_FRAME_MOTION_GRID / rows * MJPEG_FRAME_MOTION_GRID;
+
+        for (unsigned int x = 0; x < columns; x++)
+        {
+            unsigned int cell = row + x * MJPEG_FRAME_MOTION_GRID / columns;
+
+            out[x] = line[x * 2];
+            sum[cell] += out[x];
+            count[cell]++;
+        }
+    }
+    frame->block_columns = columns;
+    frame->block_rows = rows;
+    for (int i = 0; i < MJPEG_FRAME_MOTION_CELLS; i++)
+    {
+        frame->motion[i] = count[i] ? sum[i] / count[i] : 0;
+    }
+    atomic_store_explicit(&frame->motion_state, MJPEG_FRAME_MOTION_VALID, memory_order_release);
+    return 0;
+}
+
+unsigned int mjpeg_motion_score(const uint8_t a[MJPEG_FRAME_MOTION_CELLS], const uint8_t b[MJPEG_FRAME_MOTION_CELLS])
+{
+    unsigned int score = 0;
+
+    for (int i = 0; i < MJPEG_FRAME_MOTION_CELLS; i++)
+    {
+        unsigned int diff = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+
+        score = diff > score ? diff : score;
+    }
+    return score;
+}
@@ -0,0 +1,25 @@
+#ifndef MJPEG_MOTION_H
+#define MJPEG_MOTION_H
+
+#include <stdint.h>
+
+#include "mjpeg_frame.h"
+
+struct mjpeg_motion;
+typedef struct mjpeg_motion mjpeg_motion_t;
+
+// 프레임 사이의 변화량을 밝기 격자로 추정
+// 1/8 복원은 블록마다 DC 계수만 쓰므로 역변환 없이 허프만 복호화 비용만 듦
+// 복원은 프레임마다 한번만 하고 게이트(격자)와 /events(블록)가 결과를 함께 사용
+mjpeg_motion_t *mjpeg_motion_create(void);
+void mjpeg_motion_destroy(mjpeg_motion_t *obj);
+
+// frame->blocks에 블록별, frame->motion에 칸별 평균 밝기를 기록하고 motion_state를 VALID로 설정, 실패하면 NONE
+// 게시된 프레임에 한 스레드에서만 호출
+/* success: 0 */
+int mjpeg_motion_update(mjpeg_motion_t *obj, struct mjpeg_frame *frame);
+
+// 가장 많이 변한 칸의 밝기 차이 (0 ~ 255)
+unsigned int mjpeg_motion_score(const uint8_t a[MJPEG_FRAME_MOTION_CELLS], const uint8_t b[MJPEG_FRAME_MOTION_CELLS]);
+
+#endif
@@ -1,35 +1,89 @@
 #include "mjpeg_server.h"
+#include "mjpeg_frame.h"
+#include "mjpeg_transcoder.h"
+#include "mjpeg_motion.h"
+#include "mjpeg_events.h"
+#include "mjpeg_tls.h"
+#include "jpeg_decoder.h"
 #include "logging.h"
+#include "stats.h"
 
-#include <poll.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
-#include <assert.h>
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <linux/sockios.h>
+#include <linux/tcp.h>
+#include <linux/errqueue.h>
 
 /*
     reference:
         https://github.com/valbok/mjpeg-over-http/blob/master/bin/mjpeg-over-http.cpp
 */
-#define MAX_CLIENT 5
+#define MAX_CLIENT 64
+// 클라이언트마다 전송 중인 프레임은 대부분 같은 최신 프레임을 공유
+#define MAX_FRAME 16
+// 클라이언트 슬롯은 이 단위로 할당하고 해제하지 않음
+#define CLIENT_CHUNK 64
+#define MAX_EVENTS 64
+#define MAX_REACTOR 64
+#define MAX_REQUEST 8192
 #define BOUNDARY "mjpeg-over-http-boundary"
+// /metrics 응답 헤더 자리
+#define METRICS_HEAD 128
+// /snapshot.jpg?after= 대기 시간, 지나면 304
+#define SNAPSHOT_TIMEOUT 30000000000ull
+// 축소 파생 스트림의 JPEG 품질
+#define VARIANT_QUALITY 80
+// 움직임 게이트가 변화가 없어도 프레임을 보내는 간격 (초)
+#define MOTION_KEEPALIVE 10
+// 대역폭 적응 측정 간격
+#define ADAPTIVE_PROBE 500000000ull
+// 커널 송신 큐를 비우는 데 걸릴 시간이나 프레임 하나를 넘기는 데 걸린 시간이 이 값을 넘으면 한 단계 내림
+// 내린 뒤에는 이전 단계의 데이터가 큐에서 빠질 때 까지 ADAPTIVE_DOWN_HOLD 동안 더 내리지 않음
+#define ADAPTIVE_DOWN_DELAY 1000000000ull
+#define ADAPTIVE_DOWN_HOLD 2000000000ull
+// 큐에 보내는 중인 프레임만 있거나 큐 지연이 이 값 이하로 up_hold 동안 유지되면 한 단계 올림, 올린 직후 다시 내려가면 up_hold 두 배
+#define ADAPTIVE_UP_DELAY 100000000ull
+#define ADAPTIVE_UP_HOLD 5000000000ull
+#define ADAPTIVE_UP_HOLD_MAX 60000000000ull
+// 커널에 쌓인 보내지 않은 데이터가 이 값보다 적을 때만 새 프레임을 넘김 (TCP_NOTSENT_LOWAT)
+#define NOTSENT_LOWAT 131072
+// MSG_ZEROCOPY: 이보다 작은 프레임은 페이지 고정과 완료 알림 처리 비용이 복사보다 커서 복사로 전송
+#define ZEROCOPY_MIN 16384
+// 클라이언트마다 완료 알림을 기다리며 잡아 둘 수 있는 프레임 수, 넘으면 복사로 전송 (프레임 슬롯 보호)
+#define ZEROCOPY_PENDING 4
+// 닫은 연결의 완료 알림을 기다리는 최대 시간, 넘으면 RST로 끊어 전송 큐를 버린 후 프레임 반환
+#define ZEROCOPY_LINGER 10000000000ull
 
 enum socket_state
 {
     none,
-    read_get,
+    // HTTPS: 핸드셰이크가 끝나면 read_head
+    tls_handshake,
     read_head,
+    // 응답을 모두 전송하면 연결 종료 (favicon, 404)
+    send_response,
     send_mjpeg,
-    send_favicon,
+    // /snapshot.jpg?after=: sequence보다 새 프레임이 게시될 때 까지 대기
+    wait_frame,
+    // /events: 움직임 이벤트 (Server-Sent Events)
+    send_events,
+    // 닫은 연결, MSG_ZEROCOPY 완료 알림을 모두 받을 때 까지 소켓과 프레임 참조 유지
+    zerocopy_linger,
 };
 
 enum http_version
@@ -45,28 +99,191 @@ struct mjpeg_buffer
     unsigned int available;
 };
 
+struct mjpeg_reactor;
+
+// MSG_ZEROCOPY로 보낸 프레임, 알림 번호 first부터 count개의 완료 알림을 모두 받을 때 까지 참조 유지
+struct mjpeg_zerocopy
+{
+    uint32_t first;
+    uint32_t count;
+    uint32_t done;
+    struct mjpeg_frame *frame;
+};
+
 struct mjpeg_socket
 {
     int id;
     int code;
-    int event_data;
-    // 주로 클라이언트 스레드에서 문제가 있어서 작업을 종료할 때 write
-    // 서버 스레드와 클라이언트 스레드에서 poll 함수로 종료 확인
-    // 서버 스레드에서 클라이언트를 정리하기 위해 클라이언트 스레드에서는 read를 하지 말아야 함
-    int event_stop;
-    // 클라이언트 스레드에서 소켓 오류 발생 시 해제 시키므로
-    // 서버 스레드에서는 클라이언트 스레드가 종료된 후 체크하여 해제를 해야 함
     int socket;
+    // 다른 리액터에서 연결 종료를 요청할 때 설정
+    atomic_int kick;
+    // accept 순서, 0이면 연결이 종료되어 반환 대기 중
+    uint64_t serial;
+    // 마지막으로 보낼 데이터를 모두 전송한 시각 (accept 시각으로 초기화)
+    // 전송이 막혀 있거나 요청을 보내지 않는 연결일 수록 오래된 값
+    stats_counter_t active;
+
+    // 서버 전체의 연결 목록(accept 순서), clients_semaphore로 보호
+    struct mjpeg_socket *prev;
+    struct mjpeg_socket *next;
+    // 리액터의 클라이언트 목록, 리액터 스레드에서만 변경
+    struct mjpeg_socket *reactor_prev;
+    struct mjpeg_socket *reactor_next;
+    // 빈 슬롯 목록 또는 리액터의 반환 대기 목록
+    struct mjpeg_socket *free_next;
 
     char path[256];
 
     enum socket_state state;
     enum http_version version;
 
+    // 요청 헤더 수신 및 응답 헤더 전송에 사용
     struct mjpeg_buffer buffer;
 
+    // HTTPS 세션, 요청은 세션으로 읽음
+    // ktls: 송신을 커널 TLS로 넘겨 평문 sendmsg로 전송, 아니면 세션으로 암호화하여 전송
+    mjpeg_tls_session_t *tls;
+    int ktls;
+    // accept 시각
+    uint64_t accepted;
+
+    // 전송 대기 중인 데이터, 부분 전송 시 iov_base/iov_len을 갱신
+    struct iovec out[3];
+    int out_index;
+    int out_count;
+    // 현재 응답(프레임)을 보내는 동안 호출한 sendmsg 횟수
+    int out_calls;
+    unsigned int out_length;
+    // 전송이 끝날 때 까지 참조 유지
+    struct mjpeg_frame *frame;
+    // 현재 프레임을 MSG_ZEROCOPY로 보내는지, 소켓의 다음 알림 번호(성공한 sendmsg 마다 증가), 현재 프레임의 첫 알림 번호
+    int zerocopy;
+    uint32_t zerocopy_next;
+    uint32_t zerocopy_first;
+    // 커널에 넘겼지만 완료 알림을 받지 않은 프레임 (보낸 순서)
+    struct mjpeg_zerocopy zerocopy_pending[ZEROCOPY_PENDING];
+    int zerocopy_count;
+    // 보내는 스트림, 0: 원본, 1 이상: 파생 스트림 번호 + 1 (구독 중)
+    int variant;
+    // 마지막으로 전송을 시작한 프레임 번호 (보내는 스트림 기준)
+    uint64_t sequence;
+    // 현재 프레임 전송 시작 시각
+    uint64_t send_start;
+    // wait_frame 상태의 대기 만료 시각, zerocopy_linger 상태의 완료 알림 대기 만료 시각
+    uint64_t deadline;
+    // 요청 헤더를 모두 받은 시각
+    uint64_t requested;
+    // 프레임 간격 제한 (ns, 0: 모든 프레임), 다음 프레임을 보낼 캡처 시각
+    uint64_t interval;
+    uint64_t due;
+    // 움직임 게이트 (0: 모든 프레임), 마지막으로 보낸 프레임의 밝기 격자와 캡처 시각
+    unsigned int threshold;
+    int motion_valid;
+    uint8_t motion[MJPEG_FRAME_MOTION_CELLS];
+    uint64_t motion_sent;
+    // 마지막으로 보낸 움직임 이벤트 번호
+    uint64_t event_id;
+    // 대역폭 적응 (?adaptive), 요청한 스트림 설정에 단계별 축소와 프레임 간격을 곱해 구독
+    int adaptive;
+    struct mjpeg_variant request_variant;
+    int tier;
+    // stride 장마다 한 장 전송, strided: 마지막 전송 후 건너뛴 수
+    unsigned int stride;
+    unsigned int strided;
+    // 마지막 측정 시각과 그 때의 값 (송신 큐, 밀려 있었는지, 커널에 넘긴/전달된 누적 바이트, 전송/드롭한 프레임)
+    uint64_t probe_time;
+    int probe_queued;
+    int probe_backlog;
+    uint64_t probe_sent;
+    uint64_t probe_delivered;
+    uint64_t probe_frames;
+    uint64_t probe_dropped;
+    // 마지막 단계 변경 시각과 방향, 큐가 비어 있기 시작한 시각 (0: 막혀 있음)
+    uint64_t tier_changed;
+    int tier_raised;
+    uint64_t clear_since;
+    uint64_t up_hold;
+
+    // 리액터 스레드에서만 증가
+    stats_counter_t frames_sent;
+    stats_counter_t frames_dropped;
+    stats_counter_t bytes_sent;
+    // 아직 커널에 넘기지 못한 바이트 수
+    stats_counter_t pending;
+    // 대역폭 적응 단계 (/metrics)
+    stats_counter_t tier_gauge;
+
+    // 클라이언트를 소유한 리액터, 소켓 이벤트는 이 스레드에서만 처리
+    struct mjpeg_reactor *reactor;
+};
+
+struct mjpeg_client_chunk
+{
+    struct mjpeg_client_chunk *next;
+    struct mjpeg_socket sockets[CLIENT_CHUNK];
+};
+
+struct mjpeg_reactor_stats
+{
+    stats_counter_t frames_sent;
+    stats_counter_t frames_dropped;
+    // 움직임 게이트로 보내지 않은 프레임
+    stats_counter_t frames_suppressed;
+    // 보내지 않은 데이터가 TCP_NOTSENT_LOWAT 이상이라 새 프레임을 넘기지 않은 횟수
+    stats_counter_t send_deferred;
+    // TLS 핸드셰이크 완료/실패 수, 송신을 커널 TLS로 넘긴 세션 수, accept -> 핸드셰이크 완료 시간
+    stats_counter_t tls_handshakes;
+    stats_counter_t tls_failed;
+    stats_counter_t tls_ktls;
+    struct stats_histogram tls_handshake;
+    // MSG_ZEROCOPY sendmsg 호출 수, 완료 알림 중 커널이 결국 복사한 호출 수 (loopback 등)
+    stats_counter_t zerocopy_sends;
+    stats_counter_t zerocopy_copied;
+    // 대역폭 적응으로 단계를 내린/올린 횟수
+    stats_counter_t tier_down;
+    stats_counter_t tier_up;
+    stats_counter_t bytes_sent;
+    // sendmsg 호출 수, 세그먼트마다 send를 호출했을 때와 비교하여 줄어든 호출 수
+    stats_counter_t send_calls;
+    stats_counter_t send_calls_saved;
+    struct stats_histogram publish_to_send;
+    struct stats_histogram send_duration;
+    // 요청 -> 첫 프레임 전송 완료
+    struct stats_histogram first_frame;
+};
+
+struct mjpeg_reactor
+{
+    int id;
+    int epoll;
+    int event;
+
+    mjpeg_server_t *server;
+    // 마지막으로 확인한 최신 프레임, 전송을 마친 클라이언트는 이 프레임으로 이어서 전송
+    struct mjpeg_frame *frame;
+    // 파생 스트림별 최신 프레임
+    struct mjpeg_frame *variants[MJPEG_TRANSCODER_MAX_VARIANTS];
+    // 마지막으로 움직임을 분석한 원본 프레임
+    struct mjpeg_frame *analysed;
+
+    // 닫힌 클라이언트를 포함한 누적 값
+    struct mjpeg_reactor_stats stats;
+
+    // 이 리액터가 소유한 클라이언트, 리액터 스레드에서만 변경
+    struct mjpeg_socket *clients;
+    // 이벤트 처리 중 닫힌 클라이언트는 다른 리액터가 재사용하지 않도록 처리가 끝난 후 반환
+    struct mjpeg_socket *closed;
+    // wait_frame 상태의 클라이언트 수, 있으면 epoll_wait에 타임아웃을 두고 만료 확인
+    int waiting;
+    // zerocopy_linger 상태의 클라이언트 수, 만료 확인은 waiting과 같음
+    int lingering;
+
+    // 처리 중인 epoll_wait 결과
+    int event_index;
+    int event_count;
+    struct epoll_event events[MAX_EVENTS];
+
     pthread_t thread;
-    sem_t semaphore;
 };
 
 struct mjpeg_server
@@ -75,18 +292,66 @@ struct mjpeg_server
     short port;
 
     int stop;
-    int event;
     int socket;
 
-    struct mjpeg_buffer buffer;
-    struct mjpeg_socket *clients;
+    int reactor_count;
+    struct mjpeg_reactor *reactors;
+
+    struct mjpeg_buffer *favicon;
+
+    uint64_t sequence;
+    // 마지막으로 게시된 프레임, semaphore로 보호
+    struct mjpeg_frame *frame;
+    mjpeg_frame_pool_t *pool;
+    // 구독 중인 파생 스트림(?scale)만 변환
+    mjpeg_transcoder_t *transcoder;
+    // 움직임 게이트 기본값 (?motion=N 이 없는 스트림), 변환 스레드에서 프레임마다 밝기 격자 계산
+    // 기본값이 0이어도 게이트를 쓰는 클라이언트가 있으면 계산
+    unsigned int motion_threshold;
+    uint64_t motion_keepalive;
+    atomic_int motion_clients;
+    // /events 구독자가 있는 동안 분석 스레드에서 영역별 움직임 시작/종료 판단
+    mjpeg_events_t *events;
+
+    // 캡처 스레드에서만 증가
+    stats_counter_t frames_posted;
+    stats_counter_t frames_discarded;
+    stats_counter_t frames_lost;
+    struct stats_histogram capture_to_publish;
+    struct stats_histogram frame_size;
+    struct stats_histogram encode_duration;
+    // 마지막으로 받은 프레임 소스 번호
+    uint64_t source_sequence;
+
+    unsigned int max_clients;
+    enum mjpeg_overload_policy overload;
+    // ?fps가 없는 스트림의 프레임 간격 (ns, 0: 모든 프레임)
+    uint64_t interval;
+    // ?adaptive가 없는 스트림의 대역폭 적응 여부
+    int adaptive;
+    // 대기 소켓에 설정, accept한 소켓이 물려받음 (sndbuf, notsent_lowat 0: 커널 기본값)
+    int nodelay;
+    unsigned int sndbuf;
+    unsigned int notsent_lowat;
+    // SO_ZEROCOPY를 설정했으면 큰 프레임 본문을 MSG_ZEROCOPY로 전송
+    int zerocopy;
+    // 설정하면 모든 연결이 HTTPS
+    mjpeg_tls_t *tls;
+
+    // 클라이언트 슬롯 할당과 반환은 clients_semaphore로 보호
+    uint64_t serial;
+    unsigned int count;
+    unsigned int capacity;
+    // 연결 목록, head가 가장 오래된 연결
+    struct mjpeg_socket *head;
+    struct mjpeg_socket *tail;
+    struct mjpeg_socket *free;
+    struct mjpeg_client_chunk *chunks;
+    sem_t clients_semaphore;
 
-    pthread_t thread;
     sem_t semaphore;
 };
 
-static void *mjpeg_client_thread(void *arg);
-
 static struct mjpeg_buffer *read_favicon()
 {
     char path[256];
@@ -94,7 +359,9 @@ static struct mjpeg_buffer *read_favicon()
 
     struct mjpeg_buffer *buffer = 0;
 
-    if (readlink("/proc/self/exe", path, sizeof(path)) != -1)
+    memset(path, 0, sizeof(path));
+
+    if (readlink("/proc/self/exe", path, sizeof(path) - 1) != -1)
     {
         char *str = strrchr(path, '/');
         if (str)
@@ -130,18 +397,19 @@ static struct mjpeg_buffer *read_favicon()
         free(buffer);
         return 0;
     }
-    
+
     int fd = open(path, O_RDONLY);
     if (fd == -1)
     {
         free(buffer->data);
         free(buffer);
+        return 0;
     }
 
     size_t left = size;
     while (left > 0)
     {
-        size_t readlen = read(fd, buffer->data + (size - left), left);
+        ssize_t readlen = read(fd, buffer->data + (size - left), left);
         if (readlen <= 0)
         {
             free(buffer->data);
@@ -151,6 +419,7 @@ static struct mjpeg_buffer *read_favicon()
         }
         left -= readlen;
     }
+    close(fd);
     return buffer;
 }
 
@@ -195,804 +464,2700 @@ static int prepare_buffer(struct mjpeg_buffer *buffer, unsigned int size)
 }
 
 /* success: 0 */
-static int socket_write(int sock, const char *buffer, ssize_t *length)
+static int buffer_printf(struct mjpeg_buffer *buffer, const char *format, ...)
 {
-    ssize_t len = *length;
-    ssize_t left = *length;
+    while (1)
+    {
+        va_list args;
+        unsigned int left = buffer->available - buffer->length;
 
-    *length = 0;
+        va_start(args, format);
+        int length = vsnprintf(buffer->data + buffer->length, left, format, args);
+        va_end(args);
 
-    while (left)
-    {
-        ssize_t written = send(sock, buffer + (left - len), left, MSG_NOSIGNAL);
-        if (written <= 0)
+        if (length < 0)
+        {
+            return 1;
+        }
+        if ((unsigned int)length < left)
+        {
+            buffer->length += length;
+            return 0;
+        }
+        if (prepare_buffer(buffer, buffer->available * 2 + length + 1))
         {
             return 1;
         }
-        left -= written;
-        *length += written;
     }
-    return 0;
 }
 
-static void mjpeg_server_client_close(mjpeg_server_t *obj, int idx)
+// 전송한 만큼 iovec을 진행, 부분 전송이면 iov_base/iov_len을 갱신
+static void iov_advance(struct iovec *iov, int *index, int count, size_t written)
 {
-    void **rc = 0;
-    uint64_t u = 1;
-
-    if (obj == 0)
-    {
-        return;
-    }
-    struct mjpeg_socket *client = &obj->clients[idx];
-
-    logging("mjpeg client close: (event_data: %d, event_stop: %d, socket: %d)", client->event_data, client->event_stop, client->socket);
-
-    if (client->event_stop != -1)
-    {
-        write(obj->clients[idx].event_stop, &u, sizeof(u));
-    }
-    if (obj->clients[idx].thread)
-    {
-        pthread_join(obj->clients[idx].thread, rc);
-    }
-    if (obj->clients[idx].event_stop != -1)
+    while (*index < count && written >= iov[*index].iov_len)
     {
-        close(obj->clients[idx].event_stop);
+        written -= iov[*index].iov_len;
+        iov[*index].iov_len = 0;
+        (*index)++;
     }
-    if (obj->clients[idx].event_data != -1)
+    if (*index < count)
     {
-        close(obj->clients[idx].event_data);
+        iov[*index].iov_base = (char *)iov[*index].iov_base + written;
+        iov[*index].iov_len -= written;
     }
-    if (obj->clients[idx].socket != -1)
+}
+
+// zerocopy: MSG_ZEROCOPY로 전송, zerocopy_calls: 그 중 성공한 호출 수 (호출마다 완료 알림 번호 하나)
+/* done: 0, would block: 1, failed: -1 */
+static int socket_flush(int sock, struct iovec *iov, int *index, int count, int *calls, int zerocopy, int *zerocopy_calls)
+{
+    while (*index < count)
     {
-        close(obj->clients[idx].socket);
+        struct msghdr msg =
+        {
+            .msg_iov = iov + *index,
+            .msg_iovlen = count - *index,
+        };
+
+        // 헤더, 본문, 경계 문자열을 한번의 시스템 콜로 전송
+        ssize_t written = sendmsg(sock, &msg, MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+        if (written < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return 1;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == ENOBUFS && zerocopy)
+            {
+                // 고정할 수 있는 페이지(optmem, RLIMIT_MEMLOCK)가 부족하면 복사로 전송
+                zerocopy = 0;
+                continue;
+            }
+            return -1;
+        }
+        (*calls)++;
+        if (zerocopy)
+        {
+            (*zerocopy_calls)++;
+        }
+        iov_advance(iov, index, count, written);
     }
-    obj->clients[idx].event_data = -1;
-    obj->clients[idx].event_stop = -1;
-    obj->clients[idx].socket = -1;
-    obj->clients[idx].state = none;
-    obj->clients[idx].thread = 0;
+    return 0;
+}
 
-    if (idx == MAX_CLIENT - 1)
+// 커널 TLS를 쓰지 못하는 HTTPS 연결, socket_flush와 같지만 세션으로 암호화하여 전송
+/* done: 0, would block: 1, failed: -1 */
+static int tls_flush(mjpeg_tls_session_t *tls, struct iovec *iov, int *index, int count, int *calls)
+{
+    while (*index < count)
     {
-        return;
+        ssize_t written = mjpeg_tls_writev(tls, iov + *index, count - *index);
+        if (written < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return 1;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        (*calls)++;
+        iov_advance(iov, index, count, written);
     }
+    return 0;
+}
 
-    struct mjpeg_socket current = obj->clients[idx];
-
-    memmove(&obj->clients[idx], &obj->clients[idx + 1], sizeof(struct mjpeg_socket) * (MAX_CLIENT - idx - 1));
+static struct mjpeg_frame *mjpeg_server_get_frame(mjpeg_server_t *obj)
+{
+    sem_wait(&obj->semaphore);
+    struct mjpeg_frame *frame = mjpeg_frame_ref(obj->frame);
+    sem_post(&obj->semaphore);
 
-    obj->clients[MAX_CLIENT - 1] = current;
+    return frame;
 }
 
-static void mjpeg_server_accept(mjpeg_server_t *obj)
+static void mjpeg_reactor_wakeup(struct mjpeg_reactor *reactor)
 {
-    struct sockaddr_in addr;
-    socklen_t addr_len = sizeof(addr);
+    uint64_t u = 1;
 
-    int index = 0;
-    int count = 0;
+    write(reactor->event, &u, sizeof(u));
+}
 
-    memset(&addr, 0, sizeof(addr));
+// 새 프레임 게시 후 모든 리액터를 깨움 (캡처 스레드, 변환 스레드)
+static void mjpeg_server_wakeup(void *opaque)
+{
+    mjpeg_server_t *obj = opaque;
+    struct mjpeg_reactor *reactors = obj->reactors;
 
-    // pending에 빈 자리가 없으면 첫번째 소켓 연결 해제
-    logging("check open socket");
-    for (int i = 0; i < MAX_CLIENT; i++)
-    {
-        logging(" - idx: %d, socket: %d", i, obj->clients[i].socket);
-        if (obj->clients[i].socket != -1)
-        {
-            count++;
-        }
-    }
-    if (count == MAX_CLIENT)
+    for (int i = 0; reactors && i < obj->reactor_count; i++)
     {
-        mjpeg_server_client_close(obj, 0);
+        mjpeg_reactor_wakeup(&reactors[i]);
     }
+}
 
-    // 첫번째 빈 소켓 탐색
-    for (int i = 0; i < MAX_CLIENT; i++)
-    {
-        if (obj->clients[i].socket == -1)
-        {
-            index = i;
-            break;
-        }
-    }
-    logging("using clients index: %d", index);
+// 움직임 분석을 마친 원본을 /events 분석으로 넘김 (변환 스레드)
+static void mjpeg_server_analysed(void *opaque, struct mjpeg_frame *frame)
+{
+    mjpeg_server_t *obj = opaque;
+
+    mjpeg_events_post(obj->events, frame);
+}
 
-    struct mjpeg_socket *client = &obj->clients[index];
+// 클라이언트가 보내는 스트림의 최신 프레임 (리액터 캐시)
+static struct mjpeg_frame *mjpeg_client_stream_frame(struct mjpeg_socket *client)
+{
+    struct mjpeg_reactor *reactor = client->reactor;
 
-    // eventfd를 생성 못하면 리턴
-    client->event_data = eventfd(0, 0);
-    client->event_stop = eventfd(0, 0);
-    if (client->event_data == -1 || client->event_stop == -1)
+    if (client->variant)
     {
-        if (client->event_data != -1)
-        {
-            close(client->event_data);
-        }
-        if (client->event_stop != -1)
-        {
-            close(client->event_stop);
-        }
-        client->event_data = -1;
-        client->event_stop = -1;
-        return;
+        return reactor->variants[client->variant - 1];
+    }
+    // 게이트를 쓰는 스트림은 최신 프레임이 분석 중이면 마지막으로 분석한 프레임
+    // 게시가 분석보다 빨라도 최신 프레임만 기다리다 멈추지 않음
+    if (client->threshold && reactor->frame && atomic_load_explicit(&reactor->frame->motion_state, memory_order_relaxed) == MJPEG_FRAME_MOTION_PENDING)
+    {
+        return reactor->analysed;
     }
+    return reactor->frame;
+}
+
+// 리액터의 이벤트 처리가 끝난 후 호출, 슬롯을 빈 슬롯 목록으로 반환
+static void mjpeg_client_release(struct mjpeg_socket *client)
+{
+    mjpeg_server_t *obj = client->reactor->server;
+
+    sem_wait(&obj->clients_semaphore);
+    client->reactor = 0;
+    client->socket = -1;
+    client->free_next = obj->free;
+    obj->free = client;
+    sem_post(&obj->clients_semaphore);
+}
 
-    obj->clients[index].code = 0;
-    obj->clients[index].socket = accept(obj->socket, (struct sockaddr *)&addr, &addr_len);
-    obj->clients[index].state = read_get;
+// 전송을 마친 프레임 반환, MSG_ZEROCOPY로 보냈으면 완료 알림을 받을 때 까지 참조 유지
+static void mjpeg_client_release_frame(struct mjpeg_socket *client)
+{
+    uint32_t count = client->zerocopy_next - client->zerocopy_first;
 
-    if (obj->clients[index].buffer.data)
+    if (client->zerocopy && count)
     {
-        obj->clients[index].buffer.data[0] = 0;
-        obj->clients[index].buffer.length = 0;
+        struct mjpeg_zerocopy *pending = &client->zerocopy_pending[client->zerocopy_count++];
+
+        pending->first = client->zerocopy_first;
+        pending->count = count;
+        pending->done = 0;
+        pending->frame = client->frame;
     }
     else
     {
-        obj->clients[index].buffer.length = 0;
-        obj->clients[index].buffer.available = 0;
-    }
-
-    if (pthread_create(&obj->clients[index].thread, 0, mjpeg_client_thread, &obj->clients[index]) != 0)
-    {
-        mjpeg_server_client_close(obj, index);
+        mjpeg_frame_unref(client->frame);
     }
+    client->frame = 0;
+    client->zerocopy = 0;
 }
 
-static void mjpeg_server_client_post_mjpeg(mjpeg_server_t *obj)
+// 완료 알림 [lo, hi]에 해당하는 프레임 반환, 알림은 합쳐지거나 순서가 바뀌어 올 수 있음
+static void mjpeg_client_zerocopy_done(struct mjpeg_socket *client, uint32_t lo, uint32_t hi)
 {
-    uint64_t u = 1;
+    int kept = 0;
 
-    for (int i = 0; i < MAX_CLIENT; i++)
+    for (int i = 0; i < client->zerocopy_count; i++)
     {
-        struct mjpeg_socket *client = &obj->clients[i];
+        struct mjpeg_zerocopy *pending = &client->zerocopy_pending[i];
+        // 번호가 한바퀴 돌 수 있으므로 프레임의 첫 번호 기준 거리로 비교
+        uint32_t start = lo - pending->first;
+        uint32_t end = hi - pending->first;
 
-        if (obj == 0 || client->event_data == -1)
+        if (start >= pending->count && end >= pending->count && start <= end)
         {
-            return;
+            // 범위가 이 프레임 앞이나 뒤
         }
-        if (client->state != send_mjpeg)
+        else
         {
-            continue;
-        }
+            uint32_t from = start < pending->count && start <= end ? start : 0;
+            uint32_t to = end < pending->count ? end : pending->count - 1;
 
-        sem_wait(&client->semaphore);
-        if (prepare_buffer(&client->buffer, obj->buffer.length) == 0)
+            pending->done += to - from + 1;
+        }
+        if (pending->done >= pending->count)
         {
-            client->buffer.length = obj->buffer.length;
-            memcpy(client->buffer.data, obj->buffer.data, obj->buffer.length);
-            write(client->event_data, &u, sizeof(u));
+            mjpeg_frame_unref(pending->frame);
+            continue;
         }
-        sem_post(&client->semaphore);
+        client->zerocopy_pending[kept++] = *pending;
     }
+    client->zerocopy_count = kept;
 }
 
-static void *mjpeg_server_main(void *args)
+// EPOLLERR: MSG_ZEROCOPY 완료 알림을 에러 큐에서 모두 읽음
+/* success: 0, 소켓 오류이면 1 */
+static int mjpeg_client_reap(struct mjpeg_socket *client)
 {
-    // 0: 이벤트 FD
-    // 1: 서버 소켓
-    // 2~: 클라이언트
-    struct pollfd fds[3 + MAX_CLIENT];
-    struct mjpeg_server *mjpeg_server = args;
-
-    int ret;
-    int count;
+    struct mjpeg_reactor *reactor = client->reactor;
 
+    if (reactor->server->zerocopy == 0)
+    {
+        return 1;
+    }
     while (1)
     {
-        fds[0].fd = mjpeg_server->event;
-        fds[0].events = POLLIN;
-        fds[0].revents = 0;
-
-        fds[1].fd = mjpeg_server->socket;
-        fds[1].events = POLLIN;
-        fds[1].revents = 0;
-
-        count = 2;
+        char control[128];
+        struct msghdr msg =
+        {
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+        };
 
-        for (int i = 0; i < MAX_CLIENT; i++)
+        if (recvmsg(client->socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
         {
-            if (mjpeg_server->clients[i].event_stop == -1)
+            if (errno == EINTR)
             {
                 continue;
             }
-            fds[count].fd = mjpeg_server->clients[i].event_stop;
-            fds[count].events = POLLIN;
-            fds[count].revents = 0;
-
-            count++;
-        }
-
-        ret = poll(fds, count, -1);
-
-        if (ret == -1)
-        {
-            break;
-        }
-        if (mjpeg_server->stop)
-        {
             break;
         }
-
-        if (fds[0].revents)
-        {
-            uint64_t u = 0;
-
-            sem_wait(&mjpeg_server->semaphore);
-            read(mjpeg_server->event, &u, sizeof(u));
-            mjpeg_server_client_post_mjpeg(mjpeg_server);
-            sem_post(&mjpeg_server->semaphore);
-        }
-        if (fds[1].revents)
-        {
-            mjpeg_server_accept(mjpeg_server);
-        }
-        for (int i = 2; i < count; i++)
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
         {
-            if (fds[i].revents == 0)
+            if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)))
             {
                 continue;
             }
-            int idx = -1;
-            for (int j = 0; j < MAX_CLIENT; j++)
+            struct sock_extended_err *err = (struct sock_extended_err *)CMSG_DATA(cmsg);
+
+            if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno != 0)
             {
-                if (mjpeg_server->clients[j].event_stop == fds[i].fd)
-                {
-                    idx = j;
-                    break;
-                }
+                continue;
             }
-            if (idx == -1)
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
             {
-                continue;
+                stats_add(&reactor->stats.zerocopy_copied, err->ee_data - err->ee_info + 1);
             }
-            mjpeg_server_client_close(mjpeg_server, idx);
+            mjpeg_client_zerocopy_done(client, err->ee_info, err->ee_data);
         }
     }
+
+    // 에러 큐 외에 소켓 자체의 오류가 있으면 종료
+    int error = 0;
+    socklen_t length = sizeof(error);
+
+    if (getsockopt(client->socket, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0)
+    {
+        return 1;
+    }
     return 0;
 }
 
-mjpeg_server_t *mjpeg_server_create(const char *bind, short port)
+// 소켓을 닫고 슬롯을 반환 대기 목록으로
+static void mjpeg_client_finish(struct mjpeg_socket *client)
 {
-    mjpeg_server_t *obj;
-    if (bind == 0)
+    struct mjpeg_reactor *reactor = client->reactor;
+
+    // close하면 epoll에서도 제거됨
+    close(client->socket);
+
+    for (int i = 0; i < client->zerocopy_count; i++)
     {
-        return 0;
-    }    
-    obj = malloc(sizeof(*obj));
-    if (obj == 0)
+        mjpeg_frame_unref(client->zerocopy_pending[i].frame);
+    }
+    client->zerocopy_count = 0;
+    client->state = none;
+    client->out_index = 0;
+    client->out_count = 0;
+
+    if (client->reactor_prev)
     {
-        return 0;
+        client->reactor_prev->reactor_next = client->reactor_next;
     }
-    memset(obj, 0, sizeof(*obj));
-    sem_init(&obj->semaphore, 0, 1);
-    obj->event = -1;
-    obj->socket = -1;
-    obj->clients = malloc(sizeof(struct mjpeg_socket) * MAX_CLIENT);
-    if (!obj->clients)
+    else
     {
-        free(obj);
-        return 0;
+        reactor->clients = client->reactor_next;
     }
-    for (int i = 0; i < MAX_CLIENT; i++)
+    if (client->reactor_next)
     {
-        obj->clients[i].id = i + 1;
-        obj->clients[i].event_data = -1;
-        obj->clients[i].event_stop = -1;
-        obj->clients[i].socket = -1;
-        sem_init(&obj->clients[i].semaphore, 0, 1);
+        client->reactor_next->reactor_prev = client->reactor_prev;
     }
-    obj->port = port;
-    obj->bind = strdup(bind);
-    if (obj->bind == 0)
+    client->reactor_prev = 0;
+    client->reactor_next = 0;
+
+    // 아직 처리하지 않은 이벤트는 무시
+    for (int i = reactor->event_index + 1; i < reactor->event_count; i++)
     {
-        mjpeg_server_destroy(obj);
-        return 0;
+        if (reactor->events[i].data.ptr == client)
+        {
+            reactor->events[i].data.ptr = 0;
+        }
     }
-    return obj;
+    client->free_next = reactor->closed;
+    reactor->closed = client;
 }
 
-void mjpeg_server_destroy(mjpeg_server_t *obj)
+// zerocopy_linger: 완료 알림을 모두 받았으면 닫음
+static void mjpeg_client_linger(struct mjpeg_socket *client)
 {
-    void **rc = 0;
-    uint64_t u = 1;
+    mjpeg_client_reap(client);
+    if (client->zerocopy_count == 0)
+    {
+        client->reactor->lingering--;
+        mjpeg_client_finish(client);
+    }
+}
 
-    if (obj == 0)
+static void mjpeg_client_close(struct mjpeg_socket *client)
+{
+    struct mjpeg_reactor *reactor = client->reactor;
+    mjpeg_server_t *obj = reactor->server;
+
+    if (client->state == none)
     {
         return;
     }
-    if (obj->bind)
+    if (client->state == zerocopy_linger)
     {
-        free(obj->bind);
-        obj->bind = 0;
-    }
-    mjpeg_server_stop(obj);
+        // 완료 알림을 더 기다리지 않음 (만료, 서버 종료)
+        // RST로 끊으면 커널이 전송 큐를 버리므로 프레임 페이지를 더 읽지 않음
+        struct linger abort = { .l_onoff = 1, .l_linger = 0 };
 
-    for (int i = 0; i < MAX_CLIENT; i++)
+        logging("mjpeg zerocopy linger abort: (id: %d, socket: %d, pending: %d)", client->id, client->socket, client->zerocopy_count);
+        setsockopt(client->socket, SOL_SOCKET, SO_LINGER, &abort, sizeof(abort));
+        reactor->lingering--;
+        mjpeg_client_finish(client);
+        return;
+    }
+    if (client->state == wait_frame)
     {
-        obj->stop = 1;
-        if (obj->clients[i].event_stop != -1)
-        {
-            write(obj->clients[i].event_stop, &u, sizeof(u));
-        }
-        if (obj->clients[i].thread)
-        {
-            pthread_join(obj->clients[i].thread, rc);
-        }
-        if (obj->clients[i].event_data != -1)
-        {
-            close(obj->clients[i].event_data);
-        }
-        if (obj->clients[i].event_stop != -1)
-        {
-            close(obj->clients[i].event_data);
-        }
-        if (obj->clients[i].socket != -1)
-        {
-            close(obj->clients[i].socket);
-        }
-        if (obj->clients[i].buffer.data)
-        {
-            free(obj->clients[i].buffer.data);
-        }
-        obj->clients[i].event_data = -1;
-        obj->clients[i].event_stop = -1;
-        obj->clients[i].socket = -1;
-        obj->clients[i].thread = 0;
-        obj->clients[i].buffer.data = 0;
-        obj->clients[i].buffer.length = 0;
-        obj->clients[i].buffer.available = 0;
-
-        sem_destroy(&obj->clients[i].semaphore);
+        reactor->waiting--;
     }
-    if (obj->buffer.data)
+    if (client->state == send_events)
     {
-        free(obj->buffer.data);
+        mjpeg_events_unsubscribe(obj->events);
     }
-    obj->buffer.data = 0;
-    obj->buffer.length = 0;
-    obj->buffer.available = 0;
-
-    sem_destroy(&obj->semaphore);
-    free(obj->clients);
-    free(obj);
-}
-
-/* success: 0 */
-int mjpeg_server_start(mjpeg_server_t *obj)
-{
-    struct sockaddr_in addr;
-
-    if (obj->event != -1)
+    if (client->variant)
     {
-        return 1;
+        mjpeg_transcoder_unsubscribe(obj->transcoder, client->variant - 1);
+        client->variant = 0;
     }
-
-    obj->stop = 0;
-    obj->event = eventfd(0, 0);
-    if (obj->event == -1)
+    if (client->threshold)
     {
-        mjpeg_server_stop(obj);
-        return 1;
+        atomic_fetch_sub(&obj->motion_clients, 1);
+        client->threshold = 0;
     }
 
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = inet_addr(obj->bind);
-    addr.sin_port = htons(obj->port);
+    logging("mjpeg client close: (id: %d, socket: %d, sent: %llu, dropped: %llu, bytes: %llu)",
+        client->id,
+        client->socket,
+        (unsigned long long)stats_get(&client->frames_sent),
+        (unsigned long long)stats_get(&client->frames_dropped),
+        (unsigned long long)stats_get(&client->bytes_sent)
+    );
 
-    obj->socket = socket(PF_INET, SOCK_STREAM, 0);
-    if (obj->socket == -1)
+    sem_wait(&obj->clients_semaphore);
+    if (client->prev)
     {
-        perror("socket");
-        mjpeg_server_stop(obj);
-        return 1;
+        client->prev->next = client->next;
     }
-    int optval = 1;
-    if (setsockopt(obj->socket, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval))!= 0)
+    else
     {
-        perror("setsockopt");
-        mjpeg_server_stop(obj);
-        return 1;
+        obj->head = client->next;
     }
-    if (bind(obj->socket, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    if (client->next)
     {
-        perror("bind");
-        mjpeg_server_stop(obj);
-        return 1;
+        client->next->prev = client->prev;
     }
-    if (listen(obj->socket, 1) != 0)
+    else
     {
-        perror("listen");
-        mjpeg_server_stop(obj);
-        return 1;
+        obj->tail = client->prev;
     }
-    if (pthread_create(&obj->thread, 0, &mjpeg_server_main, obj) != 0)
+    client->prev = 0;
+    client->next = 0;
+    client->serial = 0;
+    obj->count--;
+    sem_post(&obj->clients_semaphore);
+
+    mjpeg_tls_session_destroy(client->tls);
+    client->tls = 0;
+    client->ktls = 0;
+
+    // 보내던 프레임도 MSG_ZEROCOPY로 넘긴 부분이 있으면 완료 알림을 기다림
+    mjpeg_client_release_frame(client);
+    if (client->zerocopy_count)
     {
-        mjpeg_server_stop(obj);
-        return 1;
+        mjpeg_client_reap(client);
     }
-    return 0;
+    if (client->zerocopy_count)
+    {
+        // 커널이 아직 프레임 페이지를 보내는 중이므로 참조를 놓으면 슬롯이 재사용되어 다른 프레임 내용이 나갈 수 있음
+        // 서버 목록에서는 빠졌으므로 연결 수에 세지 않고, 소켓은 완료 알림을 받도록 닫지 않고 끊기만 함
+        shutdown(client->socket, SHUT_RDWR);
+        client->state = zerocopy_linger;
+        client->deadline = stats_now() + ZEROCOPY_LINGER;
+        client->out_index = 0;
+        client->out_count = 0;
+        reactor->lingering++;
+        return;
+    }
+    // 목록에 있는 동안은 소켓이 유효하도록 목록에서 제거한 후 close (/metrics에서 SIOCOUTQ 조회)
+    mjpeg_client_finish(client);
 }
 
-void mjpeg_server_stop(mjpeg_server_t *obj)
+/* clients_semaphore를 잡은 상태에서 호출, failed: 0 */
+static struct mjpeg_socket *mjpeg_server_alloc_client(mjpeg_server_t *obj)
 {
-    if (obj == 0)
+    if (obj->free == 0)
     {
-        return;
+        struct mjpeg_client_chunk *chunk = calloc(1, sizeof(*chunk));
+        if (chunk == 0)
+        {
+            return 0;
+        }
+        for (int i = CLIENT_CHUNK - 1; i >= 0; i--)
+        {
+            struct mjpeg_socket *client = &chunk->sockets[i];
+
+            client->id = obj->capacity + i + 1;
+            client->socket = -1;
+            client->state = none;
+            atomic_init(&client->kick, 0);
+
+            client->free_next = obj->free;
+            obj->free = client;
+        }
+        chunk->next = obj->chunks;
+        obj->chunks = chunk;
+        obj->capacity += CLIENT_CHUNK;
     }
-    if (obj->thread)
-    {
-        uint64_t u = 1;
 
-        obj->stop = 1;
+    struct mjpeg_socket *client = obj->free;
+    obj->free = client->free_next;
+    client->free_next = 0;
 
-        write(obj->event, &u, sizeof(u));
+    return client;
+}
 
-        pthread_join(obj->thread, 0);
-        obj->thread = 0;
-    }
-    if (obj->event != -1)
+/* clients_semaphore를 잡은 상태에서 호출 */
+static struct mjpeg_socket *mjpeg_server_find_victim(mjpeg_server_t *obj)
+{
+    struct mjpeg_socket *victim = 0;
+
+    for (struct mjpeg_socket *client = obj->head; client; client = client->next)
     {
-        close(obj->event);
-        obj->event = -1;
+        // 다른 리액터에 이미 종료를 요청한 연결은 제외
+        if (atomic_load(&client->kick))
+        {
+            continue;
+        }
+        if (obj->overload == mjpeg_overload_evict_oldest)
+        {
+            return client;
+        }
+        if (victim == 0 || stats_get(&victim->active) > stats_get(&client->active))
+        {
+            victim = client;
+        }
     }
+    return victim;
 }
 
-void mjpeg_server_post(mjpeg_server_t *obj, char *buffer, unsigned int length)
+static void mjpeg_server_reject(int sock)
 {
-    char *ptr;
-    uint64_t u = 1;
+    static const char response[] =
+        "HTTP/1.0 503 Service Unavailable\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: 0\r\n"
+        "Retry-After: 5\r\n"
+        "\r\n";
 
-    if (obj == 0)
-    {
-        return;
-    }
-    sem_wait(&obj->semaphore);
+    // 요청을 읽지 않고 응답, 송신 버퍼가 비어 있으므로 한번에 전송됨
+    send(sock, response, sizeof(response) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(sock);
+}
 
-    if (obj->buffer.data == 0)
-    {
-        obj->buffer.data = malloc(length);
-        obj->buffer.available = length;
-    }
-    else if (obj->buffer.available < length)
+static void mjpeg_server_accept(struct mjpeg_reactor *reactor)
+{
+    mjpeg_server_t *obj = reactor->server;
+
+    while (1)
     {
-        ptr = obj->buffer.data;
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
 
-        obj->buffer.data = realloc(obj->buffer.data, length);
-        obj->buffer.available = length;
+        memset(&addr, 0, sizeof(addr));
 
-        if (obj->buffer.data == 0)
+        int sock = accept4(obj->socket, (struct sockaddr *)&addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sock == -1)
         {
-            obj->buffer.available = 0;
+            // EPOLLEXCLUSIVE로 여러 리액터가 깨어나면 EAGAIN
+            return;
+        }
+
+        struct mjpeg_socket *client = 0;
+        struct mjpeg_socket *victim = 0;
+        int full;
 
-            free(ptr);
+        sem_wait(&obj->clients_semaphore);
+        full = obj->max_clients && obj->count >= obj->max_clients;
+        if (full && obj->overload != mjpeg_overload_reject)
+        {
+            victim = mjpeg_server_find_victim(obj);
         }
-    }
+        if (full == 0 || victim)
+        {
+            client = mjpeg_server_alloc_client(obj);
+        }
+        if (client)
+        {
+            client->socket = sock;
+            client->serial = ++obj->serial;
+            client->reactor = reactor;
+            client->prev = obj->tail;
+            client->next = 0;
+            if (obj->tail)
+            {
+                obj->tail->next = client;
+            }
+            else
+            {
+                obj->head = client;
+            }
+            obj->tail = client;
+            obj->count++;
+        }
+        if (client && victim && victim->reactor != reactor)
+        {
+            // 다른 리액터 소유면 종료를 요청, 종료될 때 까지 잠시 max_clients를 넘을 수 있음
+            atomic_store(&victim->kick, 1);
+            mjpeg_reactor_wakeup(victim->reactor);
+            victim = 0;
+        }
+        sem_post(&obj->clients_semaphore);
 
-    if (obj->buffer.data && obj->buffer.available >= length)
-    {
-        obj->buffer.length = length;
+        if (client == 0)
+        {
+            logging("mjpeg reject: %s:%d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+            if (obj->tls)
+            {
+                // 핸드셰이크 전이므로 평문 503 대신 바로 종료
+                close(sock);
+            }
+            else
+            {
+                mjpeg_server_reject(sock);
+            }
+            continue;
+        }
+        if (victim)
+        {
+            logging("mjpeg evict: (id: %d, socket: %d)", victim->id, victim->socket);
+            mjpeg_client_close(victim);
+        }
+
+        client->code = 0;
+        client->state = obj->tls ? tls_handshake : read_head;
+        client->accepted = stats_now();
+        client->tls = 0;
+        client->ktls = 0;
+        client->frame = 0;
+        client->zerocopy = 0;
+        client->zerocopy_next = 0;
+        client->zerocopy_count = 0;
+        client->sequence = 0;
+        client->out_index = 0;
+        client->out_count = 0;
+        client->buffer.length = 0;
+        atomic_store(&client->kick, 0);
+        atomic_store(&client->frames_sent, 0);
+        atomic_store(&client->frames_dropped, 0);
+        atomic_store(&client->bytes_sent, 0);
+        atomic_store(&client->pending, 0);
+        atomic_store(&client->active, stats_now());
+
+        // EPOLLOUT은 송신 버퍼가 가득 찼다가 비었을 때만 알림 (edge-triggered)
+        struct epoll_event ev =
+        {
+            .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+            .data.ptr = client,
+        };
+
+        client->reactor_prev = 0;
+        client->reactor_next = reactor->clients;
+        if (reactor->clients)
+        {
+            reactor->clients->reactor_prev = client;
+        }
+        reactor->clients = client;
 
-        memcpy(obj->buffer.data, buffer, length);
+        if (obj->tls)
+        {
+            client->tls = mjpeg_tls_session_create(obj->tls, sock);
+        }
+        if ((obj->tls && client->tls == 0) || epoll_ctl(reactor->epoll, EPOLL_CTL_ADD, sock, &ev) != 0)
+        {
+            mjpeg_client_close(client);
+            continue;
+        }
 
-        write(obj->event, &u, sizeof(u));
+        logging("mjpeg accept: %s:%d (id: %d, socket: %d, reactor: %d)", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port), client->id, sock, reactor->id);
     }
-    else
+}
+
+static void mjpeg_client_send_frame(struct mjpeg_socket *client, struct mjpeg_frame *frame)
+{
+    static char foot[] = "\r\n--" BOUNDARY "\r\n";
+
+    // 뒤쳐진 클라이언트는 중간 프레임을 건너뛰고 최신 프레임을 전송
+    if (client->sequence && frame->sequence > client->sequence + 1)
+    {
+        uint64_t dropped = frame->sequence - client->sequence - 1;
+
+        stats_add(&client->frames_dropped, dropped);
+        stats_add(&client->reactor->stats.frames_dropped, dropped);
+    }
+    client->sequence = frame->sequence;
+    client->frame = frame;
+    client->send_start = stats_now();
+    stats_histogram_add(&client->reactor->stats.publish_to_send, client->send_start - frame->published);
+
+    // 파트 헤더는 게시할 때 프레임마다 한번 만들어 둔 것을 공유
+    client->out[0].iov_base = frame->head;
+    client->out[0].iov_len = frame->head_length;
+    client->out[1].iov_base = frame->data;
+    client->out[1].iov_len = frame->length;
+    client->out[2].iov_base = foot;
+    client->out[2].iov_len = sizeof(foot) - 1;
+    client->out_index = 0;
+    client->out_count = 3;
+    client->out_calls = 0;
+    client->out_length = frame->head_length + frame->length + sizeof(foot) - 1;
+    // 작은 프레임이거나 완료 알림을 기다리는 프레임이 많으면 복사
+    // 커널 TLS 소켓은 MSG_ZEROCOPY를 지원하지 않음
+    client->zerocopy = client->reactor->server->zerocopy && client->tls == 0 && frame->length >= ZEROCOPY_MIN && client->zerocopy_count < ZEROCOPY_PENDING;
+    client->zerocopy_first = client->zerocopy_next;
+}
+
+// 프레임 간격 제한이 있으면 캡처 시각이 간격에 맞는 프레임만 전송
+/* send: 1 */
+static int mjpeg_client_due(struct mjpeg_socket *client, struct mjpeg_frame *frame)
+{
+    if (client->interval == 0)
     {
-        obj->buffer.length = 0;
+        return 1;
     }
+    uint64_t timestamp = frame->timestamp ? frame->timestamp : frame->published;
 
-    sem_post(&obj->semaphore);
+    // 원본 주기와 맞물려 간격보다 조금 이르게 도착한 프레임도 허용
+    if (timestamp + client->interval / 4 < client->due)
+    {
+        // 간격 제한으로 건너뛴 프레임은 드롭으로 세지 않음
+        client->sequence = frame->sequence;
+        return 0;
+    }
+    client->due += client->interval;
+    // 첫 프레임이거나 한동안 프레임이 없었으면 현재 프레임 기준으로 다시 맞춤
+    if (client->due <= timestamp)
+    {
+        client->due = timestamp + client->interval;
+    }
+    return 1;
 }
 
-static void mjpeg_client_process_header(struct mjpeg_socket *client)
+// 보내지 않은 데이터가 TCP_NOTSENT_LOWAT 아래일 때만 새 프레임을 넘겨 연결마다 대략 한 프레임만 커널에 쌓이도록 함
+// 넘기지 못한 프레임은 그 사이 더 최신 프레임이 게시되면 건너뜀
+/* writable: 1 */
+static int mjpeg_client_writable(struct mjpeg_socket *client)
 {
-    struct mjpeg_buffer *favicon = 0;
+    mjpeg_server_t *obj = client->reactor->server;
+    int unsent = 0;
 
-    char buffer[512];
-    uint64_t u = 1;
+    if (obj->notsent_lowat == 0 || ioctl(client->socket, SIOCOUTQNSD, &unsent) != 0 || (unsigned int)unsent < obj->notsent_lowat)
+    {
+        return 1;
+    }
+    // 마지막 sendmsg가 모두 받아들여졌으면 커널이 빈 공간을 알리지 않으므로
+    // epoll이 소켓 상태를 다시 확인하게 하여 기준 아래로 줄어들 때 EPOLLOUT을 받음
+    struct epoll_event ev =
+    {
+        .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+        .data.ptr = client,
+    };
 
-    if (client->socket == -1)
+    epoll_ctl(client->reactor->epoll, EPOLL_CTL_MOD, client->socket, &ev);
+    stats_add(&client->reactor->stats.send_deferred, 1);
+    return 0;
+}
+
+// 대역폭 적응 단계에서 프레임 수를 줄였으면 stride 장마다 한 장만 전송
+/* send: 1 */
+static int mjpeg_client_stride(struct mjpeg_socket *client, struct mjpeg_frame *frame)
+{
+    if (client->stride <= 1)
     {
-        return;
+        return 1;
+    }
+    if (++client->strided < client->stride)
+    {
+        // 건너뛴 프레임은 드롭으로 세지 않음
+        client->sequence = frame->sequence;
+        return 0;
     }
-    memset(buffer, 0, sizeof(buffer));
+    client->strided = 0;
+    return 1;
+}
+
+// 움직임 게이트: 마지막으로 보낸 프레임보다 충분히 변했거나 keepalive 간격이 지났으면 전송
+/* send: 1 */
+static int mjpeg_client_changed(struct mjpeg_socket *client, struct mjpeg_frame *frame)
+{
+    mjpeg_server_t *obj = client->reactor->server;
 
-    ssize_t recvlen = recv(client->socket, buffer, sizeof(buffer) - 1, 0);
-    if (recvlen <= 0)
+    // 분석에 실패했으면 게이트 없이 전송
+    if (client->threshold == 0 || atomic_load_explicit(&frame->motion_state, memory_order_acquire) != MJPEG_FRAME_MOTION_VALID)
     {
-        write(client->event_stop, &u, sizeof(u));
-        close(client->socket);
-        client->socket = -1;
-        return;
+        return 1;
     }
+    uint64_t timestamp = frame->timestamp ? frame->timestamp : frame->published;
+    int send = client->motion_valid == 0 || mjpeg_motion_score(frame->motion, client->motion) >= client->threshold;
 
-    // TODO
-    // 헤더를 클라이언트 버퍼에 \r\n\r\n 문자가 수신될 때 까지 append
-    // \r\n\r\n 문자가 없으면 리턴하여 다음 수신 대기
-    // \r\n\r\n 문자가 있으면 첫번째 라인을 확인하여 HTTP 요청인지 확인 후 클라이언트 state를 send_mjpeg로 변경
-    if (client->buffer.data)
+    if (send == 0 && obj->motion_keepalive && timestamp >= client->motion_sent + obj->motion_keepalive)
+    {
+        send = 1;
+    }
+    if (send == 0)
     {
-        size_t length = strlen(client->buffer.data);
+        // 게이트로 건너뛴 프레임은 드롭으로 세지 않음
+        client->sequence = frame->sequence;
+        stats_add(&client->reactor->stats.frames_suppressed, 1);
+        return 0;
+    }
+    // 천천히 변하는 장면도 기준 프레임과 비교하므로 누적된 변화가 임계값을 넘으면 전송
+    memcpy(client->motion, frame->motion, sizeof(client->motion));
+    client->motion_valid = 1;
+    client->motion_sent = timestamp;
+    return 1;
+}
+
+// 대역폭 적응 단계, 요청한 스트림의 축소 비율(최대 1/8)과 프레임 간격에 곱함
+// 먼저 프레임 수를 줄이고 그 다음 해상도를 줄임
+static const struct
+{
+    unsigned int scale;
+    unsigned int stride;
+} adaptive_tiers[] =
+{
+    { 1, 1 },
+    { 1, 2 },
+    { 2, 2 },
+    { 4, 2 },
+    { 4, 4 },
+    { 8, 4 },
+};
+
+#define ADAPTIVE_TIERS (int)(sizeof(adaptive_tiers) / sizeof(adaptive_tiers[0]))
+
+// 요청한 스트림을 모든 프레임 보낼 때를 4096으로 한 단계의 상대적인 전송량, 바이트 수는 대략 화소 수에 비례
+static uint64_t adaptive_cost(const struct mjpeg_socket *client, int tier)
+{
+    unsigned int base = client->request_variant.scale;
+    unsigned int scale = base * adaptive_tiers[tier].scale;
 
-        if (prepare_buffer(&client->buffer, length + recvlen + 1))
+    scale = scale < 8 ? scale : 8;
+    return 4096ull * base * base / (scale * scale * adaptive_tiers[tier].stride);
+}
+
+// 단계에 맞는 파생 스트림으로 구독을 옮김, 프레임 경계에서만 호출
+/* success: 0 */
+static int mjpeg_client_set_tier(struct mjpeg_socket *client, int tier)
+{
+    struct mjpeg_reactor *reactor = client->reactor;
+    mjpeg_server_t *obj = reactor->server;
+    struct mjpeg_variant variant;
+    int index = -1;
+
+    memcpy(&variant, &client->request_variant, sizeof(variant));
+
+    unsigned int scale = variant.scale * adaptive_tiers[tier].scale;
+
+    variant.scale = scale < 8 ? scale : 8;
+    if (variant.scale > 1 || variant.crop.width || variant.gray)
+    {
+        // 새 스트림을 먼저 구독하여 이전 스트림과 같으면 슬롯을 그대로 유지
+        index = mjpeg_transcoder_subscribe(obj->transcoder, &variant);
+        if (index < 0)
         {
-            write(client->event_stop, &u, sizeof(u));
-            return;
+            return 1;
         }
-        client->buffer.length += recvlen;
-
-        strncpy(client->buffer.data + length, buffer, recvlen);
     }
-    else
+    if (client->variant)
+    {
+        mjpeg_transcoder_unsubscribe(obj->transcoder, client->variant - 1);
+    }
+    if (client->variant != index + 1)
     {
-        if (prepare_buffer(&client->buffer, recvlen + 1))
+        client->variant = index + 1;
+        // 스트림마다 프레임 번호가 따로 매겨지므로 새 스트림의 최신 프레임부터 전송
+        client->sequence = 0;
+        if (client->variant)
         {
-            write(client->event_stop, &u, sizeof(u));
-            return;
+            mjpeg_frame_unref(reactor->variants[index]);
+            reactor->variants[index] = mjpeg_transcoder_get_frame(obj->transcoder, index);
         }
-        client->buffer.length = recvlen + 1;
-
-        strncpy(client->buffer.data, buffer, recvlen);
     }
-    if (strstr(client->buffer.data, "\r\n") == 0)
+    client->tier = tier;
+    client->stride = adaptive_tiers[tier].stride;
+    client->strided = 0;
+    atomic_store_explicit(&client->tier_gauge, tier, memory_order_relaxed);
+    return 0;
+}
+
+// 프레임 전송을 마칠 때마다 호출, ADAPTIVE_PROBE 간격으로 송신 큐를 보고 단계 조정
+// duration: 방금 보낸 프레임을 커널에 모두 넘기는 데 걸린 시간
+static void mjpeg_client_adapt(struct mjpeg_socket *client, uint64_t now, uint64_t duration)
+{
+    if (client->adaptive == 0 || now < client->probe_time + ADAPTIVE_PROBE)
     {
         return;
     }
+    struct mjpeg_reactor *reactor = client->reactor;
+    struct tcp_info info;
+    socklen_t info_length = sizeof(info);
+    int queued = 0;
 
-    if (client->state == read_get)
+    memset(&info, 0, sizeof(info));
+    if (ioctl(client->socket, SIOCOUTQ, &queued) != 0)
     {
-        char method[12];
-        char path[256];
-        char version[5];
-
-        if (sscanf(client->buffer.data, "%10s %250s HTTP/%4s\r\n", method, path, version) != 3)
-        {
-            return;
-        }
+        queued = 0;
+    }
+    // 실패하거나 오래된 커널이면 tcpi_delivery_rate는 0
+    getsockopt(client->socket, IPPROTO_TCP, TCP_INFO, &info, &info_length);
 
-        client->code = strcmp(path, "/") == 0 || strcmp(path, "/video.mjpeg") == 0 || strcmp(path, "/favicon.ico") == 0 ? 200 : 404;
-        client->version = strncmp(version, "1.1", 3) == 0 ? http_v1_1 : http_v1_0;
-        client->state = read_head;
+    // 커널에 넘긴 바이트 중 큐에 남지 않은 만큼이 상대에게 전달된 양
+    uint64_t sent = stats_get(&client->bytes_sent);
+    uint64_t delivered = sent > (uint64_t)queued ? sent - queued : 0;
+    uint64_t frames = stats_get(&client->frames_sent);
+    uint64_t dropped = stats_get(&client->frames_dropped);
+    uint64_t rate = 0;
 
-        strncpy(client->path, path, sizeof(client->path));
-        logging("mjpeg pending: %d, request: %s %s HTTP/%s", client->socket, method, path, version);
-    }
-    if (client->state == read_get)
+    if (delivered > client->probe_delivered)
     {
-        logging("mjpeg unknown: %d, data: %d", client->socket, client->buffer);
-        return;
+        rate = (delivered - client->probe_delivered) * 1000000000ull / (now - client->probe_time);
     }
-    // 헤더의 마지막이 수신되었는지 유무를 확인
-    if (strstr(client->buffer.data, "\r\n\r\n") == 0)
+    // 방금 보낸 프레임보다 많이 쌓여 있으면 밀린 상태
+    int backlog = (unsigned int)queued > client->out_length;
+
+    // 측정 구간 앞뒤로 밀려 있었으면 측정값이 실제 처리량
+    // 아니면 보낼 데이터가 부족해 실제보다 낮으므로 커널 추정값과 큰 값을 사용
+    // (창이 닫혀 ACK가 오지 않는 동안 커널 추정값은 갱신되지 않음)
+    if ((client->probe_backlog == 0 || backlog == 0) && info.tcpi_delivery_rate > rate)
     {
-        return;
+        rate = info.tcpi_delivery_rate;
     }
+    // 큐를 모두 비우는 데 걸릴 시간, 전달된 데이터 없이 큐만 남아 있으면 막힌 것으로 봄
+    uint64_t delay = rate ? (uint64_t)queued * 1000000000ull / rate : (queued ? ADAPTIVE_DOWN_DELAY + 1 : 0);
+    // 큐가 줄어드는 중이면 내린 단계를 감당하고 있으므로 이전 단계에서 쌓인 데이터가 빠질 때 까지 대기
+    int draining = queued < client->probe_queued;
+    // 큐 지연, 프레임 하나를 넘기는 데 걸린 시간, 전송한 프레임보다 따라잡지 못해 건너뛴 프레임이 많은지
+    int congested = draining == 0 && (delay > ADAPTIVE_DOWN_DELAY || duration > ADAPTIVE_DOWN_DELAY || dropped - client->probe_dropped > frames - client->probe_frames);
+    // 현재 보내는 속도
+    uint64_t throughput = (sent - client->probe_sent) * 1000000000ull / (now - client->probe_time);
+    int tier = client->tier;
+
+    client->probe_time = now;
+    client->probe_queued = queued;
+    client->probe_backlog = backlog;
+    client->probe_sent = sent;
+    client->probe_delivered = delivered;
+    client->probe_frames = frames;
+    client->probe_dropped = dropped;
 
-    char response_200[256];
-    if (strcmp(client->path, "/favicon.ico"))
+    if (congested)
     {
-        snprintf(
-            response_200,
-            sizeof(response_200),
-            "HTTP/%s 200 OK\r\n"
-            "Content-Type: multipart/x-mixed-replace; boundary=" BOUNDARY "\r\n"
-            "\r\n"
-            "--" BOUNDARY "\r\n",
-            client->version == http_v1_0 ? "1.0" : "1.1"
-        );
+        client->clear_since = 0;
+        if (tier + 1 < ADAPTIVE_TIERS && now >= client->tier_changed + ADAPTIVE_DOWN_HOLD)
+        {
+            tier++;
+            // 올린 단계를 감당하지 못했으면 다음에 올리기까지 더 오래 대기
+            if (client->tier_raised && now < client->tier_changed + client->up_hold)
+            {
+                client->up_hold = client->up_hold * 2 < ADAPTIVE_UP_HOLD_MAX ? client->up_hold * 2 : ADAPTIVE_UP_HOLD_MAX;
+            }
+        }
     }
-    else
+    else if (backlog == 0 || delay <= ADAPTIVE_UP_DELAY)
     {
-        favicon = read_favicon();
-
-        if (favicon)
+        if (client->clear_since == 0)
         {
-            snprintf(
-                response_200,
-                sizeof(response_200),
-                "HTTP/%s 200 OK\r\n"
-                "Content-Type: image/x-icon\r\n"
-                "Content-Length: %d\r\n"
-                "\r\n",
-                client->version == http_v1_0 ? "1.0" : "1.1",
-                favicon->length
-            );
+            client->clear_since = now;
         }
-        else
+        // 추정 처리량이 한 단계 위의 예상 전송량을 감당할 수 있을 때만 올림
+        if (tier > 0 && now >= client->clear_since + client->up_hold && now >= client->tier_changed + client->up_hold &&
+            rate * adaptive_cost(client, tier) >= throughput * adaptive_cost(client, tier - 1))
         {
-            client->code = 404;
+            tier--;
         }
     }
-
-    char *response_404 = (client->version == http_v1_0)
-        ?
-        "HTTP/1.0 404 Not Found\r\n"
-        "Content-Type: text/plain\r\n"
-        "Content-Length: 0\r\n"
-        "\r\n"
-        :
-        "HTTP/1.1 404 Not Found\r\n"
-        "Content-Type: text/plain\r\n"
-        "Content-Length: 0\r\n"
-        "\r\n"
-        ;
-
-    char *response = client->code == 200 ? response_200 : response_404;
-    ssize_t length = strlen(response);
-
-    logging("mjpeg pending: %d, response: %d", client->socket, client->code);
-
-    if (socket_write(client->socket, response, &length))
+    else
     {
-        write(client->event_stop, &u, sizeof(u));
-        close(client->socket);
-        client->socket = -1;
+        client->clear_since = 0;
     }
-    else if (favicon)
+    if (tier == client->tier)
     {
-        ssize_t length = favicon->length;
-        socket_write(client->socket, favicon->data, &length);
-        close(client->socket);
-        client->socket = -1;
-
-        free(favicon->data);
-        free(favicon);
+        return;
     }
-    else
+
+    int previous = client->tier;
+
+    client->tier_changed = now;
+    if (mjpeg_client_set_tier(client, tier))
     {
-        client->state = send_mjpeg;
+        // 슬롯이 없으면 현재 단계 유지, tier_changed 만큼 다시 시도하지 않음
+        return;
     }
+    client->tier_raised = tier < previous;
+    client->clear_since = 0;
+    stats_add(tier > previous ? &reactor->stats.tier_down : &reactor->stats.tier_up, 1);
+
+    logging("mjpeg adaptive (id: %d, tier: %d -> %d, queue: %d, rate: %llu, delay: %llu ms)",
+        client->id,
+        previous,
+        tier,
+        queued,
+        (unsigned long long)rate,
+        (unsigned long long)(delay / 1000000)
+    );
 }
 
-// 브라우저에서 서버로 데이터를 보낼 때 호출
-// 브라우저는 처음 HTTP REQUEST 이후 서버로 데이터를 전송하지 않으므로
-// 일반적으로 클라이언트의 연결이 끊겼을 경우 호출 됨
-static void mjpeg_client_process_content(struct mjpeg_socket *client)
+// CLOCK_MONOTONIC 시각을 유닉스 시각(초)으로
+static double wall_time(uint64_t timestamp)
 {
-    char buffer[512];
-    uint64_t u = 1;
+    struct timespec ts;
 
-    if (client == 0 || client->socket == -1)
-    {
-        return;
-    }
+    clock_gettime(CLOCK_REALTIME, &ts);
 
-    memset(buffer, 0, sizeof(buffer));
+    double now = ts.tv_sec + ts.tv_nsec * 1e-9;
 
-    ssize_t len = recv(client->socket, buffer, sizeof(buffer) - 1, 0);
-    if (len <= 0)
-    {
-        logging("mjpeg client closed (ret: %d)", len);
-        write(client->event_stop, &u, sizeof(u));
-        close(client->socket);
-        client->socket = -1;
-    }
-    else
-    {
-        logging("mjpeg client message (ignore): %s", buffer);
-    }
+    return now - (double)(stats_now() - timestamp) * 1e-9;
 }
 
-static void mjpeg_client_send_data(struct mjpeg_socket *client)
+// 쌓인 이벤트를 한번에 보냄
+/* failed: -1, 보낼 이벤트가 없으면 0 */
+static int mjpeg_client_prepare_events(struct mjpeg_socket *client)
 {
-    char head[128];
-    char foot[] = "\r\n--" BOUNDARY "\r\n";
-    ssize_t length;
-    ssize_t send_len = 0;
-    uint64_t u = 1;
+    mjpeg_server_t *obj = client->reactor->server;
+    struct mjpeg_event event;
+    int count = 0;
 
-    length = sprintf(head,
-        "Content-Type: image/jpeg\r\n"
-        "Content-Length: %d\r\n"
-        "\r\n",
-        client->buffer.length
-    );
-    assert(sizeof(head) > length);
-    //printf("%s\n", head);
-    if (socket_write(client->socket, head, &length) != 0)
-    {
-        logging("mjpeg failed header");
-        write(client->event_stop, &u, sizeof(u));
-        close(client->socket);
-        client->socket = -1;
-        return;
+    client->buffer.length = 0;
+    while (count < MJPEG_EVENTS_HISTORY && mjpeg_events_get(obj->events, client->event_id, &event) == 0)
+    {
+        const struct mjpeg_zone *zone = mjpeg_events_get_zone(obj->events, event.zone);
+
+        if (buffer_printf(&client->buffer,
+            "id: %llu\n"
+            "event: %s\n"
+            "data: {\"zone\":\"%s\",\"sequence\":%llu,\"time\":%.3f,\"blocks\":%u}\n"
+            "\n",
+            (unsigned long long)event.id,
+            event.active ? "start" : "stop",
+            zone->name,
+            (unsigned long long)event.sequence,
+            wall_time(event.timestamp),
+            event.blocks))
+        {
+            return -1;
+        }
+        client->event_id = event.id;
+        count++;
     }
-    send_len += length;
-
-    length = client->buffer.length;
-    //printf("... send body\n");
-    if (socket_write(client->socket, client->buffer.data, &length) != 0)
+    if (count)
     {
-        //printf("... socket closed\n");
-        logging("mjpeg failed body");
-        write(client->event_stop, &u, sizeof(u));
-        close(client->socket);
-        client->socket = -1;
-        return;
+        client->out[0].iov_base = client->buffer.data;
+        client->out[0].iov_len = client->buffer.length;
+        client->out_index = 0;
+        client->out_count = 1;
+        client->out_calls = 0;
     }
-    //printf("... send length: %d\n", length);
-    send_len += length;
+    return count;
+}
+
+/* success: 0 */
+static int mjpeg_client_write(struct mjpeg_socket *client)
+{
+    struct mjpeg_reactor *reactor = client->reactor;
 
-    length = strlen(foot);
-    //printf("%s\n", foot);
-    if (socket_write(client->socket, foot, &length) != 0)
+    while (1)
     {
-        logging("mjpeg failed footer");
-        close(client->socket);
-        client->socket = -1;
-        return;
-    }
-    send_len += length;
+        if (client->out_index < client->out_count)
+        {
+            int calls = 0;
+            int zerocopy_calls = 0;
+            int ret;
 
-    //logging("post socket %d, written %d bytes", client->socket, send_len);
-}
+            // 평문이나 커널 TLS는 그대로 sendmsg
+            if (client->tls && client->ktls == 0)
+            {
+                ret = tls_flush(client->tls, client->out, &client->out_index, client->out_count, &calls);
+            }
+            else
+            {
+                ret = socket_flush(client->socket, client->out, &client->out_index, client->out_count, &calls, client->zerocopy, &zerocopy_calls);
+            }
 
-static void *mjpeg_client_thread(void *arg)
-{
-    struct pollfd fds[3];
-    struct mjpeg_socket *client = arg;
+            client->out_calls += calls;
+            client->zerocopy_next += zerocopy_calls;
+            stats_add(&reactor->stats.send_calls, calls);
+            stats_add(&reactor->stats.zerocopy_sends, zerocopy_calls);
 
-    int ret;
-    uint64_t u = 1;
+            unsigned int pending = 0;
 
-    logging("start client thread(event_stop: %d, event_data: %d, socket: %d)", client->event_stop, client->event_data, client->socket);
+            for (int i = client->out_index; i < client->out_count; i++)
+            {
+                pending += client->out[i].iov_len;
+            }
+            atomic_store_explicit(&client->pending, pending, memory_order_relaxed);
 
-    while (1)
-    {
-        fds[0].fd = client->event_stop;
-        fds[0].events = POLLIN;
-        fds[0].revents = 0;
+            if (ret < 0)
+            {
+                logging("mjpeg failed send (id: %d)", client->id);
+                return 1;
+            }
+            if (ret > 0)
+            {
+                // EPOLLOUT에서 이어서 전송
+                return 0;
+            }
 
-        fds[1].fd = client->event_data;
-        fds[1].events = POLLIN;
-        fds[1].revents = 0;
+            if (client->out_count > client->out_calls)
+            {
+                stats_add(&reactor->stats.send_calls_saved, client->out_count - client->out_calls);
+            }
+            uint64_t now = stats_now();
 
-        fds[2].fd = client->socket;
-        fds[2].events = POLLIN;
-        fds[2].revents = 0;
+            client->out_index = 0;
+            client->out_count = 0;
+            client->out_calls = 0;
+            atomic_store_explicit(&client->active, now, memory_order_relaxed);
 
-        ret = poll(fds, sizeof(fds) / sizeof(fds[0]), -1);
-        if (ret == -1)
-        {
-            write(client->event_stop, &u, sizeof(u));
+            if (client->frame)
+            {
+                stats_histogram_add(&reactor->stats.send_duration, now - client->send_start);
+                if (client->state == send_mjpeg && stats_get(&client->frames_sent) == 0)
+                {
+                    stats_histogram_add(&reactor->stats.first_frame, now - client->requested);
+                }
+                stats_add(&client->frames_sent, 1);
+                stats_add(&client->bytes_sent, client->out_length);
+                stats_add(&reactor->stats.frames_sent, 1);
+                stats_add(&reactor->stats.bytes_sent, client->out_length);
 
-            break;
+                mjpeg_client_release_frame(client);
+
+                if (client->state == send_mjpeg)
+                {
+                    mjpeg_client_adapt(client, now, now - client->send_start);
+                }
+            }
         }
-        if (fds[0].revents)
+        if (client->state == send_response)
         {
-            break;
+            return 1;
         }
-        if (fds[1].revents)
+        if (client->state == send_events)
         {
-            read(fds[1].fd, &u, sizeof(u));
+            int count = mjpeg_client_prepare_events(client);
 
-            if (client->state != send_mjpeg)
+            if (count <= 0)
             {
-                continue;
+                // 다음 이벤트가 생기면 mjpeg_reactor_post에서 이어서 전송
+                return count < 0;
             }
-
-            sem_wait(&client->semaphore);
-            mjpeg_client_send_data(client);
-            sem_post(&client->semaphore);
+            continue;
         }
-        if (fds[2].revents)
+        if (client->state != send_mjpeg)
         {
-            enum socket_state state = client->state;
-            if (state == read_get || state == read_head)
-            {
-                mjpeg_client_process_header(client);
-            }
-            else
+            return 0;
+        }
+        // 전송을 마친 시점에 더 최신 프레임이 있으면 이어서 전송, 없으면 다음 게시를 기다림
+        struct mjpeg_frame *frame = mjpeg_client_stream_frame(client);
+
+        if (frame == 0 || frame->sequence <= client->sequence)
+        {
+            return 0;
+        }
+        if (mjpeg_client_writable(client) == 0)
+        {
+            return 0;
+        }
+        if (mjpeg_client_due(client, frame) == 0 || mjpeg_client_stride(client, frame) == 0 || mjpeg_client_changed(client, frame) == 0)
+        {
+            return 0;
+        }
+        mjpeg_client_send_frame(client, mjpeg_frame_ref(frame));
+    }
+}
+
+// query: "a=1&b=2", 값의 시작 위치 ('&' 또는 문자열 끝까지)
+/* not found: 0 */
+static const char *query_find(const char *query, const char *name)
+{
+    size_t length = strlen(name);
+
+    while (query && *query)
+    {
+        if (strncmp(query, name, length) == 0 && query[length] == '=')
+        {
+            return query + length + 1;
+        }
+        query = strchr(query, '&');
+        if (query)
+        {
+            query++;
+        }
+    }
+    return 0;
+}
+
+/* found: 0 */
+static int query_get_u64(const char *query, const char *name, uint64_t *value)
+{
+    const char *found = query_find(query, name);
+
+    if (found == 0)
+    {
+        return 1;
+    }
+    *value = strtoull(found, 0, 10);
+    return 0;
+}
+
+// scale=1/2, 1%2F2 또는 2
+/* invalid: 0 */
+static unsigned int query_get_scale(const char *query)
+{
+    const char *value = query_find(query, "scale");
+
+    if (value == 0)
+    {
+        return 1;
+    }
+    if (strncmp(value, "1/", 2) == 0)
+    {
+        value += 2;
+    }
+    else if (strncasecmp(value, "1%2F", 4) == 0)
+    {
+        value += 4;
+    }
+
+    char *end;
+    unsigned long scale = strtoul(value, &end, 10);
+
+    if ((*end != 0 && *end != '&') || (scale != 1 && scale != 2 && scale != 4 && scale != 8))
+    {
+        return 0;
+    }
+    return scale;
+}
+
+// crop=x,y,w,h (픽셀)
+/* success: 0 */
+static int query_get_crop(const char *query, struct mjpeg_variant *variant)
+{
+    const char *value = query_find(query, "crop");
+    unsigned int x, y, width, height;
+    int end = 0;
+
+    if (value == 0)
+    {
+        return 0;
+    }
+    if (sscanf(value, "%u,%u,%u,%u%n", &x, &y, &width, &height, &end) != 4 || (value[end] != 0 && value[end] != '&') || width == 0 || height == 0)
+    {
+        return 1;
+    }
+    variant->crop.x = x;
+    variant->crop.y = y;
+    variant->crop.width = width;
+    variant->crop.height = height;
+    return 0;
+}
+
+// 잘라낼 영역이 최신 프레임 밖이면 1, 아직 프레임이 없으면 크기를 알 수 없으므로 0
+// 시작 위치는 MCU 경계로 내리기만 하므로 영역 안에 있으면 정렬 후에도 겹침
+static int mjpeg_server_crop_empty(mjpeg_server_t *obj, const struct mjpeg_variant *variant)
+{
+    struct mjpeg_frame *frame;
+    unsigned int width;
+    unsigned int height;
+    int empty = 0;
+
+    if (variant->crop.width == 0)
+    {
+        return 0;
+    }
+    frame = mjpeg_server_get_frame(obj);
+    if (frame && jpeg_decoder_peek_size(frame->data, frame->length, &width, &height) == 0)
+    {
+        empty = variant->crop.x >= width || variant->crop.y >= height;
+    }
+    mjpeg_frame_unref(frame);
+    return empty;
+}
+
+// If-None-Match: "<sequence>", *이면 모든 프레임과 일치 (sequence 0)
+/* found: 0 */
+static int header_get_u64(const char *request, const char *name, uint64_t *value)
+{
+    char key[64];
+
+    snprintf(key, sizeof(key), "\n%s:", name);
+
+    const char *found = strcasestr(request, key);
+
+    if (found == 0)
+    {
+        return 1;
+    }
+    found += strlen(key);
+    while (*found == ' ' || *found == '\t')
+    {
+        found++;
+    }
+    if (*found < '0' || *found > '9')
+    {
+        return 1;
+    }
+    *value = strtoull(found, 0, 10);
+    return 0;
+}
+
+/* found: 0 */
+static int header_get_etag(const char *request, uint64_t *sequence)
+{
+    const char *value = strcasestr(request, "\nIf-None-Match:");
+
+    if (value == 0)
+    {
+        return 1;
+    }
+    value += 15;
+    while (*value == ' ' || *value == '\t')
+    {
+        value++;
+    }
+    if (*value == '*')
+    {
+        *sequence = 0;
+        return 0;
+    }
+    if (strncmp(value, "W/", 2) == 0)
+    {
+        value += 2;
+    }
+    if (*value != '"')
+    {
+        return 1;
+    }
+    *sequence = strtoull(value + 1, 0, 10);
+    return 0;
+}
+
+// 프레임 데이터는 복사하지 않고 참조를 잡은 채 iovec으로 전송
+static void mjpeg_client_prepare_snapshot(struct mjpeg_socket *client, struct mjpeg_frame *frame)
+{
+    client->buffer.length = snprintf(
+        client->buffer.data,
+        client->buffer.available,
+        "HTTP/%s 200 OK\r\n"
+        "Content-Type: image/jpeg\r\n"
+        "Content-Length: %u\r\n"
+        "Cache-Control: no-cache\r\n"
+        "ETag: \"%llu\"\r\n"
+        "\r\n",
+        client->version == http_v1_0 ? "1.0" : "1.1",
+        frame->length,
+        (unsigned long long)frame->sequence
+    );
+    client->code = 200;
+    client->frame = frame;
+    client->sequence = frame->sequence;
+    client->send_start = stats_now();
+    client->out[1].iov_base = frame->data;
+    client->out[1].iov_len = frame->length;
+    client->out_length = frame->length;
+    client->state = send_response;
+    client->out_count = 2;
+}
+
+static void mjpeg_client_prepare_not_modified(struct mjpeg_socket *client, uint64_t sequence)
+{
+    client->code = 304;
+    client->buffer.length = snprintf(
+        client->buffer.data,
+        client->buffer.available,
+        "HTTP/%s 304 Not Modified\r\n"
+        "Cache-Control: no-cache\r\n"
+        "ETag: \"%llu\"\r\n"
+        "\r\n",
+        client->version == http_v1_0 ? "1.0" : "1.1",
+        (unsigned long long)sequence
+    );
+    client->state = send_response;
+    client->out_count = 1;
+}
+
+static void mjpeg_client_begin_response(struct mjpeg_socket *client)
+{
+    client->out[0].iov_base = client->buffer.data;
+    client->out[0].iov_len = client->buffer.length;
+    client->out_index = 0;
+    client->out_calls = 0;
+
+    logging("mjpeg pending: %d, response: %d", client->socket, client->code);
+
+    if (mjpeg_client_write(client))
+    {
+        mjpeg_client_close(client);
+    }
+}
+
+// wait_frame 상태의 클라이언트에 응답, frame이 0이면 만료된 클라이언트에 304
+static void mjpeg_reactor_answer_waiting(struct mjpeg_reactor *reactor, struct mjpeg_frame *frame)
+{
+    uint64_t now = frame ? 0 : stats_now();
+    struct mjpeg_socket *next;
+
+    for (struct mjpeg_socket *client = reactor->clients; client && reactor->waiting; client = next)
+    {
+        next = client->reactor_next;
+
+        if (client->state != wait_frame)
+        {
+            continue;
+        }
+        if (frame && frame->sequence > client->sequence)
+        {
+            reactor->waiting--;
+            mjpeg_client_prepare_snapshot(client, mjpeg_frame_ref(frame));
+            mjpeg_client_begin_response(client);
+        }
+        else if (frame == 0 && now >= client->deadline)
+        {
+            reactor->waiting--;
+            mjpeg_client_prepare_not_modified(client, client->sequence);
+            mjpeg_client_begin_response(client);
+        }
+    }
+}
+
+static void mjpeg_reactor_post(struct mjpeg_reactor *reactor)
+{
+    struct mjpeg_frame *frame = mjpeg_server_get_frame(reactor->server);
+
+    mjpeg_frame_unref(reactor->frame);
+    reactor->frame = frame;
+
+    // 변환 스레드가 게시할 때도 깨어나므로 파생 스트림도 함께 갱신, 구독자가 없는 스트림은 비워짐
+    for (int i = 0; i < MJPEG_TRANSCODER_MAX_VARIANTS; i++)
+    {
+        mjpeg_frame_unref(reactor->variants[i]);
+        reactor->variants[i] = mjpeg_transcoder_get_frame(reactor->server->transcoder, i);
+    }
+    mjpeg_frame_unref(reactor->analysed);
+    reactor->analysed = mjpeg_transcoder_get_analysed(reactor->server->transcoder);
+
+    if (frame == 0)
+    {
+        return;
+    }
+    if (reactor->waiting)
+    {
+        mjpeg_reactor_answer_waiting(reactor, frame);
+    }
+    struct mjpeg_socket *next;
+
+    for (struct mjpeg_socket *client = reactor->clients; client; client = next)
+    {
+        next = client->reactor_next;
+
+        // 전송 중인 클라이언트는 전송을 마친 후 최신 프레임(이벤트)을 가져감
+        if ((client->state != send_mjpeg && client->state != send_events) || client->out_count != 0)
+        {
+            continue;
+        }
+        if (mjpeg_client_write(client))
+        {
+            mjpeg_client_close(client);
+        }
+    }
+}
+
+static int metrics_value(struct mjpeg_buffer *buffer, const char *name, const char *type, const char *help, uint64_t value)
+{
+    return buffer_printf(buffer, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name, (unsigned long long)value);
+}
+
+// scale: 버킷 상한 단위 변환, sum_scale: 합계 단위 변환
+static int metrics_histogram(struct mjpeg_buffer *buffer, const char *name, const char *help, const struct mjpeg_histogram *histogram, double scale, double sum_scale)
+{
+    uint64_t count = 0;
+    int failed = buffer_printf(buffer, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+
+    for (int i = 0; i < MJPEG_HISTOGRAM_BUCKETS && failed == 0; i++)
+    {
+        count += histogram->bucket[i];
+        failed = buffer_printf(buffer, "%s_bucket{le=\"%g\"} %llu\n", name, (double)(1ull << i) * scale, (unsigned long long)count);
+    }
+    if (failed == 0)
+    {
+        // 버킷과 count는 따로 읽으므로 누적 버킷 값으로 맞춤
+        failed = buffer_printf(buffer, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %g\n%s_count %llu\n",
+            name, (unsigned long long)count,
+            name, histogram->sum * sum_scale,
+            name, (unsigned long long)count);
+    }
+    return failed;
+}
+
+// Prometheus text format, 카운터는 스레드별 relaxed atomic 값을 읽기만 함
+/* success: 0 */
+static int mjpeg_server_render_metrics(mjpeg_server_t *obj, struct mjpeg_buffer *buffer)
+{
+    struct mjpeg_server_stats stats;
+    int failed = 0;
+
+    mjpeg_server_get_stats(obj, &stats);
+
+    failed |= metrics_value(buffer, "mjpeg_frames_captured_total", "counter", "Frames received from the frame source.", stats.frames_posted + stats.frames_discarded);
+    failed |= metrics_value(buffer, "mjpeg_frames_published_total", "counter", "Frames published to clients.", stats.frames_posted);
+    failed |= metrics_value(buffer, "mjpeg_frames_discarded_total", "counter", "Frames discarded because no frame slot was free.", stats.frames_discarded);
+    failed |= metrics_value(buffer, "mjpeg_frames_lost_total", "counter", "Gaps in the frame source sequence.", stats.frames_lost);
+    failed |= metrics_value(buffer, "mjpeg_frames_sent_total", "counter", "Frames fully sent to clients.", stats.frames_sent);
+    failed |= metrics_value(buffer, "mjpeg_frames_dropped_total", "counter", "Frames skipped for clients that fell behind.", stats.frames_dropped);
+    failed |= metrics_value(buffer, "mjpeg_frames_suppressed_total", "counter", "Frames not sent because the scene did not change enough (?motion).", stats.frames_suppressed);
+    failed |= metrics_value(buffer, "mjpeg_tls_handshakes_total", "counter", "Completed TLS handshakes.", stats.tls_handshakes);
+    failed |= metrics_value(buffer, "mjpeg_tls_handshake_failures_total", "counter", "Failed TLS handshakes.", stats.tls_failed);
+    failed |= metrics_value(buffer, "mjpeg_tls_ktls_sessions_total", "counter", "TLS sessions whose transmit side was handed to kernel TLS.", stats.tls_ktls);
+    failed |= metrics_value(buffer, "mjpeg_zerocopy_sends_total", "counter", "sendmsg calls made with MSG_ZEROCOPY.", stats.zerocopy_sends);
+    failed |= metrics_value(buffer, "mjpeg_zerocopy_copied_total", "counter", "MSG_ZEROCOPY sends the kernel completed by copying.", stats.zerocopy_copied);
+    failed |= metrics_value(buffer, "mjpeg_send_deferred_total", "counter", "New frames held back because a connection had more unsent bytes than TCP_NOTSENT_LOWAT.", stats.send_deferred);
+    failed |= metrics_value(buffer, "mjpeg_adaptive_steps_down_total", "counter", "Adaptive streams moved to a lower tier because the send queue built up.", stats.tier_down);
+    failed |= metrics_value(buffer, "mjpeg_adaptive_steps_up_total", "counter", "Adaptive streams moved back to a higher tier.", stats.tier_up);
+    failed |= metrics_value(buffer, "mjpeg_bytes_sent_total", "counter", "Bytes of multipart parts sent.", stats.bytes_sent);
+    failed |= metrics_value(buffer, "mjpeg_send_calls_total", "counter", "sendmsg calls.", stats.send_calls);
+    failed |= metrics_value(buffer, "mjpeg_clients", "gauge", "Connected clients.", stats.clients);
+    failed |= metrics_value(buffer, "mjpeg_frames_transcoded_total", "counter", "Source frames transcoded to scaled streams.", stats.frames_transcoded);
+    failed |= metrics_value(buffer, "mjpeg_transcode_failures_total", "counter", "Source frames that could not be transcoded.", stats.transcode_failed);
+    failed |= metrics_value(buffer, "mjpeg_transcode_frames_discarded_total", "counter", "Scaled stream frames discarded because no transcoder frame slot was free.", stats.transcode_discarded);
+    failed |= metrics_value(buffer, "mjpeg_motion_frames_analysed_total", "counter", "Frames analysed for /events.", stats.frames_analysed);
+    failed |= metrics_value(buffer, "mjpeg_motion_analyse_failures_total", "counter", "Frames that could not be analysed for /events.", stats.analyse_failed);
+    failed |= metrics_value(buffer, "mjpeg_motion_events_total", "counter", "Motion start/stop events.", stats.motion_events);
+
+    failed |= buffer_printf(buffer, "# HELP mjpeg_motion_zone_active Motion in progress in a zone (only while /events has listeners).\n# TYPE mjpeg_motion_zone_active gauge\n");
+    for (int i = 0; i < mjpeg_events_get_zone_count(obj->events) && failed == 0; i++)
+    {
+        failed |= buffer_printf(buffer, "mjpeg_motion_zone_active{zone=\"%s\"} %d\n", mjpeg_events_get_zone(obj->events, i)->name, mjpeg_events_get_zone_active(obj->events, i));
+    }
+
+    failed |= metrics_histogram(buffer, "mjpeg_frame_size_bytes", "Published frame size.", &stats.frame_size, 1, 1);
+    failed |= metrics_histogram(buffer, "mjpeg_capture_to_publish_seconds", "Time from capture to publish.", &stats.capture_to_publish, 1e-6, 1e-9);
+    failed |= metrics_histogram(buffer, "mjpeg_encode_duration_seconds", "Time to encode a raw capture to JPEG.", &stats.encode_duration, 1e-6, 1e-9);
+    failed |= metrics_histogram(buffer, "mjpeg_transcode_duration_seconds", "Time to transcode a source frame to all subscribed scaled streams.", &stats.transcode_duration, 1e-6, 1e-9);
+    failed |= metrics_histogram(buffer, "mjpeg_motion_analyse_duration_seconds", "Time to analyse a frame for motion events.", &stats.analyse_duration, 1e-6, 1e-9);
+    failed |= metrics_histogram(buffer, "mjpeg_publish_to_send_seconds", "Time from publish to the start of a client send.", &stats.publish_to_send, 1e-6, 1e-9);
+    failed |= metrics_histogram(buffer, "mjpeg_send_duration_seconds", "Time to send one part to a client.", &stats.send_duration, 1e-6, 1e-9);
+    failed |= metrics_histogram(buffer, "mjpeg_tls_handshake_seconds", "Time from accept to a completed TLS handshake.", &stats.tls_handshake, 1e-6, 1e-9);
+    failed |= metrics_histogram(buffer, "mjpeg_first_frame_seconds", "Time from a stream request to its first frame being sent.", &stats.first_frame, 1e-6, 1e-9);
+
+    // 같은 이름의 값은 한 묶음으로 출력해야 하므로 항목마다 목록을 순회
+    static const char *client_metrics[4][3] =
+    {
+        { "mjpeg_client_send_queue_bytes", "gauge", "Bytes queued for a client, in the server and in the socket send buffer." },
+        { "mjpeg_client_frames_sent_total", "counter", "Frames sent to a client." },
+        { "mjpeg_client_frames_dropped_total", "counter", "Frames skipped for a client." },
+        { "mjpeg_client_adaptive_tier", "gauge", "Bandwidth tier of an adaptive stream, 0: as requested." },
+    };
+
+    sem_wait(&obj->clients_semaphore);
+    for (int i = 0; i < 4 && failed == 0; i++)
+    {
+        const char *name = client_metrics[i][0];
+
+        failed |= buffer_printf(buffer, "# HELP %s %s\n# TYPE %s %s\n", name, client_metrics[i][2], name, client_metrics[i][1]);
+
+        for (struct mjpeg_socket *client = obj->head; client && failed == 0; client = client->next)
+        {
+            uint64_t value;
+
+            if (i == 0)
+            {
+                int queued = 0;
+
+                if (ioctl(client->socket, SIOCOUTQ, &queued) != 0)
+                {
+                    queued = 0;
+                }
+                value = stats_get(&client->pending) + queued;
+            }
+            else if (i == 3)
+            {
+                value = stats_get(&client->tier_gauge);
+            }
+            else
+            {
+                value = stats_get(i == 1 ? &client->frames_sent : &client->frames_dropped);
+            }
+            failed |= buffer_printf(buffer, "%s{client=\"%d\",reactor=\"%d\"} %llu\n", name, client->id, client->reactor->id, (unsigned long long)value);
+        }
+    }
+    sem_post(&obj->clients_semaphore);
+
+    return failed;
+}
+
+static void mjpeg_client_process_header(struct mjpeg_socket *client)
+{
+    mjpeg_server_t *obj = client->reactor->server;
+
+    char method[12];
+    char path[256];
+    char version[5];
+    char *query = 0;
+
+    client->requested = stats_now();
+
+    if (sscanf(client->buffer.data, "%10s %250s HTTP/%4s\r\n", method, path, version) != 3)
+    {
+        logging("mjpeg unknown: %d, data: %s", client->socket, client->buffer.data);
+        client->code = 404;
+        strcpy(version, "1.0");
+        path[0] = 0;
+    }
+    else
+    {
+        logging("mjpeg pending: %d, request: %s %s HTTP/%s", client->socket, method, path, version);
+
+        query = strchr(path, '?');
+        if (query)
+        {
+            *query++ = 0;
+        }
+        client->code = strcmp(path, "/") == 0 || strcmp(path, "/video.mjpeg") == 0 || strcmp(path, "/metrics") == 0 || strcmp(path, "/snapshot.jpg") == 0 || strcmp(path, "/events") == 0 || (strcmp(path, "/favicon.ico") == 0 && obj->favicon) ? 200 : 404;
+    }
+    client->version = strncmp(version, "1.1", 3) == 0 ? http_v1_1 : http_v1_0;
+
+    strncpy(client->path, path, sizeof(client->path) - 1);
+    client->path[sizeof(client->path) - 1] = 0;
+
+    // 요청 헤더는 응답 헤더를 쓰기 전에 확인
+    uint64_t etag = 0;
+    uint64_t after = 0;
+    uint64_t fps = 0;
+    uint64_t threshold = 0;
+    int has_etag = client->code == 200 && header_get_etag(client->buffer.data, &etag) == 0;
+    int has_after = query_get_u64(query, "after", &after) == 0;
+    int has_fps = query_get_u64(query, "fps", &fps) == 0;
+    int has_motion = query_get_u64(query, "motion", &threshold) == 0;
+    uint64_t event_id = 0;
+    // EventSource는 재연결할 때 마지막으로 받은 이벤트 번호를 보냄
+    int has_event_id = header_get_u64(client->buffer.data, "Last-Event-ID", &event_id) == 0;
+    uint64_t adaptive = 0;
+    int has_adaptive = query_get_u64(query, "adaptive", &adaptive) == 0;
+    uint64_t gray = 0;
+    struct mjpeg_variant variant;
+
+    memset(&variant, 0, sizeof(variant));
+    variant.scale = query_get_scale(query);
+    query_get_u64(query, "gray", &gray);
+    variant.gray = gray != 0;
+    if (variant.scale == 0 || query_get_crop(query, &variant) || mjpeg_server_crop_empty(obj, &variant))
+    {
+        logging("mjpeg invalid scale or crop: %d", client->socket);
+        client->code = 404;
+    }
+
+    // 요청 버퍼를 응답 헤더 버퍼로 재사용
+    if (prepare_buffer(&client->buffer, 256))
+    {
+        mjpeg_client_close(client);
+        return;
+    }
+
+    if (client->code != 200)
+    {
+        client->buffer.length = snprintf(
+            client->buffer.data,
+            client->buffer.available,
+            "HTTP/%s 404 Not Found\r\n"
+            "Content-Type: text/plain\r\n"
+            "Content-Length: 0\r\n"
+            "\r\n",
+            client->version == http_v1_0 ? "1.0" : "1.1"
+        );
+        client->state = send_response;
+        client->out_count = 1;
+    }
+    else if (strcmp(client->path, "/snapshot.jpg") == 0)
+    {
+        struct mjpeg_frame *frame = mjpeg_server_get_frame(obj);
+
+        if (frame && has_after == 0 && has_etag && (etag == 0 || etag == frame->sequence))
+        {
+            mjpeg_client_prepare_not_modified(client, frame->sequence);
+            mjpeg_frame_unref(frame);
+        }
+        else if (frame && frame->sequence > after)
+        {
+            mjpeg_client_prepare_snapshot(client, frame);
+        }
+        else
+        {
+            // 새 프레임이 게시되면 mjpeg_reactor_post에서 응답
+            mjpeg_frame_unref(frame);
+            client->state = wait_frame;
+            client->sequence = after;
+            client->deadline = stats_now() + SNAPSHOT_TIMEOUT;
+            client->reactor->waiting++;
+            return;
+        }
+    }
+    else if (strcmp(client->path, "/metrics") == 0)
+    {
+        // 본문을 METRICS_HEAD 위치부터 만들고 헤더는 앞에 채움
+        client->buffer.length = METRICS_HEAD;
+        if (mjpeg_server_render_metrics(obj, &client->buffer))
+        {
+            mjpeg_client_close(client);
+            return;
+        }
+
+        unsigned int length = client->buffer.length - METRICS_HEAD;
+
+        client->buffer.length = snprintf(
+            client->buffer.data,
+            METRICS_HEAD,
+            "HTTP/%s 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %u\r\n"
+            "\r\n",
+            client->version == http_v1_0 ? "1.0" : "1.1",
+            length
+        );
+        client->out[1].iov_base = client->buffer.data + METRICS_HEAD;
+        client->out[1].iov_len = length;
+        client->state = send_response;
+        client->out_count = 2;
+    }
+    else if (strcmp(client->path, "/events") == 0)
+    {
+        client->buffer.length = snprintf(
+            client->buffer.data,
+            client->buffer.available,
+            "HTTP/%s 200 OK\r\n"
+            "Content-Type: text/event-stream\r\n"
+            "Cache-Control: no-cache\r\n"
+            "\r\n",
+            client->version == http_v1_0 ? "1.0" : "1.1"
+        );
+        // 재연결이 아니면 연결 이후의 이벤트만 전송
+        client->event_id = has_event_id ? event_id : mjpeg_events_get_last_id(obj->events);
+        client->state = send_events;
+        client->out_count = 1;
+        mjpeg_events_subscribe(obj->events);
+    }
+    else if (strcmp(client->path, "/favicon.ico") == 0)
+    {
+        client->buffer.length = snprintf(
+            client->buffer.data,
+            client->buffer.available,
+            "HTTP/%s 200 OK\r\n"
+            "Content-Type: image/x-icon\r\n"
+            "Content-Length: %d\r\n"
+            "\r\n",
+            client->version == http_v1_0 ? "1.0" : "1.1",
+            obj->favicon->length
+        );
+        client->out[1].iov_base = obj->favicon->data;
+        client->out[1].iov_len = obj->favicon->length;
+        client->state = send_response;
+        client->out_count = 2;
+    }
+    else
+    {
+        client->buffer.length = snprintf(
+            client->buffer.data,
+            client->buffer.available,
+            "HTTP/%s 200 OK\r\n"
+            "Content-Type: multipart/x-mixed-replace; boundary=" BOUNDARY "\r\n"
+            "\r\n"
+            "--" BOUNDARY "\r\n",
+            client->version == http_v1_0 ? "1.0" : "1.1"
+        );
+        client->state = send_mjpeg;
+        client->out_count = 1;
+        // ?fps=0 이면 서버 기본값과 관계없이 모든 프레임
+        client->interval = has_fps ? (fps ? 1000000000ull / fps : 0) : obj->interval;
+        client->due = 0;
+        // ?motion=0 이면 서버 기본값과 관계없이 게이트를 쓰지 않음
+        client->threshold = has_motion ? (threshold < 255 ? threshold : 255) : obj->motion_threshold;
+        client->motion_valid = 0;
+        if (client->threshold)
+        {
+            atomic_fetch_add(&obj->motion_clients, 1);
+        }
+
+        // ?adaptive=0 이면 서버 기본값과 관계없이 요청한 스트림을 그대로 전송
+        client->adaptive = has_adaptive ? adaptive != 0 : obj->adaptive;
+        memcpy(&client->request_variant, &variant, sizeof(variant));
+        client->tier = 0;
+        client->stride = 1;
+        client->strided = 0;
+        client->probe_time = stats_now();
+        client->probe_queued = 0;
+        client->probe_backlog = 0;
+        client->probe_sent = 0;
+        client->probe_delivered = 0;
+        client->probe_frames = 0;
+        client->probe_dropped = 0;
+        client->tier_changed = client->probe_time;
+        client->tier_raised = 0;
+        client->clear_since = 0;
+        client->up_hold = ADAPTIVE_UP_HOLD;
+        atomic_store(&client->tier_gauge, 0);
+
+        struct mjpeg_reactor *reactor = client->reactor;
+
+        if (variant.scale > 1 || variant.crop.width || variant.gray)
+        {
+            int index = mjpeg_transcoder_subscribe(obj->transcoder, &variant);
+
+            if (index < 0)
             {
-                logging("received socket: %d", fds[2].fd);
-                mjpeg_client_process_content(client);
+                logging("mjpeg no free variant slot, sending original: %d", client->socket);
             }
+            client->variant = index + 1;
+        }
+
+        // 헤더에 이어 캐시된 최신 프레임을 바로 전송 (mjpeg_client_write)
+        if (client->variant)
+        {
+            // 재사용된 슬롯이면 리액터 캐시에 이전 설정의 프레임이 남아 있으므로 변환 스레드 기준으로 교체
+            // 아직 변환된 프레임이 없으면 변환 스레드가 게시할 때 전송
+            mjpeg_frame_unref(reactor->variants[client->variant - 1]);
+            reactor->variants[client->variant - 1] = mjpeg_transcoder_get_frame(obj->transcoder, client->variant - 1);
         }
+        else
+        {
+            // 리액터 캐시가 아직 비었거나 깨어나기 전이면 서버의 최신 프레임으로 갱신
+            struct mjpeg_frame *frame = mjpeg_server_get_frame(obj);
+
+            if (frame && (reactor->frame == 0 || frame->sequence > reactor->frame->sequence))
+            {
+                mjpeg_frame_unref(reactor->frame);
+                reactor->frame = frame;
+            }
+            else
+            {
+                mjpeg_frame_unref(frame);
+            }
+        }
+    }
+    mjpeg_client_begin_response(client);
+}
+
+// 브라우저는 처음 HTTP REQUEST 이후 서버로 데이터를 전송하지 않으므로
+// 헤더 수신 이후의 데이터는 무시하고, 일반적으로 연결이 끊겼을 때 0을 수신
+// 핸드셰이크가 끝나면 요청 헤더 수신으로
+/* 이어서 읽기: 0 */
+static int mjpeg_client_handshake(struct mjpeg_socket *client)
+{
+    struct mjpeg_reactor *reactor = client->reactor;
+    int ret = mjpeg_tls_handshake(client->tls);
+
+    if (ret < 0)
+    {
+        stats_add(&reactor->stats.tls_failed, 1);
+        mjpeg_client_close(client);
+        return 1;
+    }
+    if (ret > 0)
+    {
+        return 1;
+    }
+    client->ktls = mjpeg_tls_ktls(client->tls);
+    client->state = read_head;
+    stats_add(&reactor->stats.tls_handshakes, 1);
+    stats_add(&reactor->stats.tls_ktls, client->ktls);
+    stats_histogram_add(&reactor->stats.tls_handshake, stats_now() - client->accepted);
+
+    logging("mjpeg tls: (id: %d, %s, %s, ktls: %d)", client->id, mjpeg_tls_version(client->tls), mjpeg_tls_cipher(client->tls), client->ktls);
+
+    // 핸드셰이크와 함께 도착한 요청은 세션 버퍼에 있으므로 이어서 읽음
+    return 0;
+}
+
+static ssize_t mjpeg_client_recv(struct mjpeg_socket *client, void *buffer, size_t length)
+{
+    if (client->tls)
+    {
+        return mjpeg_tls_read(client->tls, buffer, length);
+    }
+    return recv(client->socket, buffer, length, 0);
+}
+
+static void mjpeg_client_read(struct mjpeg_socket *client)
+{
+    char buffer[512];
+
+    if (client->state == tls_handshake && mjpeg_client_handshake(client))
+    {
+        return;
+    }
+    while (client->state != none)
+    {
+        ssize_t recvlen = mjpeg_client_recv(client, buffer, sizeof(buffer));
+        if (recvlen < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                mjpeg_client_close(client);
+            }
+            return;
+        }
+        if (recvlen == 0)
+        {
+            logging("mjpeg client closed (id: %d)", client->id);
+            mjpeg_client_close(client);
+            return;
+        }
+        if (client->state != read_head)
+        {
+            continue;
+        }
+
+        // 헤더를 클라이언트 버퍼에 \r\n\r\n 문자가 수신될 때 까지 append
+        if (client->buffer.length + recvlen >= MAX_REQUEST || prepare_buffer(&client->buffer, client->buffer.length + recvlen + 1))
+        {
+            mjpeg_client_close(client);
+            return;
+        }
+        memcpy(client->buffer.data + client->buffer.length, buffer, recvlen);
+        client->buffer.length += recvlen;
+        client->buffer.data[client->buffer.length] = 0;
+
+        if (strstr(client->buffer.data, "\r\n\r\n"))
+        {
+            mjpeg_client_process_header(client);
+        }
+    }
+}
+
+// 완료 알림 대기가 만료된 닫은 연결을 끊음
+static void mjpeg_reactor_expire_lingering(struct mjpeg_reactor *reactor)
+{
+    uint64_t now = stats_now();
+    struct mjpeg_socket *next;
+
+    for (struct mjpeg_socket *client = reactor->clients; client && reactor->lingering; client = next)
+    {
+        next = client->reactor_next;
+
+        if (client->state == zerocopy_linger && now >= client->deadline)
+        {
+            mjpeg_client_close(client);
+        }
+    }
+}
+
+static void mjpeg_reactor_kick(struct mjpeg_reactor *reactor)
+{
+    struct mjpeg_socket *next;
+
+    for (struct mjpeg_socket *client = reactor->clients; client; client = next)
+    {
+        next = client->reactor_next;
+
+        if (atomic_load(&client->kick) && client->state != zerocopy_linger)
+        {
+            logging("mjpeg evict: (id: %d, socket: %d)", client->id, client->socket);
+            mjpeg_client_close(client);
+        }
+    }
+}
+
+static void mjpeg_reactor_release(struct mjpeg_reactor *reactor)
+{
+    while (reactor->closed)
+    {
+        struct mjpeg_socket *client = reactor->closed;
+
+        reactor->closed = client->free_next;
+        mjpeg_client_release(client);
+    }
+}
+
+static void *mjpeg_reactor_main(void *args)
+{
+    struct mjpeg_reactor *reactor = args;
+    struct mjpeg_server *mjpeg_server = reactor->server;
+
+    while (mjpeg_server->stop == 0)
+    {
+        int post = 0;
+
+        reactor->event_index = 0;
+        // 대기 중인 /snapshot.jpg 요청이나 완료 알림을 기다리는 닫은 연결이 있으면 만료를 확인하기 위해 주기적으로 깨어남
+        reactor->event_count = epoll_wait(reactor->epoll, reactor->events, MAX_EVENTS, reactor->waiting || reactor->lingering ? 1000 : -1);
+
+        if (reactor->event_count == -1)
+        {
+            reactor->event_count = 0;
+
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        if (mjpeg_server->stop)
+        {
+            break;
+        }
+
+        for (; reactor->event_index < reactor->event_count; reactor->event_index++)
+        {
+            struct epoll_event *ev = &reactor->events[reactor->event_index];
+
+            if (ev->data.ptr == 0)
+            {
+                continue;
+            }
+            if (ev->data.ptr == &reactor->event)
+            {
+                uint64_t u = 0;
+
+                read(reactor->event, &u, sizeof(u));
+                post = 1;
+                continue;
+            }
+            if (ev->data.ptr == &mjpeg_server->socket)
+            {
+                mjpeg_server_accept(reactor);
+                continue;
+            }
+
+            struct mjpeg_socket *client = ev->data.ptr;
+
+            // 닫은 연결은 완료 알림만 처리
+            if (client->state == zerocopy_linger)
+            {
+                if (ev->events & EPOLLERR)
+                {
+                    mjpeg_client_linger(client);
+                }
+                continue;
+            }
+            // 핸드셰이크는 읽기/쓰기 어느 쪽을 기다리는지 모르므로 모든 이벤트에서 진행
+            if ((ev->events & EPOLLIN) || client->state == tls_handshake)
+            {
+                mjpeg_client_read(client);
+            }
+            // 완료 알림을 먼저 처리하여 잡아 둔 프레임 반환
+            if (client->state != none && client->state != zerocopy_linger && (ev->events & EPOLLERR))
+            {
+                if (mjpeg_client_reap(client))
+                {
+                    mjpeg_client_close(client);
+                }
+            }
+            if (client->state != none && client->state != zerocopy_linger && (ev->events & EPOLLOUT))
+            {
+                if (mjpeg_client_write(client))
+                {
+                    mjpeg_client_close(client);
+                }
+            }
+            if (client->state != none && client->state != zerocopy_linger && (ev->events & EPOLLHUP))
+            {
+                mjpeg_client_close(client);
+            }
+        }
+        reactor->event_count = 0;
+
+        if (post)
+        {
+            mjpeg_reactor_kick(reactor);
+            mjpeg_reactor_post(reactor);
+        }
+        if (reactor->waiting)
+        {
+            mjpeg_reactor_answer_waiting(reactor, 0);
+        }
+        if (reactor->lingering)
+        {
+            mjpeg_reactor_expire_lingering(reactor);
+        }
+        mjpeg_reactor_release(reactor);
+    }
+    return 0;
+}
+
+mjpeg_server_t *mjpeg_server_create(const char *bind, short port)
+{
+    mjpeg_server_t *obj;
+    if (bind == 0)
+    {
+        return 0;
+    }
+    obj = malloc(sizeof(*obj));
+    if (obj == 0)
+    {
+        return 0;
+    }
+    memset(obj, 0, sizeof(*obj));
+    sem_init(&obj->semaphore, 0, 1);
+    sem_init(&obj->clients_semaphore, 0, 1);
+    obj->socket = -1;
+    obj->reactor_count = 1;
+    obj->max_clients = MAX_CLIENT;
+    obj->overload = mjpeg_overload_evict_oldest;
+    obj->pool = mjpeg_frame_pool_create(MAX_FRAME);
+    if (!obj->pool)
+    {
+        free(obj);
+        return 0;
+    }
+    obj->transcoder = mjpeg_transcoder_create(VARIANT_QUALITY, mjpeg_server_wakeup, mjpeg_server_analysed, obj);
+    obj->events = mjpeg_events_create(mjpeg_server_wakeup, obj);
+    if (obj->transcoder == 0 || obj->events == 0)
+    {
+        mjpeg_transcoder_destroy(obj->transcoder);
+        mjpeg_events_destroy(obj->events);
+        mjpeg_frame_pool_destroy(obj->pool);
+        free(obj);
+        return 0;
+    }
+    obj->motion_keepalive = MOTION_KEEPALIVE * 1000000000ull;
+    obj->nodelay = 1;
+    obj->notsent_lowat = NOTSENT_LOWAT;
+    atomic_init(&obj->motion_clients, 0);
+    obj->port = port;
+    obj->bind = strdup(bind);
+    if (obj->bind == 0)
+    {
+        mjpeg_server_destroy(obj);
+        return 0;
+    }
+    return obj;
+}
+
+void mjpeg_server_destroy(mjpeg_server_t *obj)
+{
+    if (obj == 0)
+    {
+        return;
+    }
+    if (obj->bind)
+    {
+        free(obj->bind);
+        obj->bind = 0;
+    }
+    mjpeg_server_stop(obj);
+
+    while (obj->chunks)
+    {
+        struct mjpeg_client_chunk *chunk = obj->chunks;
+
+        for (int i = 0; i < CLIENT_CHUNK; i++)
+        {
+            if (chunk->sockets[i].buffer.data)
+            {
+                free(chunk->sockets[i].buffer.data);
+            }
+        }
+        obj->chunks = chunk->next;
+        free(chunk);
+    }
+    mjpeg_frame_unref(obj->frame);
+    obj->frame = 0;
+    mjpeg_transcoder_destroy(obj->transcoder);
+    mjpeg_events_destroy(obj->events);
+    mjpeg_tls_destroy(obj->tls);
+
+    sem_destroy(&obj->semaphore);
+    sem_destroy(&obj->clients_semaphore);
+    mjpeg_frame_pool_destroy(obj->pool);
+    free(obj);
+}
+
+void mjpeg_server_set_reactors(mjpeg_server_t *obj, int count)
+{
+    if (count < 1)
+    {
+        count = 1;
+    }
+    if (count > MAX_REACTOR)
+    {
+        count = MAX_REACTOR;
+    }
+    obj->reactor_count = count;
+}
+
+void mjpeg_server_set_max_clients(mjpeg_server_t *obj, unsigned int count, enum mjpeg_overload_policy policy)
+{
+    sem_wait(&obj->clients_semaphore);
+    obj->max_clients = count;
+    obj->overload = policy;
+    sem_post(&obj->clients_semaphore);
+}
+
+void mjpeg_server_set_client_fps(mjpeg_server_t *obj, unsigned int fps)
+{
+    obj->interval = fps ? 1000000000ull / fps : 0;
+}
+
+void mjpeg_server_set_tcp(mjpeg_server_t *obj, int nodelay, unsigned int sndbuf, unsigned int notsent_lowat)
+{
+    obj->nodelay = nodelay != 0;
+    obj->sndbuf = sndbuf;
+    obj->notsent_lowat = notsent_lowat;
+}
+
+/* success: 0 */
+int mjpeg_server_set_tls(mjpeg_server_t *obj, const char *cert, const char *key)
+{
+    mjpeg_tls_t *tls = mjpeg_tls_create(cert, key);
+
+    if (tls == 0)
+    {
+        return 1;
+    }
+    mjpeg_tls_destroy(obj->tls);
+    obj->tls = tls;
+    return 0;
+}
+
+void mjpeg_server_set_zerocopy(mjpeg_server_t *obj, int enable)
+{
+    obj->zerocopy = enable != 0;
+}
+
+void mjpeg_server_set_adaptive(mjpeg_server_t *obj, int enable)
+{
+    obj->adaptive = enable != 0;
+}
+
+void mjpeg_server_set_motion(mjpeg_server_t *obj, unsigned int threshold, unsigned int keepalive)
+{
+    obj->motion_threshold = threshold < 255 ? threshold : 255;
+    obj->motion_keepalive = keepalive * 1000000000ull;
+}
+
+/* success: 0 */
+int mjpeg_server_add_motion_zone(mjpeg_server_t *obj, const struct mjpeg_zone *zone)
+{
+    return mjpeg_events_add_zone(obj->events, zone);
+}
+
+void mjpeg_server_set_motion_sensitivity(mjpeg_server_t *obj, unsigned int level)
+{
+    mjpeg_events_set_sensitivity(obj->events, level);
+}
+
+/* success: 0 */
+int mjpeg_server_set_frame_slots(mjpeg_server_t *obj, unsigned int count)
+{
+    // 게시된 프레임이 있으면 풀을 교체할 수 없음
+    if (obj->reactors || obj->frame)
+    {
+        return 1;
+    }
+    mjpeg_frame_pool_t *pool = mjpeg_frame_pool_create(count);
+    if (pool == 0)
+    {
+        return 1;
+    }
+    mjpeg_frame_pool_destroy(obj->pool);
+    obj->pool = pool;
+    return 0;
+}
+
+/* success: 0 */
+static int mjpeg_reactor_start(struct mjpeg_reactor *reactor)
+{
+    mjpeg_server_t *obj = reactor->server;
+
+    reactor->epoll = epoll_create1(EPOLL_CLOEXEC);
+    reactor->event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->epoll == -1 || reactor->event == -1)
+    {
+        return 1;
+    }
+
+    struct epoll_event ev =
+    {
+        .events = EPOLLIN,
+        .data.ptr = &reactor->event,
+    };
+    if (epoll_ctl(reactor->epoll, EPOLL_CTL_ADD, reactor->event, &ev) != 0)
+    {
+        return 1;
+    }
+
+    // 리액터가 여러 개면 커널이 깨울 리액터 하나를 선택
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = &obj->socket;
+    if (epoll_ctl(reactor->epoll, EPOLL_CTL_ADD, obj->socket, &ev) != 0)
+    {
+        return 1;
+    }
+
+    if (pthread_create(&reactor->thread, 0, &mjpeg_reactor_main, reactor) != 0)
+    {
+        reactor->thread = 0;
+        return 1;
+    }
+    return 0;
+}
+
+/* success: 0 */
+int mjpeg_server_start(mjpeg_server_t *obj)
+{
+    struct sockaddr_in addr;
+    struct mjpeg_reactor *reactors;
+
+    if (obj->reactors)
+    {
+        return 1;
+    }
+
+    obj->stop = 0;
+
+    if (obj->favicon == 0)
+    {
+        obj->favicon = read_favicon();
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(obj->bind);
+    addr.sin_port = htons(obj->port);
+
+    obj->socket = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (obj->socket == -1)
+    {
+        perror("socket");
+        mjpeg_server_stop(obj);
+        return 1;
+    }
+    int optval = 1;
+    if (setsockopt(obj->socket, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval))!= 0)
+    {
+        perror("setsockopt");
+        mjpeg_server_stop(obj);
+        return 1;
+    }
+    // 프레임 끝의 경계 문자열이 Nagle 알고리즘으로 늦게 나가지 않도록 함
+    optval = obj->nodelay;
+    if (setsockopt(obj->socket, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) != 0)
+    {
+        perror("TCP_NODELAY");
+    }
+    optval = obj->sndbuf;
+    if (obj->sndbuf && setsockopt(obj->socket, SOL_SOCKET, SO_SNDBUF, &optval, sizeof(optval)) != 0)
+    {
+        perror("SO_SNDBUF");
+    }
+    // 보내지 않은 데이터가 이 값 아래로 줄어들 때만 EPOLLOUT, 이 값을 넘으면 sendmsg가 EAGAIN
+    optval = obj->notsent_lowat;
+    if (obj->notsent_lowat && setsockopt(obj->socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &optval, sizeof(optval)) != 0)
+    {
+        perror("TCP_NOTSENT_LOWAT");
+        obj->notsent_lowat = 0;
+    }
+    optval = 1;
+    if (obj->zerocopy && setsockopt(obj->socket, SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof(optval)) != 0)
+    {
+        perror("SO_ZEROCOPY");
+        obj->zerocopy = 0;
+    }
+    if (bind(obj->socket, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        perror("bind");
+        mjpeg_server_stop(obj);
+        return 1;
+    }
+    if (listen(obj->socket, SOMAXCONN) != 0)
+    {
+        perror("listen");
+        mjpeg_server_stop(obj);
+        return 1;
+    }
+
+    reactors = calloc(obj->reactor_count, sizeof(struct mjpeg_reactor));
+    if (reactors == 0)
+    {
+        mjpeg_server_stop(obj);
+        return 1;
+    }
+    for (int i = 0; i < obj->reactor_count; i++)
+    {
+        reactors[i].id = i;
+        reactors[i].epoll = -1;
+        reactors[i].event = -1;
+        reactors[i].server = obj;
+    }
+    for (int i = 0; i < obj->reactor_count; i++)
+    {
+        if (mjpeg_reactor_start(&reactors[i]))
+        {
+            perror("reactor");
+            obj->reactors = reactors;
+            mjpeg_server_stop(obj);
+            return 1;
+        }
+    }
+    // 캡처 스레드의 mjpeg_server_post에서 참조하므로 초기화가 끝난 후 설정
+    obj->reactors = reactors;
+
+    if (mjpeg_transcoder_start(obj->transcoder))
+    {
+        perror("transcoder");
+        mjpeg_server_stop(obj);
+        return 1;
+    }
+    if (mjpeg_events_start(obj->events))
+    {
+        perror("events");
+        mjpeg_server_stop(obj);
+        return 1;
+    }
+
+    logging("mjpeg server: %s:%d, reactors: %d", obj->bind, obj->port, obj->reactor_count);
+    return 0;
+}
+
+void mjpeg_server_stop(mjpeg_server_t *obj)
+{
+    struct mjpeg_reactor *reactors;
+
+    if (obj == 0)
+    {
+        return;
+    }
+    obj->stop = 1;
+
+    // 변환/분석 스레드가 리액터를 깨우지 않도록 먼저 종료
+    mjpeg_transcoder_stop(obj->transcoder);
+    mjpeg_events_stop(obj->events);
+
+    sem_wait(&obj->clients_semaphore);
+    reactors = obj->reactors;
+    obj->reactors = 0;
+    sem_post(&obj->clients_semaphore);
+
+    for (int i = 0; reactors && i < obj->reactor_count; i++)
+    {
+        if (reactors[i].thread)
+        {
+            mjpeg_reactor_wakeup(&reactors[i]);
+        }
+    }
+    for (int i = 0; reactors && i < obj->reactor_count; i++)
+    {
+        struct mjpeg_reactor *reactor = &reactors[i];
+
+        if (reactor->thread)
+        {
+            pthread_join(reactor->thread, 0);
+            reactor->thread = 0;
+        }
+        // 리액터 스레드가 종료된 후 남은 클라이언트 정리
+        while (reactor->clients)
+        {
+            mjpeg_client_close(reactor->clients);
+        }
+        mjpeg_reactor_release(reactor);
+
+        mjpeg_frame_unref(reactor->frame);
+        reactor->frame = 0;
+        for (int j = 0; j < MJPEG_TRANSCODER_MAX_VARIANTS; j++)
+        {
+            mjpeg_frame_unref(reactor->variants[j]);
+            reactor->variants[j] = 0;
+        }
+        mjpeg_frame_unref(reactor->analysed);
+        reactor->analysed = 0;
+
+        if (reactor->event != -1)
+        {
+            close(reactor->event);
+        }
+        if (reactor->epoll != -1)
+        {
+            close(reactor->epoll);
+        }
+    }
+    if (reactors)
+    {
+        // mjpeg_server_get_stats에서 참조 중일 수 있음
+        sem_wait(&obj->clients_semaphore);
+        free(reactors);
+        sem_post(&obj->clients_semaphore);
+    }
+    if (obj->socket != -1)
+    {
+        close(obj->socket);
+        obj->socket = -1;
+    }
+    if (obj->favicon)
+    {
+        free(obj->favicon->data);
+        free(obj->favicon);
+        obj->favicon = 0;
+    }
+}
+
+void mjpeg_server_post(mjpeg_server_t *obj, const char *buffer, unsigned int length, uint64_t timestamp, uint64_t sequence)
+{
+    if (obj == 0)
+    {
+        return;
+    }
+
+    if (stats_get(&obj->frames_posted) + stats_get(&obj->frames_discarded) && sequence > obj->source_sequence + 1)
+    {
+        stats_add(&obj->frames_lost, sequence - obj->source_sequence - 1);
+    }
+    obj->source_sequence = sequence;
+
+    // 캡처 버퍼(mmap)는 곧바로 드라이버에 반환되므로 한번만 복사하여 게시
+    // 모든 슬롯이 전송 중이면 이번 프레임은 버림
+    struct mjpeg_frame *frame = mjpeg_frame_pool_acquire(obj->pool, length);
+    if (frame == 0)
+    {
+        stats_add(&obj->frames_discarded, 1);
+        return;
+    }
+    memcpy(frame->data, buffer, length);
+    frame->length = length;
+    frame->source_sequence = sequence;
+    frame->timestamp = timestamp;
+    mjpeg_frame_build_head(frame);
+
+    frame->published = stats_now();
+    if (frame->published >= timestamp)
+    {
+        stats_histogram_add(&obj->capture_to_publish, frame->published - timestamp);
+    }
+    stats_histogram_add_value(&obj->frame_size, length);
+
+    // 게이트를 쓰는 스트림이나 /events 구독자가 있을 때만 계산, 캡처가 밀리지 않도록 변환 스레드에서 게시 후 분석
+    // /events는 분석이 끝난 프레임을 변환 스레드에서 받음 (mjpeg_server_analysed)
+    if (obj->motion_threshold || atomic_load(&obj->motion_clients) || mjpeg_events_get_subscribers(obj->events))
+    {
+        atomic_store_explicit(&frame->motion_state, MJPEG_FRAME_MOTION_PENDING, memory_order_relaxed);
+    }
+
+    sem_wait(&obj->semaphore);
+    struct mjpeg_frame *prev = obj->frame;
+    frame->sequence = ++obj->sequence;
+    obj->frame = frame;
+    sem_post(&obj->semaphore);
+
+    mjpeg_frame_unref(prev);
+
+    stats_add(&obj->frames_posted, 1);
+
+    mjpeg_transcoder_post(obj->transcoder, frame);
+    mjpeg_server_wakeup(obj);
+}
+
+void mjpeg_server_add_encode_time(mjpeg_server_t *obj, uint64_t duration)
+{
+    stats_histogram_add(&obj->encode_duration, duration);
+}
+
+static void histogram_merge(struct mjpeg_histogram *dst, struct stats_histogram *src)
+{
+    dst->count += stats_get(&src->count);
+    dst->sum += stats_get(&src->sum);
+    for (int i = 0; i < MJPEG_HISTOGRAM_BUCKETS; i++)
+    {
+        dst->bucket[i] += stats_get(&src->bucket[i]);
+    }
+}
+
+uint64_t mjpeg_histogram_percentile(const struct mjpeg_histogram *histogram, double p)
+{
+    uint64_t total = 0;
+
+    for (int i = 0; i < MJPEG_HISTOGRAM_BUCKETS; i++)
+    {
+        total += histogram->bucket[i];
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(p / 100.0 * total + 0.5);
+    uint64_t count = 0;
+
+    for (int i = 0; i < MJPEG_HISTOGRAM_BUCKETS; i++)
+    {
+        count += histogram->bucket[i];
+        if (count >= rank && count)
+        {
+            return 1ull << i;
+        }
+    }
+    return 1ull << (MJPEG_HISTOGRAM_BUCKETS - 1);
+}
+
+void mjpeg_server_get_stats(mjpeg_server_t *obj, struct mjpeg_server_stats *stats)
+{
+    _Static_assert(STATS_HISTOGRAM_BUCKETS == MJPEG_HISTOGRAM_BUCKETS, "histogram buckets");
+
+    memset(stats, 0, sizeof(*stats));
+
+    stats->frames_posted = stats_get(&obj->frames_posted);
+    stats->frames_discarded = stats_get(&obj->frames_discarded);
+    stats->frames_lost = stats_get(&obj->frames_lost);
+    histogram_merge(&stats->capture_to_publish, &obj->capture_to_publish);
+    histogram_merge(&stats->frame_size, &obj->frame_size);
+    histogram_merge(&stats->encode_duration, &obj->encode_duration);
+
+    struct mjpeg_transcoder_stats *transcoder = mjpeg_transcoder_get_stats(obj->transcoder);
+
+    stats->frames_transcoded = stats_get(&transcoder->frames_transcoded);
+    stats->transcode_failed = stats_get(&transcoder->frames_failed);
+    stats->transcode_discarded = stats_get(&transcoder->frames_discarded);
+    histogram_merge(&stats->transcode_duration, &transcoder->duration);
+
+    struct mjpeg_events_stats *events = mjpeg_events_get_stats(obj->events);
+
+    stats->frames_analysed = stats_get(&events->frames_analysed);
+    stats->analyse_failed = stats_get(&events->frames_failed);
+    stats->motion_events = stats_get(&events->events);
+    histogram_merge(&stats->analyse_duration, &events->duration);
+
+    sem_wait(&obj->clients_semaphore);
+    for (int i = 0; obj->reactors && i < obj->reactor_count; i++)
+    {
+        struct mjpeg_reactor_stats *reactor = &obj->reactors[i].stats;
+
+        stats->frames_sent += stats_get(&reactor->frames_sent);
+        stats->frames_dropped += stats_get(&reactor->frames_dropped);
+        stats->frames_suppressed += stats_get(&reactor->frames_suppressed);
+        stats->send_deferred += stats_get(&reactor->send_deferred);
+        stats->zerocopy_sends += stats_get(&reactor->zerocopy_sends);
+        stats->zerocopy_copied += stats_get(&reactor->zerocopy_copied);
+        stats->tier_down += stats_get(&reactor->tier_down);
+        stats->tier_up += stats_get(&reactor->tier_up);
+        stats->bytes_sent += stats_get(&reactor->bytes_sent);
+        stats->send_calls += stats_get(&reactor->send_calls);
+        stats->send_calls_saved += stats_get(&reactor->send_calls_saved);
+        histogram_merge(&stats->publish_to_send, &reactor->publish_to_send);
+        histogram_merge(&stats->send_duration, &reactor->send_duration);
+        histogram_merge(&stats->first_frame, &reactor->first_frame);
+        stats->tls_handshakes += stats_get(&reactor->tls_handshakes);
+        stats->tls_failed += stats_get(&reactor->tls_failed);
+        stats->tls_ktls += stats_get(&reactor->tls_ktls);
+        histogram_merge(&stats->tls_handshake, &reactor->tls_handshake);
+    }
+    stats->clients = obj->count;
+    sem_post(&obj->clients_semaphore);
+}
+
+void mjpeg_server_log_stats(mjpeg_server_t *obj)
+{
+    struct mjpeg_server_stats stats;
+
+    mjpeg_server_get_stats(obj, &stats);
+
+    logging("mjpeg stats: posted: %llu, discarded: %llu, lost: %llu, sent: %llu, dropped: %llu, suppressed: %llu, deferred: %llu, tier down/up: %llu/%llu, bytes: %llu, syscalls: %llu (saved: %llu), clients: %u",
+        (unsigned long long)stats.frames_posted,
+        (unsigned long long)stats.frames_discarded,
+        (unsigned long long)stats.frames_lost,
+        (unsigned long long)stats.frames_sent,
+        (unsigned long long)stats.frames_dropped,
+        (unsigned long long)stats.frames_suppressed,
+        (unsigned long long)stats.send_deferred,
+        (unsigned long long)stats.tier_down,
+        (unsigned long long)stats.tier_up,
+        (unsigned long long)stats.bytes_sent,
+        (unsigned long long)stats.send_calls,
+        (unsigned long long)stats.send_calls_saved,
+        stats.clients
+    );
+    logging("mjpeg latency (us, p50/p99 upper bound): capture->publish: %llu/%llu, publish->send: %llu/%llu, send: %llu/%llu, first frame: %llu/%llu",
+        (unsigned long long)mjpeg_histogram_percentile(&stats.capture_to_publish, 50),
+        (unsigned long long)mjpeg_histogram_percentile(&stats.capture_to_publish, 99),
+        (unsigned long long)mjpeg_histogram_percentile(&stats.publish_to_send, 50),
+        (unsigned long long)mjpeg_histogram_percentile(&stats.publish_to_send, 99),
+        (unsigned long long)mjpeg_histogram_percentile(&stats.send_duration, 50),
+        (unsigned long long)mjpeg_histogram_percentile(&stats.send_duration, 99),
+        (unsigned long long)mjpeg_histogram_percentile(&stats.first_frame, 50),
+        (unsigned long long)mjpeg_histogram_percentile(&stats.first_frame, 99)
+    );
+    if (stats.frames_transcoded + stats.transcode_failed + stats.transcode_discarded)
+    {
+        logging("mjpeg transcode: %llu (failed: %llu, discarded: %llu), us p50/p99 upper bound: %llu/%llu",
+            (unsigned long long)stats.frames_transcoded,
+            (unsigned long long)stats.transcode_failed,
+            (unsigned long long)stats.transcode_discarded,
+            (unsigned long long)mjpeg_histogram_percentile(&stats.transcode_duration, 50),
+            (unsigned long long)mjpeg_histogram_percentile(&stats.transcode_duration, 99)
+        );
+    }
+    if (stats.frames_analysed + stats.analyse_failed)
+    {
+        logging("mjpeg motion events: %llu, analysed: %llu (failed: %llu), us p50/p99 upper bound: %llu/%llu",
+            (unsigned long long)stats.motion_events,
+            (unsigned long long)stats.frames_analysed,
+            (unsigned long long)stats.analyse_failed,
+            (unsigned long long)mjpeg_histogram_percentile(&stats.analyse_duration, 50),
+            (unsigned long long)mjpeg_histogram_percentile(&stats.analyse_duration, 99)
+        );
+    }
+    if (stats.tls_handshakes + stats.tls_failed)
+    {
+        logging("mjpeg tls: handshakes: %llu (failed: %llu, ktls: %llu), us p50/p99 upper bound: %llu/%llu",
+            (unsigned long long)stats.tls_handshakes,
+            (unsigned long long)stats.tls_failed,
+            (unsigned long long)stats.tls_ktls,
+            (unsigned long long)mjpeg_histogram_percentile(&stats.tls_handshake, 50),
+            (unsigned long long)mjpeg_histogram_percentile(&stats.tls_handshake, 99)
+        );
+    }
+    if (stats.encode_duration.count)
+    {
+        logging("mjpeg encode (us, p50/p99 upper bound): %llu/%llu, average: %llu",
+            (unsigned long long)mjpeg_histogram_percentile(&stats.encode_duration, 50),
+            (unsigned long long)mjpeg_histogram_percentile(&stats.encode_duration, 99),
+            (unsigned long long)(stats.encode_duration.sum / stats.encode_duration.count / 1000)
+        );
+    }
+
+    sem_wait(&obj->clients_semaphore);
+    for (struct mjpeg_socket *client = obj->head; client; client = client->next)
+    {
+        logging(" - client: %d, reactor: %d, sent: %llu, dropped: %llu, bytes: %llu",
+            client->id,
+            client->reactor->id,
+            (unsigned long long)stats_get(&client->frames_sent),
+            (unsigned long long)stats_get(&client->frames_dropped),
+            (unsigned long long)stats_get(&client->bytes_sent)
+        );
     }
+    sem_post(&obj->clients_semaphore);
 }
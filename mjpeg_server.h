@@ -1,16 +1,136 @@
 #ifndef MJPEG_SERVER_H
 #define MJPEG_SERVER_H
 
+#include <stdint.h>
+
+#include "mjpeg_events.h"
+
 struct mjpeg_server;
 typedef struct mjpeg_server mjpeg_server_t;
 
+// 연결 수가 max_clients에 도달했을 때 새 연결 처리 방법
+enum mjpeg_overload_policy
+{
+    // 503 응답 후 새 연결 종료
+    mjpeg_overload_reject,
+    // 가장 오래된 연결 종료
+    mjpeg_overload_evict_oldest,
+    // 가장 오랫동안 전송이 막혀 있는 연결 종료
+    mjpeg_overload_evict_idle,
+};
+
+#define MJPEG_HISTOGRAM_BUCKETS 32
+
+// 버킷 i: [2^(i-1), 2^i) us (크기는 bytes), 버킷 0: 1 미만
+struct mjpeg_histogram
+{
+    uint64_t count;
+    // 시간은 ns
+    uint64_t sum;
+    uint64_t bucket[MJPEG_HISTOGRAM_BUCKETS];
+};
+
+struct mjpeg_server_stats
+{
+    // 캡처 측: 게시된 프레임, 빈 슬롯이 없어서 버린 프레임
+    uint64_t frames_posted;
+    uint64_t frames_discarded;
+    // 프레임 소스 번호가 건너뛴 수 (드라이버 드롭, 지연 우선 모드에서 건너뛴 프레임)
+    uint64_t frames_lost;
+    // 클라이언트 측: 전송한 프레임, 전송이 늦어 건너뛴 프레임
+    uint64_t frames_sent;
+    uint64_t frames_dropped;
+    // 움직임 게이트가 변화가 적어 보내지 않은 프레임
+    uint64_t frames_suppressed;
+    // 보내지 않은 데이터가 TCP_NOTSENT_LOWAT 이상이라 새 프레임을 넘기지 않은 횟수
+    uint64_t send_deferred;
+    // MSG_ZEROCOPY sendmsg 호출 수, 커널이 결국 복사한 호출 수
+    uint64_t zerocopy_sends;
+    uint64_t zerocopy_copied;
+    // 대역폭 적응 스트림이 단계를 내린/올린 횟수
+    uint64_t tier_down;
+    uint64_t tier_up;
+    uint64_t bytes_sent;
+    // sendmsg 호출 수, 파트마다 헤더/본문/경계를 따로 send 했을 때보다 줄어든 호출 수
+    uint64_t send_calls;
+    uint64_t send_calls_saved;
+    unsigned int clients;
+    // ?scale 파생 스트림으로 변환한 원본 프레임 수, 실패한 수
+    uint64_t frames_transcoded;
+    uint64_t transcode_failed;
+    // 파생 프레임 풀이 모자라 게시하지 못한 파생 프레임 수
+    uint64_t transcode_discarded;
+    // /events 분석 프레임 수, 실패한 수, 움직임 시작/종료 이벤트 수
+    uint64_t frames_analysed;
+    uint64_t analyse_failed;
+    uint64_t motion_events;
+
+    // 캡처 -> 게시, 게시 -> 클라이언트 전송 시작, 전송 시작 -> 전송 완료
+    struct mjpeg_histogram capture_to_publish;
+    struct mjpeg_histogram publish_to_send;
+    struct mjpeg_histogram send_duration;
+    // 스트림 요청 -> 첫 프레임 전송 완료
+    struct mjpeg_histogram first_frame;
+    // TLS 핸드셰이크 완료/실패 수, 송신을 커널 TLS로 넘긴 세션 수, accept -> 핸드셰이크 완료 시간
+    uint64_t tls_handshakes;
+    uint64_t tls_failed;
+    uint64_t tls_ktls;
+    struct mjpeg_histogram tls_handshake;
+    // 게시된 프레임 크기
+    struct mjpeg_histogram frame_size;
+    // 원본 캡처를 JPEG로 부호화한 시간
+    struct mjpeg_histogram encode_duration;
+    // 원본 한 장을 구독 중인 모든 파생 스트림으로 변환한 시간
+    struct mjpeg_histogram transcode_duration;
+    // 프레임 한 장의 움직임 분석 시간
+    struct mjpeg_histogram analyse_duration;
+};
+
 mjpeg_server_t *mjpeg_server_create(const char *bind, short port);
 void mjpeg_server_destroy(mjpeg_server_t *obj);
 
+void mjpeg_server_set_reactors(mjpeg_server_t *obj, int count);
+/* count 0: unlimited */
+void mjpeg_server_set_max_clients(mjpeg_server_t *obj, unsigned int count, enum mjpeg_overload_policy policy);
+// ?fps=N 이 없는 스트림의 프레임 제한, 0: 모든 프레임, start 전에 설정
+void mjpeg_server_set_client_fps(mjpeg_server_t *obj, unsigned int fps);
+// 연결 소켓 설정, start 전에 설정
+// nodelay: TCP_NODELAY (기본값: 1), sndbuf: SO_SNDBUF (0: 커널 자동 조절)
+// notsent_lowat: 보내지 않은 데이터가 이 값(바이트)보다 적을 때만 새 프레임 전송 (0: 제한 없음, 기본값: 131072)
+void mjpeg_server_set_tcp(mjpeg_server_t *obj, int nodelay, unsigned int sndbuf, unsigned int notsent_lowat);
+// 모든 연결을 HTTPS로 받음, 핸드셰이크 후 가능하면 송신을 커널 TLS로 넘겨 프레임은 평문 sendmsg로 전송
+// cert: 인증서 체인 PEM, key: 개인키 PEM, OpenSSL 없이 빌드했으면 실패, start 전에 설정
+/* success: 0 */
+int mjpeg_server_set_tls(mjpeg_server_t *obj, const char *cert, const char *key);
+// 큰 프레임 본문을 MSG_ZEROCOPY로 전송, 완료 알림을 받을 때 까지 프레임 슬롯을 잡아 두므로
+// 느린 클라이언트가 많으면 프레임 슬롯(set_frame_slots)을 늘려야 함, start 전에 설정
+void mjpeg_server_set_zerocopy(mjpeg_server_t *obj, int enable);
+// ?adaptive=N 이 없는 스트림의 대역폭 적응, 송신 큐가 쌓이면 프레임 수와 해상도를 단계적으로 낮춤
+void mjpeg_server_set_adaptive(mjpeg_server_t *obj, int enable);
+// ?motion=N 이 없는 스트림의 움직임 게이트, threshold: 칸 평균 밝기 차이 (0: 사용 안 함, 최대 255)
+// keepalive: 변화가 없어도 프레임을 보내는 간격 (초, 0: 보내지 않음), start 전에 설정
+void mjpeg_server_set_motion(mjpeg_server_t *obj, unsigned int threshold, unsigned int keepalive);
+// /events 감시 영역, 없으면 영상 전체, start 전에 설정
+/* success: 0 */
+int mjpeg_server_add_motion_zone(mjpeg_server_t *obj, const struct mjpeg_zone *zone);
+// /events 블록 밝기 변화 기준 (기본값: 16)
+void mjpeg_server_set_motion_sensitivity(mjpeg_server_t *obj, unsigned int level);
+/* success: 0, before start only */
+int mjpeg_server_set_frame_slots(mjpeg_server_t *obj, unsigned int count);
+
 /* success: 0 */
 int mjpeg_server_start(mjpeg_server_t *obj);
 void mjpeg_server_stop(mjpeg_server_t *obj);
 
-void mjpeg_server_post(mjpeg_server_t *obj, char *buffer, unsigned int length);
+// timestamp: 캡처 시각 (CLOCK_MONOTONIC, ns), sequence: 프레임 소스가 붙인 번호
+void mjpeg_server_post(mjpeg_server_t *obj, const char *buffer, unsigned int length, uint64_t timestamp, uint64_t sequence);
+
+// 프레임 소스가 부호화한 경우 post 전에 호출, 캡처 스레드에서만 호출
+void mjpeg_server_add_encode_time(mjpeg_server_t *obj, uint64_t duration);
+
+void mjpeg_server_get_stats(mjpeg_server_t *obj, struct mjpeg_server_stats *stats);
+void mjpeg_server_log_stats(mjpeg_server_t *obj);
+// p: 0 ~ 100, 해당 버킷의 상한 (us 또는 bytes)
+uint64_t mjpeg_histogram_percentile(const struct mjpeg_histogram *histogram, double p);
 
 #endif
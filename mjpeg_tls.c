@@ -0,0 +1,308 @@
+#include "mjpeg_tls.h"
+#include "logging.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+#ifdef MJPEG_TLS
+
+#include <signal.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+struct mjpeg_tls
+{
+    SSL_CTX *ctx;
+};
+
+struct mjpeg_tls_session
+{
+    SSL *ssl;
+    int ktls;
+};
+
+static void log_errors(const char *what)
+{
+    unsigned long error = ERR_get_error();
+
+    if (error == 0)
+    {
+        logging("mjpeg tls %s failed", what);
+    }
+    for (; error; error = ERR_get_error())
+    {
+        char text[256];
+
+        ERR_error_string_n(error, text, sizeof(text));
+        logging("mjpeg tls %s failed: %s", what, text);
+    }
+}
+
+mjpeg_tls_t *mjpeg_tls_create(const char *cert, const char *key)
+{
+    mjpeg_tls_t *obj = malloc(sizeof(*obj));
+
+    if (obj == 0)
+    {
+        return 0;
+    }
+    obj->ctx = SSL_CTX_new(TLS_server_method());
+    if (obj->ctx == 0)
+    {
+        log_errors("context");
+        free(obj);
+        return 0;
+    }
+    SSL_CTX_set_min_proto_version(obj->ctx, TLS1_2_VERSION);
+    // 핸드셰이크 후 커널이 지원하는 암호(AES-GCM 등)이면 송신을 커널 TLS로 넘김
+    SSL_CTX_set_options(obj->ctx, SSL_OP_ENABLE_KTLS);
+    // 커널 TLS를 쓰지 못하면 SSL_write로 전송, sendmsg처럼 부분 전송 후 남은 위치부터 다시 호출
+    SSL_CTX_set_mode(obj->ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+    if (SSL_CTX_use_certificate_chain_file(obj->ctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey_file(obj->ctx, key, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(obj->ctx) != 1)
+    {
+        log_errors("certificate");
+        SSL_CTX_free(obj->ctx);
+        free(obj);
+        return 0;
+    }
+    // OpenSSL은 소켓에 write를 쓰므로 끊긴 연결에 보내도 프로세스가 종료되지 않도록 함 (서버는 MSG_NOSIGNAL)
+    signal(SIGPIPE, SIG_IGN);
+    return obj;
+}
+
+void mjpeg_tls_destroy(mjpeg_tls_t *obj)
+{
+    if (obj == 0)
+    {
+        return;
+    }
+    SSL_CTX_free(obj->ctx);
+    free(obj);
+}
+
+mjpeg_tls_session_t *mjpeg_tls_session_create(mjpeg_tls_t *obj, int sock)
+{
+    mjpeg_tls_session_t *session = malloc(sizeof(*session));
+
+    if (session == 0)
+    {
+        return 0;
+    }
+    session->ktls = 0;
+    session->ssl = SSL_new(obj->ctx);
+    if (session->ssl == 0 || SSL_set_fd(session->ssl, sock) != 1)
+    {
+        log_errors("session");
+        SSL_free(session->ssl);
+        free(session);
+        return 0;
+    }
+    SSL_set_accept_state(session->ssl);
+    return session;
+}
+
+void mjpeg_tls_session_destroy(mjpeg_tls_session_t *session)
+{
+    if (session == 0)
+    {
+        return;
+    }
+    // close_notify는 보내지 않음, 스트림은 연결 종료로 끝남
+    SSL_free(session->ssl);
+    free(session);
+}
+
+int mjpeg_tls_handshake(mjpeg_tls_session_t *session)
+{
+    ERR_clear_error();
+
+    int ret = SSL_do_handshake(session->ssl);
+
+    if (ret == 1)
+    {
+        session->ktls = BIO_get_ktls_send(SSL_get_wbio(session->ssl)) != 0;
+        return 0;
+    }
+
+    int error = SSL_get_error(session->ssl, ret);
+
+    if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+    {
+        return 1;
+    }
+    log_errors("handshake");
+    return -1;
+}
+
+int mjpeg_tls_ktls(mjpeg_tls_session_t *session)
+{
+    return session->ktls;
+}
+
+const char *mjpeg_tls_version(mjpeg_tls_session_t *session)
+{
+    return SSL_get_version(session->ssl);
+}
+
+const char *mjpeg_tls_cipher(mjpeg_tls_session_t *session)
+{
+    return SSL_get_cipher_name(session->ssl);
+}
+
+ssize_t mjpeg_tls_read(mjpeg_tls_session_t *session, void *buffer, size_t length)
+{
+    size_t read = 0;
+
+    ERR_clear_error();
+
+    int ret = SSL_read_ex(session->ssl, buffer, length, &read);
+
+    if (ret == 1)
+    {
+        return read;
+    }
+
+    int error = SSL_get_error(session->ssl, ret);
+
+    if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (error == SSL_ERROR_ZERO_RETURN || (error == SSL_ERROR_SYSCALL && errno == 0))
+    {
+        return 0;
+    }
+    if (error != SSL_ERROR_SYSCALL)
+    {
+        errno = EIO;
+    }
+    return -1;
+}
+
+ssize_t mjpeg_tls_writev(mjpeg_tls_session_t *session, const struct iovec *iov, int count)
+{
+    ssize_t total = 0;
+
+    ERR_clear_error();
+
+    // iovec 항목마다 레코드를 만듦, 부분 전송 모드의 SSL_write는 레코드(16KB) 하나마다 반환하므로
+    // 소켓 버퍼가 찰 때까지 이어서 호출
+    for (int i = 0; i < count; i++)
+    {
+        size_t offset = 0;
+
+        while (offset < iov[i].iov_len)
+        {
+            size_t written = 0;
+
+            if (SSL_write_ex(session->ssl, (const char *)iov[i].iov_base + offset, iov[i].iov_len - offset, &written) == 1)
+            {
+                offset += written;
+                total += written;
+                continue;
+            }
+
+            int error = SSL_get_error(session->ssl, 0);
+
+            if (total)
+            {
+                return total;
+            }
+            if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+            {
+                errno = EAGAIN;
+            }
+            else if (error != SSL_ERROR_SYSCALL || errno == 0)
+            {
+                errno = EIO;
+            }
+            return -1;
+        }
+    }
+    return total;
+}
+
+#else
+
+// OpenSSL 없이 빌드하면 TLS를 설정할 수 없음, 세션 함수는 호출되지 않음
+
+mjpeg_tls_t *mjpeg_tls_create(const char *cert, const char *key)
+{
+    (void)cert;
+    (void)key;
+
+    logging("mjpeg tls: built without OpenSSL");
+    return 0;
+}
+
+void mjpeg_tls_destroy(mjpeg_tls_t *obj)
+{
+    (void)obj;
+}
+
+mjpeg_tls_session_t *mjpeg_tls_session_create(mjpeg_tls_t *obj, int sock)
+{
+    (void)obj;
+    (void)sock;
+
+    return 0;
+}
+
+void mjpeg_tls_session_destroy(mjpeg_tls_session_t *session)
+{
+    (void)session;
+}
+
+int mjpeg_tls_handshake(mjpeg_tls_session_t *session)
+{
+    (void)session;
+
+    return -1;
+}
+
+int mjpeg_tls_ktls(mjpeg_tls_session_t *session)
+{
+    (void)session;
+
+    return 0;
+}
+
+const char *mjpeg_tls_version(mjpeg_tls_session_t *session)
+{
+    (void)session;
+
+    return "";
+}
+
+const char *mjpeg_tls_cipher(mjpeg_tls_session_t *session)
+{
+    (void)session;
+
+    return "";
+}
+
+ssize_t mjpeg_tls_read(mjpeg_tls_session_t *session, void *buffer, size_t length)
+{
+    (void)session;
+    (void)buffer;
+    (void)length;
+
+    errno = EIO;
+    return -1;
+}
+
+ssize_t mjpeg_tls_writev(mjpeg_tls_session_t *session, const struct iovec *iov, int count)
+{
+    (void)session;
+    (void)iov;
+    (void)count;
+
+    errno = EIO;
+    return -1;
+}
+
+#endif
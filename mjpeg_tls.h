@@ -0,0 +1,39 @@
+#ifndef MJPEG_TLS_H
+#define MJPEG_TLS_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct mjpeg_tls;
+typedef struct mjpeg_tls mjpeg_tls_t;
+
+struct mjpeg_tls_session;
+typedef struct mjpeg_tls_session mjpeg_tls_session_t;
+
+// 인증서(체인)와 키 PEM 파일로 서버 컨텍스트 생성, OpenSSL 없이 빌드했으면 항상 실패
+/* failed: 0 */
+mjpeg_tls_t *mjpeg_tls_create(const char *cert, const char *key);
+void mjpeg_tls_destroy(mjpeg_tls_t *obj);
+
+// accept한 논블로킹 소켓에 세션 연결, 소켓은 닫지 않음
+/* failed: 0 */
+mjpeg_tls_session_t *mjpeg_tls_session_create(mjpeg_tls_t *obj, int sock);
+void mjpeg_tls_session_destroy(mjpeg_tls_session_t *session);
+
+// 소켓 이벤트마다 호출
+/* done: 0, would block: 1, failed: -1 */
+int mjpeg_tls_handshake(mjpeg_tls_session_t *session);
+// 핸드셰이크 후 송신을 커널 TLS(TCP_ULP tls)로 넘겼으면 1
+// 이후 소켓에 평문을 sendmsg 하면 커널이 레코드로 암호화하여 전송
+int mjpeg_tls_ktls(mjpeg_tls_session_t *session);
+// 협상한 프로토콜, 암호 이름
+const char *mjpeg_tls_version(mjpeg_tls_session_t *session);
+const char *mjpeg_tls_cipher(mjpeg_tls_session_t *session);
+
+// recv와 같은 결과, 읽을 데이터가 없으면 -1 (errno: EAGAIN)
+ssize_t mjpeg_tls_read(mjpeg_tls_session_t *session, void *buffer, size_t length);
+// 커널 TLS를 쓰지 못하는 세션의 송신, sendmsg와 같은 결과 (부분 전송 가능)
+// would block 이후에는 남은 데이터로 다시 호출
+ssize_t mjpeg_tls_writev(mjpeg_tls_session_t *session, const struct iovec *iov, int count);
+
+#endif
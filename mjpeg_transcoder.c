@@ -0,0 +1,534 @@
+#include "mjpeg_transcoder.h"
+#include "mjpeg_motion.h"
+#include "jpeg_decoder.h"
+#include "jpeg_encoder.h"
+#include "logging.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+struct mjpeg_transcoder_slot
+{
+    struct mjpeg_variant variant;
+    int used;
+    // 다른 설정으로 재사용할 때마다 증가, 변환 중에 재사용된 슬롯에는 게시하지 않음
+    unsigned int generation;
+    atomic_int subscribers;
+
+    // 마지막으로 변환한 원본 번호, 변환 스레드에서만 사용
+    uint64_t source;
+    // 파생 프레임 번호, 클라이언트는 원본과 같은 방식으로 번호를 비교하여 새 프레임 확인
+    uint64_t sequence;
+    // semaphore로 보호
+    struct mjpeg_frame *frame;
+};
+
+struct mjpeg_transcoder
+{
+    mjpeg_frame_pool_t *pool;
+    int quality;
+    mjpeg_transcoder_callback_t published;
+    mjpeg_transcoder_frame_callback_t analysed_callback;
+    void *opaque;
+
+    int stop;
+    int running;
+    pthread_t thread;
+    // 깨우기 요청이 쌓이지 않도록 pending이 0 -> 1 일 때만 post
+    sem_t wakeup;
+    atomic_int pending;
+    // 전체 구독자 수, 0이면 원본이 게시되어도 깨우지 않음
+    atomic_int subscribers;
+
+    // source, analysed, slots[].used/variant/frame 보호
+    sem_t semaphore;
+    struct mjpeg_frame *source;
+    struct mjpeg_frame *analysed;
+    struct mjpeg_transcoder_slot slots[MJPEG_TRANSCODER_MAX_VARIANTS];
+
+    // 변환 스레드에서만 사용
+    jpeg_decoder_t *decoder;
+    jpeg_encoder_t *encoder;
+    mjpeg_motion_t *motion;
+    int failing;
+
+    struct mjpeg_transcoder_stats stats;
+};
+
+static void mjpeg_transcoder_kick(mjpeg_transcoder_t *obj)
+{
+    if (atomic_exchange(&obj->pending, 1) == 0)
+    {
+        sem_post(&obj->wakeup);
+    }
+}
+
+/* success: 0 */
+static int mjpeg_transcoder_publish(mjpeg_transcoder_t *obj, int index, unsigned int generation, struct mjpeg_frame *source, const void *data, size_t length)
+{
+    struct mjpeg_transcoder_slot *slot = &obj->slots[index];
+    struct mjpeg_frame *frame = mjpeg_frame_pool_acquire(obj->pool, length);
+
+    if (frame == 0)
+    {
+        stats_add(&obj->stats.frames_discarded, 1);
+        return 1;
+    }
+    memcpy(frame->data, data, length);
+    frame->length = length;
+    frame->source_sequence = source->source_sequence;
+    frame->timestamp = source->timestamp;
+    // 같은 장면이므로 움직임 판단은 원본 격자를 그대로 사용, 원본은 변환 전에 분석을 마침
+    if (atomic_load_explicit(&source->motion_state, memory_order_acquire) == MJPEG_FRAME_MOTION_VALID)
+    {
+        memcpy(frame->motion, source->motion, sizeof(frame->motion));
+        atomic_store_explicit(&frame->motion_state, MJPEG_FRAME_MOTION_VALID, memory_order_relaxed);
+    }
+    mjpeg_frame_build_head(frame);
+    frame->published = stats_now();
+
+    sem_wait(&obj->semaphore);
+    struct mjpeg_frame *prev = frame;
+
+    if (slot->generation == generation)
+    {
+        prev = slot->frame;
+        frame->sequence = ++slot->sequence;
+        slot->frame = frame;
+    }
+    sem_post(&obj->semaphore);
+
+    mjpeg_frame_unref(prev);
+    return 0;
+}
+
+// 계수 단계(잘라내기, 밝기 전용)를 먼저 하고, 축소가 필요한 스트림은 결과를 원본별로 한번씩 복원
+// discarded: 빈 슬롯이 없어 게시하지 못한 파생 스트림이 있으면 1
+/* success: 0 */
+static int mjpeg_transcoder_convert(mjpeg_transcoder_t *obj, struct mjpeg_frame *source, const int *active, const unsigned int *generations, const struct mjpeg_variant *variants, int count, int *discarded)
+{
+    struct jpeg_decoder_rewrite rewrites[JPEG_DECODER_MAX_REWRITES];
+    struct jpeg_decoder_output outputs[JPEG_DECODER_MAX_OUTPUTS];
+    int groups[MJPEG_TRANSCODER_MAX_VARIANTS];
+    int targets[MJPEG_TRANSCODER_MAX_VARIANTS];
+    int rewrite_count = 0;
+
+    // 같은 영역/성분은 한번만 다시 부호화, -1: 원본
+    for (int i = 0; i < count; i++)
+    {
+        const struct mjpeg_variant *variant = &variants[i];
+
+        groups[i] = -1;
+        if (variant->crop.width == 0 && variant->gray == 0)
+        {
+            continue;
+        }
+        int group = 0;
+
+        while (group < rewrite_count && !(rewrites[group].x == variant->crop.x && rewrites[group].y == variant->crop.y &&
+            rewrites[group].width == variant->crop.width && rewrites[group].height == variant->crop.height &&
+            rewrites[group].gray == variant->gray))
+        {
+            group++;
+        }
+        if (group == rewrite_count)
+        {
+            memset(&rewrites[group], 0, sizeof(rewrites[group]));
+            rewrites[group].x = variant->crop.x;
+            rewrites[group].y = variant->crop.y;
+            rewrites[group].width = variant->crop.width;
+            rewrites[group].height = variant->crop.height;
+            rewrites[group].gray = variant->gray;
+            rewrite_count++;
+        }
+        groups[i] = group;
+    }
+    if (rewrite_count && jpeg_decoder_rewrite(obj->decoder, source->data, source->length, rewrites, rewrite_count))
+    {
+        return 1;
+    }
+
+    for (int group = -1; group < rewrite_count; group++)
+    {
+        const void *data = group < 0 ? source->data : rewrites[group].data;
+        size_t length = group < 0 ? source->length : rewrites[group].length;
+        int output_count = 0;
+
+        // 같은 크기는 한번만 복원
+        for (int i = 0; i < count; i++)
+        {
+            if (groups[i] != group || variants[i].scale <= 1)
+            {
+                continue;
+            }
+            int target = 0;
+
+            while (target < output_count && outputs[target].scale != variants[i].scale)
+            {
+                target++;
+            }
+            if (target == output_count)
+            {
+                outputs[output_count++].scale = variants[i].scale;
+            }
+            targets[i] = target;
+        }
+        if (output_count && jpeg_decoder_decode(obj->decoder, data, length, outputs, output_count))
+        {
+            return 1;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            if (groups[i] != group)
+            {
+                continue;
+            }
+            if (variants[i].scale <= 1)
+            {
+                // 축소하지 않는 스트림은 계수 단계 결과를 그대로 게시
+                *discarded |= mjpeg_transcoder_publish(obj, active[i], generations[i], source, data, length);
+                continue;
+            }
+            struct jpeg_decoder_output *output = &outputs[targets[i]];
+            const void *encoded;
+            size_t encoded_length;
+
+            int failed = variants[i].gray ?
+                jpeg_encoder_encode_gray(obj->encoder, output->yuyv, output->width, output->height, output->stride, &encoded, &encoded_length) :
+                jpeg_encoder_encode_yuyv(obj->encoder, output->yuyv, output->width, output->height, output->stride, &encoded, &encoded_length);
+
+            if (failed)
+            {
+                return 1;
+            }
+            // 빈 슬롯이 없으면 이번 프레임은 건너뜀
+            *discarded |= mjpeg_transcoder_publish(obj, active[i], generations[i], source, encoded, encoded_length);
+        }
+    }
+    return 0;
+}
+
+static void mjpeg_transcoder_run(mjpeg_transcoder_t *obj)
+{
+    int active[MJPEG_TRANSCODER_MAX_VARIANTS];
+    unsigned int generations[MJPEG_TRANSCODER_MAX_VARIANTS];
+    struct mjpeg_variant variants[MJPEG_TRANSCODER_MAX_VARIANTS];
+    struct mjpeg_frame *idle[MJPEG_TRANSCODER_MAX_VARIANTS];
+    int active_count = 0;
+    int idle_count = 0;
+
+    sem_wait(&obj->semaphore);
+    struct mjpeg_frame *source = mjpeg_frame_ref(obj->source);
+
+    for (int i = 0; i < MJPEG_TRANSCODER_MAX_VARIANTS; i++)
+    {
+        struct mjpeg_transcoder_slot *slot = &obj->slots[i];
+
+        if (slot->used == 0)
+        {
+            continue;
+        }
+        if (atomic_load(&slot->subscribers) == 0)
+        {
+            // 구독자가 없으면 슬롯을 비워 풀로 반환
+            if (slot->frame)
+            {
+                idle[idle_count++] = slot->frame;
+                slot->frame = 0;
+            }
+            continue;
+        }
+        if (source == 0 || slot->source >= source->sequence)
+        {
+            continue;
+        }
+        slot->source = source->sequence;
+        variants[active_count] = slot->variant;
+        generations[active_count] = slot->generation;
+        active[active_count++] = i;
+    }
+    sem_post(&obj->semaphore);
+
+    for (int i = 0; i < idle_count; i++)
+    {
+        mjpeg_frame_unref(idle[i]);
+    }
+
+    // 캡처 스레드 대신 여기서 분석, 게이트를 쓰는 클라이언트는 격자가 채워질 때까지 기다림
+    int analysed = source && atomic_load_explicit(&source->motion_state, memory_order_relaxed) == MJPEG_FRAME_MOTION_PENDING;
+
+    if (analysed)
+    {
+        mjpeg_motion_update(obj->motion, source);
+
+        sem_wait(&obj->semaphore);
+        struct mjpeg_frame *prev = obj->analysed;
+        obj->analysed = mjpeg_frame_ref(source);
+        sem_post(&obj->semaphore);
+
+        mjpeg_frame_unref(prev);
+
+        if (obj->analysed_callback)
+        {
+            obj->analysed_callback(obj->opaque, source);
+        }
+    }
+    if (active_count == 0)
+    {
+        mjpeg_frame_unref(source);
+        if (analysed && obj->published)
+        {
+            obj->published(obj->opaque);
+        }
+        return;
+    }
+
+    uint64_t start = stats_now();
+    int discarded = 0;
+    int failed = mjpeg_transcoder_convert(obj, source, active, generations, variants, active_count, &discarded);
+
+    if (failed)
+    {
+        if (obj->failing == 0)
+        {
+            logging("mjpeg transcode failed (sequence: %llu, bytes: %u)", (unsigned long long)source->source_sequence, source->length);
+        }
+        stats_add(&obj->stats.frames_failed, 1);
+    }
+    else
+    {
+        // 건너뛴 파생 스트림이 있으면 frames_discarded에만 셈
+        if (discarded == 0)
+        {
+            stats_add(&obj->stats.frames_transcoded, 1);
+        }
+        stats_histogram_add(&obj->stats.duration, stats_now() - start);
+    }
+    obj->failing = failed;
+    mjpeg_frame_unref(source);
+
+    // 실패해도 앞서 게시한 스트림이 있을 수 있음
+    if (obj->published)
+    {
+        obj->published(obj->opaque);
+    }
+}
+
+static void *mjpeg_transcoder_main(void *args)
+{
+    mjpeg_transcoder_t *obj = args;
+
+    while (1)
+    {
+        sem_wait(&obj->wakeup);
+        if (obj->stop)
+        {
+            break;
+        }
+        atomic_store(&obj->pending, 0);
+        mjpeg_transcoder_run(obj);
+    }
+    return 0;
+}
+
+mjpeg_transcoder_t *mjpeg_transcoder_create(int quality, mjpeg_transcoder_callback_t published, mjpeg_transcoder_frame_callback_t analysed, void *opaque)
+{
+    mjpeg_transcoder_t *obj = malloc(sizeof(*obj));
+
+    if (obj == 0)
+    {
+        return 0;
+    }
+    memset(obj, 0, sizeof(*obj));
+    obj->pool = mjpeg_frame_pool_create(MJPEG_TRANSCODER_FRAMES);
+    if (obj->pool == 0)
+    {
+        free(obj);
+        return 0;
+    }
+    obj->quality = quality;
+    obj->published = published;
+    obj->analysed_callback = analysed;
+    obj->opaque = opaque;
+    sem_init(&obj->wakeup, 0, 0);
+    sem_init(&obj->semaphore, 0, 1);
+    atomic_init(&obj->pending, 0);
+    atomic_init(&obj->subscribers, 0);
+    for (int i = 0; i < MJPEG_TRANSCODER_MAX_VARIANTS; i++)
+    {
+        atomic_init(&obj->slots[i].subscribers, 0);
+    }
+    return obj;
+}
+
+void mjpeg_transcoder_destroy(mjpeg_transcoder_t *obj)
+{
+    if (obj == 0)
+    {
+        return;
+    }
+    mjpeg_transcoder_stop(obj);
+    sem_destroy(&obj->wakeup);
+    sem_destroy(&obj->semaphore);
+    mjpeg_frame_pool_destroy(obj->pool);
+    free(obj);
+}
+
+/* success: 0 */
+int mjpeg_transcoder_start(mjpeg_transcoder_t *obj)
+{
+    if (obj->running)
+    {
+        return 1;
+    }
+    // 파생 스트림은 작으므로 인코더는 변환 스레드 하나로 충분
+    obj->decoder = jpeg_decoder_create();
+    obj->encoder = jpeg_encoder_create(obj->quality, 1);
+    obj->motion = mjpeg_motion_create();
+    obj->stop = 0;
+    obj->failing = 0;
+    if (obj->decoder == 0 || obj->encoder == 0 || obj->motion == 0 || pthread_create(&obj->thread, 0, mjpeg_transcoder_main, obj))
+    {
+        mjpeg_transcoder_stop(obj);
+        return 1;
+    }
+    obj->running = 1;
+
+    // 시작 전에 구독한 스트림이 있으면 바로 변환
+    if (atomic_load(&obj->subscribers))
+    {
+        mjpeg_transcoder_kick(obj);
+    }
+    return 0;
+}
+
+void mjpeg_transcoder_stop(mjpeg_transcoder_t *obj)
+{
+    if (obj->running)
+    {
+        obj->stop = 1;
+        sem_post(&obj->wakeup);
+        pthread_join(obj->thread, 0);
+        obj->running = 0;
+    }
+    jpeg_decoder_destroy(obj->decoder);
+    jpeg_encoder_destroy(obj->encoder);
+    mjpeg_motion_destroy(obj->motion);
+    obj->decoder = 0;
+    obj->encoder = 0;
+    obj->motion = 0;
+
+    sem_wait(&obj->semaphore);
+    mjpeg_frame_unref(obj->source);
+    mjpeg_frame_unref(obj->analysed);
+    obj->source = 0;
+    obj->analysed = 0;
+    for (int i = 0; i < MJPEG_TRANSCODER_MAX_VARIANTS; i++)
+    {
+        mjpeg_frame_unref(obj->slots[i].frame);
+        obj->slots[i].frame = 0;
+        obj->slots[i].source = 0;
+    }
+    sem_post(&obj->semaphore);
+}
+
+/* failed: -1 */
+int mjpeg_transcoder_subscribe(mjpeg_transcoder_t *obj, const struct mjpeg_variant *variant)
+{
+    int index = -1;
+    int reuse = -1;
+
+    sem_wait(&obj->semaphore);
+    for (int i = 0; i < MJPEG_TRANSCODER_MAX_VARIANTS && index < 0; i++)
+    {
+        struct mjpeg_transcoder_slot *slot = &obj->slots[i];
+
+        if (slot->used && memcmp(&slot->variant, variant, sizeof(*variant)) == 0)
+        {
+            index = i;
+        }
+        else if (reuse < 0 && (slot->used == 0 || atomic_load(&slot->subscribers) == 0))
+        {
+            reuse = i;
+        }
+    }
+    if (index < 0 && reuse >= 0)
+    {
+        struct mjpeg_transcoder_slot *slot = &obj->slots[reuse];
+
+        // 번호(sequence)는 이어서 사용, 리액터에 남은 이전 설정의 프레임보다 항상 큼
+        mjpeg_frame_unref(slot->frame);
+        slot->frame = 0;
+        slot->source = 0;
+        slot->generation++;
+        slot->variant = *variant;
+        slot->used = 1;
+        index = reuse;
+    }
+    // 재사용 판단과 같은 잠금 안에서 증가
+    if (index >= 0)
+    {
+        atomic_fetch_add(&obj->slots[index].subscribers, 1);
+        atomic_fetch_add(&obj->subscribers, 1);
+    }
+    sem_post(&obj->semaphore);
+
+    // 다음 원본을 기다리지 않고 최신 원본으로 바로 변환
+    if (index >= 0 && obj->running)
+    {
+        mjpeg_transcoder_kick(obj);
+    }
+    return index;
+}
+
+void mjpeg_transcoder_unsubscribe(mjpeg_transcoder_t *obj, int index)
+{
+    atomic_fetch_sub(&obj->subscribers, 1);
+
+    // 마지막 구독자면 변환 스레드에서 프레임 반환
+    if (atomic_fetch_sub(&obj->slots[index].subscribers, 1) == 1 && obj->running)
+    {
+        mjpeg_transcoder_kick(obj);
+    }
+}
+
+void mjpeg_transcoder_post(mjpeg_transcoder_t *obj, struct mjpeg_frame *frame)
+{
+    sem_wait(&obj->semaphore);
+    struct mjpeg_frame *prev = obj->source;
+    obj->source = mjpeg_frame_ref(frame);
+    sem_post(&obj->semaphore);
+
+    mjpeg_frame_unref(prev);
+
+    if ((atomic_load(&obj->subscribers) || atomic_load_explicit(&frame->motion_state, memory_order_relaxed) == MJPEG_FRAME_MOTION_PENDING) && obj->running)
+    {
+        mjpeg_transcoder_kick(obj);
+    }
+}
+
+struct mjpeg_frame *mjpeg_transcoder_get_frame(mjpeg_transcoder_t *obj, int index)
+{
+    sem_wait(&obj->semaphore);
+    struct mjpeg_frame *frame = mjpeg_frame_ref(obj->slots[index].frame);
+    sem_post(&obj->semaphore);
+
+    return frame;
+}
+
+struct mjpeg_frame *mjpeg_transcoder_get_analysed(mjpeg_transcoder_t *obj)
+{
+    sem_wait(&obj->semaphore);
+    struct mjpeg_frame *frame = mjpeg_frame_ref(obj->analysed);
+    sem_post(&obj->semaphore);
+
+    return frame;
+}
+
+struct mjpeg_transcoder_stats *mjpeg_transcoder_get_stats(mjpeg_transcoder_t *obj)
+{
+    return &obj->stats;
+}
@@ -0,0 +1,78 @@
+#ifndef MJPEG_TRANSCODER_H
+#define MJPEG_TRANSCODER_H
+
+#include <stdint.h>
+
+#include "mjpeg_frame.h"
+#include "stats.h"
+
+struct mjpeg_transcoder;
+typedef struct mjpeg_transcoder mjpeg_transcoder_t;
+
+#define MJPEG_TRANSCODER_MAX_VARIANTS 8
+// 파생 프레임 풀 크기, 파생 스트림마다 게시 중 1 + 리액터/전송 중인 이전 프레임
+#define MJPEG_TRANSCODER_FRAMES (MJPEG_TRANSCODER_MAX_VARIANTS * 4)
+
+// 원본 프레임에서 만드는 파생 스트림 설정, 같은 설정을 요청한 클라이언트는 결과를 공유
+// 비교는 memcmp이므로 memset 후 설정
+struct mjpeg_variant
+{
+    // 1/scale 크기: 1, 2, 4, 8
+    unsigned int scale;
+    // 잘라낼 영역 (픽셀), width 0: 자르지 않음
+    // DCT 계수 그대로 MCU 단위로 잘라내므로 시작 위치는 MCU 경계로 내림 (jpeg_decoder_rewrite)
+    struct
+    {
+        unsigned int x;
+        unsigned int y;
+        unsigned int width;
+        unsigned int height;
+    } crop;
+    // 색차 성분을 버린 밝기 전용 스트림, 계수 단계에서 처리하고 축소하면 단일 성분으로 다시 부호화
+    int gray;
+};
+
+// 변환 스레드에서만 증가
+struct mjpeg_transcoder_stats
+{
+    stats_counter_t frames_transcoded;
+    stats_counter_t frames_failed;
+    // 파생 프레임 풀에 빈 슬롯이 없어 게시하지 못한 파생 프레임 수 (느린 클라이언트가 이전 프레임을 잡고 있음)
+    stats_counter_t frames_discarded;
+    // 원본 한 장을 구독 중인 모든 파생 스트림으로 변환하는 시간 (잘라내기 포함)
+    struct stats_histogram duration;
+};
+
+typedef void (*mjpeg_transcoder_callback_t)(void *opaque);
+typedef void (*mjpeg_transcoder_frame_callback_t)(void *opaque, struct mjpeg_frame *frame);
+
+// 파생 프레임은 원본 풀을 차지하지 않도록 별도 풀에서 할당
+// published: 파생 프레임을 게시할 때마다 변환 스레드에서 호출
+// analysed: 원본의 움직임 분석을 마칠 때마다 (실패 포함) 변환 스레드에서 호출, frame은 호출 중에만 참조 보장
+mjpeg_transcoder_t *mjpeg_transcoder_create(int quality, mjpeg_transcoder_callback_t published, mjpeg_transcoder_frame_callback_t analysed, void *opaque);
+// 파생 프레임의 참조가 모두 해제된 후 호출
+void mjpeg_transcoder_destroy(mjpeg_transcoder_t *obj);
+
+/* success: 0 */
+int mjpeg_transcoder_start(mjpeg_transcoder_t *obj);
+// 가지고 있는 프레임 참조를 모두 해제
+void mjpeg_transcoder_stop(mjpeg_transcoder_t *obj);
+
+// 같은 설정의 파생 스트림을 구독, 없으면 추가 (구독자가 없는 슬롯 재사용)
+// 구독자가 있는 파생 스트림만 변환
+/* failed: -1, 성공하면 파생 스트림 번호 */
+int mjpeg_transcoder_subscribe(mjpeg_transcoder_t *obj, const struct mjpeg_variant *variant);
+void mjpeg_transcoder_unsubscribe(mjpeg_transcoder_t *obj, int index);
+
+// 원본 프레임이 게시될 때마다 호출, 변환이 밀리면 가장 최신 원본만 변환
+// 원본의 motion_state가 PENDING이면 변환 전에 움직임 격자를 계산하고 published 호출 (구독자가 없어도)
+void mjpeg_transcoder_post(mjpeg_transcoder_t *obj, struct mjpeg_frame *frame);
+// 파생 스트림의 최신 프레임 참조, 없으면 0
+struct mjpeg_frame *mjpeg_transcoder_get_frame(mjpeg_transcoder_t *obj, int index);
+// 마지막으로 움직임을 분석한 원본 프레임 참조, 없으면 0
+// 최신 원본이 분석 중일 때 게이트를 쓰는 클라이언트가 대신 사용
+struct mjpeg_frame *mjpeg_transcoder_get_analysed(mjpeg_transcoder_t *obj);
+
+struct mjpeg_transcoder_stats *mjpeg_transcoder_get_stats(mjpeg_transcoder_t *obj);
+
+#endif
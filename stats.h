@@ -0,0 +1,67 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// 한 스레드에서만 증가시키고 다른 스레드에서는 읽기만 하는 카운터
+// lock 접두사가 붙는 atomic 연산 없이 일반 load/store로 컴파일 됨
+typedef _Atomic uint64_t stats_counter_t;
+
+static inline void stats_add(stats_counter_t *counter, uint64_t value)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static inline uint64_t stats_get(stats_counter_t *counter)
+{
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+// log2 버킷 히스토그램, 버킷 i: [2^(i-1), 2^i), 버킷 0: 1 미만
+#define STATS_HISTOGRAM_BUCKETS 32
+
+struct stats_histogram
+{
+    stats_counter_t count;
+    stats_counter_t sum;
+    stats_counter_t bucket[STATS_HISTOGRAM_BUCKETS];
+};
+
+static inline void stats_histogram_insert(struct stats_histogram *histogram, uint64_t key, uint64_t value)
+{
+    int index = key ? 64 - __builtin_clzll(key) : 0;
+
+    if (index >= STATS_HISTOGRAM_BUCKETS)
+    {
+        index = STATS_HISTOGRAM_BUCKETS - 1;
+    }
+    stats_add(&histogram->bucket[index], 1);
+    stats_add(&histogram->count, 1);
+    stats_add(&histogram->sum, value);
+}
+
+// 시간: 버킷은 us 단위, 합계는 ns
+static inline void stats_histogram_add(struct stats_histogram *histogram, uint64_t ns)
+{
+    stats_histogram_insert(histogram, ns / 1000, ns);
+}
+
+// 크기 등 값 그대로
+static inline void stats_histogram_add_value(struct stats_histogram *histogram, uint64_t value)
+{
+    stats_histogram_insert(histogram, value, value);
+}
+
+// CLOCK_MONOTONIC, ns
+static inline uint64_t stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include "v4l2_client.h"
 #include "logging.h"
+#include "stats.h"
 
 #include <poll.h>
 #include <errno.h>
@@ -15,10 +16,26 @@
 #include <sys/eventfd.h>
 #include <linux/videodev2.h>
 
+#define DEFAULT_BUFFER_COUNT 4
+
 struct v4l2_client
 {
     char *device;
 
+    // 요청 값, 실제 값은 open 시 협상
+    unsigned int width;
+    unsigned int height;
+    uint32_t format;
+    unsigned int fps;
+    unsigned int buffer_count;
+    // 준비된 버퍼를 모두 꺼내 가장 최신 것만 전달
+    int latest;
+
+    // open 시 협상된 값
+    unsigned int frame_width;
+    unsigned int frame_height;
+    unsigned int frame_stride;
+
     int stop;
     int event;
     int fd;
@@ -29,6 +46,15 @@ struct v4l2_client
     unsigned int *buf_len;
     unsigned int buf_index;
     unsigned int buf_bytes;
+    uint32_t buf_sequence;
+    uint64_t buf_timestamp;
+
+    // 최신 프레임을 위해 건너뛴 프레임 수
+    stats_counter_t skipped;
+    // 드라이버가 버린 프레임 수 (sequence 건너뜀)
+    stats_counter_t dropped;
+    uint32_t last_sequence;
+    int dequeued;
 
     void *opaque;
     v4l2_client_callback_t callback;
@@ -42,6 +68,8 @@ static const char *format_name(uint32_t format)
     {
     case V4L2_PIX_FMT_MJPEG:
         return "Motion-JPEG";
+    case V4L2_PIX_FMT_JPEG:
+        return "JFIF JPEG";
     //case V4L2_PIX_FMT_VYUY:
     //    return "VYUY 4:2:2";
     case V4L2_PIX_FMT_YUYV:
@@ -179,6 +207,10 @@ v4l2_client_t *v4l2_client_create(const char *device)
     memset(obj, 0, sizeof(*obj));
     obj->fd  = -1;
     obj->event = -1;
+    obj->width = 1920;
+    obj->height = 1080;
+    obj->format = V4L2_PIX_FMT_MJPEG;
+    obj->buffer_count = DEFAULT_BUFFER_COUNT;
     obj->device = strdup(device);
     if (obj->device == 0)
     {
@@ -204,6 +236,121 @@ void v4l2_client_destroy(v4l2_client_t *obj)
     free(obj);
 }
 
+static unsigned int distance(unsigned int a, unsigned int b)
+{
+    return a > b ? a - b : b - a;
+}
+
+static unsigned int clamp_step(unsigned int value, unsigned int min, unsigned int max, unsigned int step)
+{
+    if (value < min)
+    {
+        return min;
+    }
+    if (value > max)
+    {
+        return max;
+    }
+    if (step > 1)
+    {
+        value = min + (value - min + step / 2) / step * step;
+    }
+    return value > max ? max : value;
+}
+
+// VIDIOC_ENUM_FRAMESIZES 중 요청 크기에 가장 가까운 크기
+static void v4l2_client_match_size(int fd, uint32_t format, unsigned int *width, unsigned int *height)
+{
+    struct v4l2_frmsizeenum vfse = { .pixel_format = format };
+    unsigned int best_width = 0;
+    unsigned int best_height = 0;
+    unsigned int best = ~0u;
+
+    while (ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &vfse) == 0)
+    {
+        unsigned int w;
+        unsigned int h;
+
+        if (vfse.type == V4L2_FRMSIZE_TYPE_DISCRETE)
+        {
+            w = vfse.discrete.width;
+            h = vfse.discrete.height;
+        }
+        else
+        {
+            w = clamp_step(*width, vfse.stepwise.min_width, vfse.stepwise.max_width, vfse.stepwise.step_width);
+            h = clamp_step(*height, vfse.stepwise.min_height, vfse.stepwise.max_height, vfse.stepwise.step_height);
+        }
+
+        unsigned int score = distance(w, *width) + distance(h, *height);
+
+        if (score < best)
+        {
+            best = score;
+            best_width = w;
+            best_height = h;
+        }
+        if (vfse.type != V4L2_FRMSIZE_TYPE_DISCRETE)
+        {
+            break;
+        }
+        vfse.index++;
+    }
+    if (best != ~0u)
+    {
+        *width = best_width;
+        *height = best_height;
+    }
+}
+
+// VIDIOC_ENUM_FRAMEINTERVALS 중 요청 fps에 가장 가까운 간격
+static struct v4l2_fract v4l2_client_match_interval(int fd, uint32_t format, unsigned int width, unsigned int height, unsigned int fps)
+{
+    struct v4l2_frmivalenum vfie = { .pixel_format = format, .width = width, .height = height };
+    struct v4l2_fract best = { 1, fps };
+    double target = 1.0 / fps;
+    double best_error = -1;
+
+    while (ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &vfie) == 0)
+    {
+        if (vfie.type == V4L2_FRMIVAL_TYPE_DISCRETE)
+        {
+            struct v4l2_fract *fract = &vfie.discrete;
+
+            if (fract->denominator)
+            {
+                double error = (double)fract->numerator / fract->denominator - target;
+
+                error = error < 0 ? -error : error;
+                if (best_error < 0 || error < best_error)
+                {
+                    best_error = error;
+                    best = *fract;
+                }
+            }
+            vfie.index++;
+            continue;
+        }
+
+        struct v4l2_fract *min = &vfie.stepwise.min;
+        struct v4l2_fract *max = &vfie.stepwise.max;
+
+        if (min->denominator && max->denominator)
+        {
+            if (target < (double)min->numerator / min->denominator)
+            {
+                best = *min;
+            }
+            else if (target > (double)max->numerator / max->denominator)
+            {
+                best = *max;
+            }
+        }
+        break;
+    }
+    return best;
+}
+
 /* success: 0 */
 static int v4l2_client_open(v4l2_client_t *obj)
 {
@@ -217,12 +364,18 @@ static int v4l2_client_open(v4l2_client_t *obj)
         return 1;
     }
 
-    fd = open(obj->device, O_RDWR);
+    // DQBUF는 poll로 준비를 확인한 후에만 호출
+    fd = open(obj->device, O_RDWR | O_NONBLOCK | O_CLOEXEC);
     if (fd == -1)
     {
         return 1;
     }
 
+    unsigned int width = obj->width;
+    unsigned int height = obj->height;
+
+    v4l2_client_match_size(fd, obj->format, &width, &height);
+
     struct v4l2_format fmt =
     {
         .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
@@ -230,9 +383,9 @@ static int v4l2_client_open(v4l2_client_t *obj)
         {
             .pix =
             {
-                .width = 1920,
-                .height = 1080,
-                .pixelformat = V4L2_PIX_FMT_MJPEG,
+                .width = width,
+                .height = height,
+                .pixelformat = obj->format,
                 .field = V4L2_FIELD_ANY,
             },
         },
@@ -243,17 +396,33 @@ static int v4l2_client_open(v4l2_client_t *obj)
         close(fd);
         return 1;
     }
-    if (fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_MJPEG)
+    if (fmt.fmt.pix.pixelformat != obj->format)
     {
+        logging("v4l2 pixel format not supported: %s", format_name(obj->format));
         close(fd);
         return 1;
     }
 
+    // 프레임 간격, 지원하지 않는 장치는 기본값으로 동작
+    struct v4l2_streamparm parm = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+    if (obj->fps && ioctl(fd, VIDIOC_G_PARM, &parm) == 0 && (parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME))
+    {
+        parm.parm.capture.timeperframe = v4l2_client_match_interval(fd, obj->format, fmt.fmt.pix.width, fmt.fmt.pix.height, obj->fps);
+        if (ioctl(fd, VIDIOC_S_PARM, &parm) < 0)
+        {
+            logging("v4l2 frame interval not set: %u fps", obj->fps);
+        }
+    }
+    if (ioctl(fd, VIDIOC_G_PARM, &parm) < 0)
+    {
+        memset(&parm, 0, sizeof(parm));
+    }
+
     // mmap init
     struct v4l2_requestbuffers req =
     {
         .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
-        .count = 256,
+        .count = obj->buffer_count,
         .memory = V4L2_MEMORY_MMAP,
     };
     if (ioctl(fd, VIDIOC_REQBUFS, &req) < 0)
@@ -339,10 +508,19 @@ static int v4l2_client_open(v4l2_client_t *obj)
 
     if (failed == 0)
     {
-        logging("v4l2 size: %ix%i", fmt.fmt.pix.width, fmt.fmt.pix.height);
+        struct v4l2_fract *interval = &parm.parm.capture.timeperframe;
+
+        logging("v4l2 size: %ux%u (requested: %ux%u)", fmt.fmt.pix.width, fmt.fmt.pix.height, obj->width, obj->height);
         logging("v4l2 pixel format: %s, interlaced: %c", format_name(fmt.fmt.pix.pixelformat), fmt.fmt.pix.field & V4L2_FIELD_INTERLACED ? 'Y' : 'N');
-        logging("v4l2 buffer count: %u", req.count);
+        if (interval->numerator)
+        {
+            logging("v4l2 frame interval: %u/%u (%.2f fps, requested: %u)", interval->numerator, interval->denominator, (double)interval->denominator / interval->numerator, obj->fps);
+        }
+        logging("v4l2 buffer count: %u (requested: %u)", req.count, obj->buffer_count);
 
+        obj->frame_width = fmt.fmt.pix.width;
+        obj->frame_height = fmt.fmt.pix.height;
+        obj->frame_stride = fmt.fmt.pix.bytesperline;
         obj->buf_count = req.count;
         obj->buf_start = buf_start;
         obj->buf_len = buf_len;
@@ -391,9 +569,69 @@ void v4l2_client_close(v4l2_client_t *obj)
     obj->fd = -1;
 }
 
+// CLOCK_MONOTONIC 기준이 아니면 0
+static uint64_t buffer_timestamp(const struct v4l2_buffer *buf)
+{
+    if ((buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) != V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+    {
+        return 0;
+    }
+    return (uint64_t)buf->timestamp.tv_sec * 1000000000ull + buf->timestamp.tv_usec * 1000ull;
+}
+
+static void v4l2_client_account(v4l2_client_t *obj, const struct v4l2_buffer *buf)
+{
+    if (obj->dequeued && buf->sequence > obj->last_sequence + 1)
+    {
+        stats_add(&obj->dropped, buf->sequence - obj->last_sequence - 1);
+    }
+    obj->last_sequence = buf->sequence;
+    obj->dequeued = 1;
+}
+
+// 이미 준비된 버퍼를 모두 꺼내고 가장 최신 것만 buf에 남김, 오래된 버퍼는 바로 반환
+/* success: 0 */
+static int v4l2_client_drain(v4l2_client_t *obj, struct v4l2_buffer *buf)
+{
+    for (;;)
+    {
+        struct v4l2_buffer next =
+        {
+            .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+            .memory = V4L2_MEMORY_MMAP,
+        };
+
+        if (ioctl(obj->fd, VIDIOC_DQBUF, &next) < 0)
+        {
+            return errno == EAGAIN ? 0 : 1;
+        }
+        v4l2_client_account(obj, &next);
+        // 드라이버는 순서대로 채우지만 sequence로 한번 더 확인
+        if (next.sequence < buf->sequence)
+        {
+            struct v4l2_buffer stale = next;
+
+            next = *buf;
+            *buf = stale;
+        }
+        if (ioctl(obj->fd, VIDIOC_QBUF, buf) < 0)
+        {
+            *buf = next;
+            return 1;
+        }
+        *buf = next;
+        stats_add(&obj->skipped, 1);
+    }
+}
+
 void *v4l2_client_reader(void *arg)
 {
     v4l2_client_t *obj = arg;
+    struct pollfd pfd[2] =
+    {
+        { .fd = obj->fd, .events = POLLIN },
+        { .fd = obj->event, .events = POLLIN },
+    };
 
     while (obj->stop == 0)
     {
@@ -403,16 +641,47 @@ void *v4l2_client_reader(void *arg)
             .memory = V4L2_MEMORY_MMAP,
         };
 
+        if (poll(pfd, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        if (pfd[1].revents)
+        {
+            break;
+        }
+        // 장치 분리 등
+        if (pfd[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+        {
+            logging("v4l2 device error: 0x%x", pfd[0].revents);
+            break;
+        }
+        if ((pfd[0].revents & POLLIN) == 0)
+        {
+            continue;
+        }
+
         if (ioctl(obj->fd, VIDIOC_DQBUF, &buf) < 0)
         {
-            if (errno == EAGAIN)
+            if (errno == EAGAIN || errno == EINTR)
             {
                 continue;
             }
+            logging("v4l2 dequeue failed: %s", strerror(errno));
+            break;
+        }
+        v4l2_client_account(obj, &buf);
+        if (obj->latest && v4l2_client_drain(obj, &buf))
+        {
             break;
         }
         obj->buf_index = buf.index;
         obj->buf_bytes = buf.bytesused;
+        obj->buf_sequence = buf.sequence;
+        obj->buf_timestamp = buffer_timestamp(&buf);
 
         if (obj->callback)
         {
@@ -424,7 +693,9 @@ void *v4l2_client_reader(void *arg)
             break;
         }
     }
-    logging("v4l2 stopped");
+    logging("v4l2 stopped (skipped: %llu, driver dropped: %llu)", (unsigned long long)stats_get(&obj->skipped), (unsigned long long)stats_get(&obj->dropped));
+
+    return 0;
 }
 
 /* success: 0 */
@@ -436,6 +707,7 @@ int v4l2_client_start(v4l2_client_t *obj)
     }
 
     obj->stop = 0;
+    obj->dequeued = 0;
     obj->event = eventfd(0, 0);
     if (obj->event == -1)
     {
@@ -482,6 +754,48 @@ void v4l2_client_set_callback(v4l2_client_t *obj, v4l2_client_callback_t callbac
     obj->opaque = opaque;
 }
 
+void v4l2_client_set_format(v4l2_client_t *obj, unsigned int width, unsigned int height, uint32_t format)
+{
+    obj->width = width;
+    obj->height = height;
+    obj->format = format;
+}
+
+void v4l2_client_set_fps(v4l2_client_t *obj, unsigned int fps)
+{
+    obj->fps = fps;
+}
+
+void v4l2_client_set_buffer_count(v4l2_client_t *obj, unsigned int count)
+{
+    obj->buffer_count = count ? count : DEFAULT_BUFFER_COUNT;
+}
+
+void v4l2_client_set_latest(v4l2_client_t *obj, int enable)
+{
+    obj->latest = enable;
+}
+
+uint32_t v4l2_client_get_format(v4l2_client_t *obj)
+{
+    return obj->format;
+}
+
+unsigned int v4l2_client_get_width(v4l2_client_t *obj)
+{
+    return obj->frame_width;
+}
+
+unsigned int v4l2_client_get_height(v4l2_client_t *obj)
+{
+    return obj->frame_height;
+}
+
+unsigned int v4l2_client_get_stride(v4l2_client_t *obj)
+{
+    return obj->frame_stride;
+}
+
 void *v4l2_client_get_buffer(v4l2_client_t *obj)
 {
     if (obj->buf_start == 0)
@@ -505,3 +819,23 @@ unsigned int v4l2_client_get_buffer_count(v4l2_client_t *obj)
 {
     return obj->buf_count;
 }
+
+uint32_t v4l2_client_get_buffer_sequence(v4l2_client_t *obj)
+{
+    return obj->buf_sequence;
+}
+
+uint64_t v4l2_client_get_buffer_timestamp(v4l2_client_t *obj)
+{
+    return obj->buf_timestamp;
+}
+
+uint64_t v4l2_client_get_skipped(v4l2_client_t *obj)
+{
+    return stats_get(&obj->skipped);
+}
+
+uint64_t v4l2_client_get_dropped(v4l2_client_t *obj)
+{
+    return stats_get(&obj->dropped);
+}
@@ -1,6 +1,8 @@
 #ifndef V4L2_CLIENT_H
 #define V4L2_CLIENT_H
 
+#include <stdint.h>
+
 struct v4l2_client;
 typedef struct v4l2_client v4l2_client_t;
 typedef void (*v4l2_client_callback_t)(v4l2_client_t *obj, void *opaque);
@@ -14,10 +16,32 @@ void v4l2_client_destroy(v4l2_client_t *obj);
 int v4l2_client_start(v4l2_client_t *obj);
 void v4l2_client_stop(v4l2_client_t *obj);
 void v4l2_client_set_callback(v4l2_client_t *obj, v4l2_client_callback_t callback, void *opaque);
+// 장치가 지원하는 가장 가까운 값으로 협상됨, start 전에 설정
+// format: V4L2_PIX_FMT_* (default: 1920x1080 MJPEG)
+void v4l2_client_set_format(v4l2_client_t *obj, unsigned int width, unsigned int height, uint32_t format);
+// 0: 드라이버 기본값
+void v4l2_client_set_fps(v4l2_client_t *obj, unsigned int fps);
+// default: 4
+void v4l2_client_set_buffer_count(v4l2_client_t *obj, unsigned int count);
+// 지연 우선: 깨어날 때마다 준비된 버퍼를 모두 꺼내 가장 최신 것만 전달
+void v4l2_client_set_latest(v4l2_client_t *obj, int enable);
+
+uint32_t v4l2_client_get_format(v4l2_client_t *obj);
+// start 후 협상된 값, stride: 한 행의 바이트 수 (압축 포맷은 0)
+unsigned int v4l2_client_get_width(v4l2_client_t *obj);
+unsigned int v4l2_client_get_height(v4l2_client_t *obj);
+unsigned int v4l2_client_get_stride(v4l2_client_t *obj);
 
 void *v4l2_client_get_buffer(v4l2_client_t *obj);
 unsigned int v4l2_client_get_buffer_length(v4l2_client_t *obj);
 unsigned int v4l2_client_get_buffer_index(v4l2_client_t *obj);
 unsigned int v4l2_client_get_buffer_count(v4l2_client_t *obj);
+// 드라이버가 붙인 값, timestamp는 CLOCK_MONOTONIC(ns)이 아니면 0
+uint32_t v4l2_client_get_buffer_sequence(v4l2_client_t *obj);
+uint64_t v4l2_client_get_buffer_timestamp(v4l2_client_t *obj);
+// 최신 프레임을 위해 건너뛴 프레임 수
+uint64_t v4l2_client_get_skipped(v4l2_client_t *obj);
+// 드라이버가 버린 프레임 수 (sequence 건너뜀)
+uint64_t v4l2_client_get_dropped(v4l2_client_t *obj);
 
 #endif